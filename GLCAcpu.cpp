@@ -0,0 +1,714 @@
+///\file GLCAcpu.cpp
+///\brief Multi-threaded CPU engine of GLCAlib.
+///
+///Runs the built-in rules without any OpenGL context. The state is kept as bit planes
+///of 64 cells per word, or as planar uint8 cells, surrounded by a ring of zero cells
+///(the same border the textures have); the matrix is split in tiles shared by a thread pool
+///and each row is computed by a kernel vectorized for the available instruction set.
+
+//includes
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <immintrin.h>
+#include "GLCAcpu.h"
+#include "GLCAtrace.h"
+
+using namespace std;
+namespace GLCAlib {
+///rows of a tile, the task of the pool
+const int bandRows = 16;
+///cells of a tile in a row, for the byte kernels
+const int tileCells = 256;
+///words of a tile in a row, for the bit-sliced kernels (a single AVX-512 register)
+const int tileWords = 8;
+
+ThreadPool::ThreadPool(int n) : ranges(n > 0 ? n : (thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1)),
+                                job(NULL), epoch(0), pending(0), quit(false) {
+    //cerr<<"Inside ThreadPool"<<endl;
+    for (int i=1; i<size(); ++i) threads.push_back(thread(&ThreadPool::worker, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for (size_t i=0; i<threads.size(); ++i) threads[i].join();
+}
+
+int ThreadPool::size() const {
+    return ranges.size();
+}
+
+void ThreadPool::parallelFor(int tasks, const function<void(int)>& task) {
+    //cerr<<"Inside parallelFor"<<endl;
+    int n = size();
+    for (int i=0; i<n; ++i) {
+        ranges[i].next.store((long)tasks*i/n, memory_order_relaxed);
+        ranges[i].end = (long)tasks*(i+1)/n;
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        pending = n-1;
+        ++epoch;
+    }
+    wake.notify_all();
+    work(0);
+    unique_lock<std::mutex> lock(mutex);
+    while (pending > 0) done.wait(lock);
+}
+
+///Waits for a job, runs its share and steals from the others
+void ThreadPool::worker(int id) {
+    long seen = 0;
+    for (;;) {
+        {
+            unique_lock<std::mutex> lock(mutex);
+            while (!quit && epoch == seen) wake.wait(lock);
+            if (quit) return;
+            seen = epoch;
+        }
+        work(id);
+        {
+            lock_guard<std::mutex> lock(mutex);
+            --pending;
+        }
+        done.notify_one();
+    }
+}
+
+///Drains the own range of tasks first, then the ones of the other threads
+void ThreadPool::work(int id) {
+    int n = size();
+    for (int v=0; v<n; ++v) {
+        Range& range = ranges[(id+v)%n];
+        for (int i = range.next.fetch_add(1); i < range.end; i = range.next.fetch_add(1))
+            (*job)(i);
+    }
+}
+
+///\brief Two state rules, cells are 0 (dead) or 1 (alive)
+///
+///The live neighbours are just summed up and the rule looks up its births and survivals.
+void lifeRow(const unsigned char* up, const unsigned char* row, const unsigned char* down, unsigned char* out, int x, const struct_rule& rule) {
+    for (int j=0; j<x; ++j) {
+        int sum = up[j-1] + up[j] + up[j+1] + row[j-1] + row[j+1] + down[j-1] + down[j] + down[j+1];
+        out[j] = (rule.life >> (sum + 9*row[j])) & 1;
+    }
+}
+
+///\brief Any rule on its table, cells in a state the rule does not know die
+void tableRow(const unsigned char* up, const unsigned char* row, const unsigned char* down, unsigned char* out, int x, const struct_rule& rule) {
+    const unsigned char k = rule.counted;
+    for (int j=0; j<x; ++j) {
+        int n = (up[j-1]==k) + (up[j]==k) + (up[j+1]==k) + (row[j-1]==k) + (row[j+1]==k) +
+                (down[j-1]==k) + (down[j]==k) + (down[j+1]==k);
+        out[j] = row[j] < rule.states ? rule.next[9*row[j]+n] : 0;
+    }
+}
+
+///\brief Births (state 0) or survivals (state 1) of a two state rule by live neighbours, a byte each
+inline __m128i lifeLUT(const struct_rule& rule, int state) {
+    alignas(16) unsigned char lut[16] = {0};
+    for (int n=0; n<9; ++n) lut[n] = (rule.life >> (n + 9*state)) & 1;
+    return _mm_load_si128((const __m128i*)lut);
+}
+
+__attribute__((target("avx2")))
+void lifeRowAVX2(const unsigned char* up, const unsigned char* row, const unsigned char* down, unsigned char* out, int x, const struct_rule& rule) {
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i born = _mm256_broadcastsi128_si256(lifeLUT(rule, 0)), survives = _mm256_broadcastsi128_si256(lifeLUT(rule, 1));
+    int j=0;
+    for (; j+32<=x; j+=32) {
+        __m256i sum = _mm256_add_epi8(_mm256_loadu_si256((const __m256i*)(up+j-1)), _mm256_loadu_si256((const __m256i*)(up+j)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i*)(up+j+1)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i*)(row+j-1)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i*)(row+j+1)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i*)(down+j-1)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i*)(down+j)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i*)(down+j+1)));
+        __m256i alive = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(row+j)), one);
+        __m256i next = _mm256_blendv_epi8(_mm256_shuffle_epi8(born, sum), _mm256_shuffle_epi8(survives, sum), alive);
+        _mm256_storeu_si256((__m256i*)(out+j), next);
+    }
+    lifeRow(up+j, row+j, down+j, out+j, x-j, rule);
+}
+
+///\brief Any rule on its table: the counted neighbours index the row of each state with a byte shuffle
+__attribute__((target("avx2")))
+void tableRowAVX2(const unsigned char* up, const unsigned char* row, const unsigned char* down, unsigned char* out, int x, const struct_rule& rule) {
+    const __m256i counted = _mm256_set1_epi8(rule.counted);
+    const int states = rule.states;
+    int j=0;
+    for (; j+32<=x; j+=32) {
+        //counted neighbours are -1 each
+        __m256i n = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(up+j-1)), counted);
+        n = _mm256_add_epi8(n, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(up+j)), counted));
+        n = _mm256_add_epi8(n, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(up+j+1)), counted));
+        n = _mm256_add_epi8(n, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(row+j-1)), counted));
+        n = _mm256_add_epi8(n, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(row+j+1)), counted));
+        n = _mm256_add_epi8(n, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(down+j-1)), counted));
+        n = _mm256_add_epi8(n, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(down+j)), counted));
+        n = _mm256_add_epi8(n, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(down+j+1)), counted));
+        n = _mm256_sub_epi8(_mm256_setzero_si256(), n);
+
+        __m256i c = _mm256_loadu_si256((const __m256i*)(row+j));
+        __m256i next = _mm256_setzero_si256();
+        for (int s=0; s<states; ++s) {
+            __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&rule.rows[16*s]));
+            next = _mm256_blendv_epi8(next, _mm256_shuffle_epi8(lut, n), _mm256_cmpeq_epi8(c, _mm256_set1_epi8(s)));
+        }
+        _mm256_storeu_si256((__m256i*)(out+j), next);
+    }
+    tableRow(up+j, row+j, down+j, out+j, x-j, rule);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void lifeRowAVX512(const unsigned char* up, const unsigned char* row, const unsigned char* down, unsigned char* out, int x, const struct_rule& rule) {
+    const __m512i one = _mm512_set1_epi8(1);
+    const __m512i born = _mm512_broadcast_i32x4(lifeLUT(rule, 0)), survives = _mm512_broadcast_i32x4(lifeLUT(rule, 1));
+    int j=0;
+    for (; j+64<=x; j+=64) {
+        __m512i sum = _mm512_add_epi8(_mm512_loadu_si512(up+j-1), _mm512_loadu_si512(up+j));
+        sum = _mm512_add_epi8(sum, _mm512_loadu_si512(up+j+1));
+        sum = _mm512_add_epi8(sum, _mm512_loadu_si512(row+j-1));
+        sum = _mm512_add_epi8(sum, _mm512_loadu_si512(row+j+1));
+        sum = _mm512_add_epi8(sum, _mm512_loadu_si512(down+j-1));
+        sum = _mm512_add_epi8(sum, _mm512_loadu_si512(down+j));
+        sum = _mm512_add_epi8(sum, _mm512_loadu_si512(down+j+1));
+        __mmask64 alive = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(row+j), one);
+        __m512i next = _mm512_mask_shuffle_epi8(_mm512_shuffle_epi8(born, sum), alive, survives, sum);
+        _mm512_storeu_si512(out+j, next);
+    }
+    lifeRow(up+j, row+j, down+j, out+j, x-j, rule);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void tableRowAVX512(const unsigned char* up, const unsigned char* row, const unsigned char* down, unsigned char* out, int x, const struct_rule& rule) {
+    const __m512i one = _mm512_set1_epi8(1), counted = _mm512_set1_epi8(rule.counted);
+    const int states = rule.states;
+    int j=0;
+    for (; j+64<=x; j+=64) {
+        __m512i n = _mm512_maskz_mov_epi8(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512(up+j-1), counted), one);
+        n = _mm512_mask_add_epi8(n, _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(up+j), counted), n, one);
+        n = _mm512_mask_add_epi8(n, _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(up+j+1), counted), n, one);
+        n = _mm512_mask_add_epi8(n, _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(row+j-1), counted), n, one);
+        n = _mm512_mask_add_epi8(n, _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(row+j+1), counted), n, one);
+        n = _mm512_mask_add_epi8(n, _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(down+j-1), counted), n, one);
+        n = _mm512_mask_add_epi8(n, _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(down+j), counted), n, one);
+        n = _mm512_mask_add_epi8(n, _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(down+j+1), counted), n, one);
+
+        __m512i c = _mm512_loadu_si512(row+j);
+        __m512i next = _mm512_setzero_si512();
+        for (int s=0; s<states; ++s) {
+            __m512i lut = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)&rule.rows[16*s]));
+            next = _mm512_mask_shuffle_epi8(next, _mm512_cmpeq_epi8_mask(c, _mm512_set1_epi8(s)), lut, n);
+        }
+        _mm512_storeu_si512(out+j, next);
+    }
+    tableRow(up+j, row+j, down+j, out+j, x-j, rule);
+}
+
+///\brief Two state rules on their neighbourhood table
+///
+///The 9 bit index of each cell is slid along the row: the column that leaves is shifted
+///out and the new one comes in, 3 loads per cell whatever the rule.
+void lookupRow(const unsigned char* up, const unsigned char* row, const unsigned char* down, unsigned char* out, int x, const struct_rule& rule) {
+    const unsigned char* table = &rule.neighbourhood[0];
+    //cerr<<"column j of the index: bits 0, 3 and 6 for the cells above, beside and below"<<endl;
+    unsigned int index = 0;
+    for (int j=-1; j<1; ++j)
+        index = (index>>1 & 0xdb) | (up[j]!=0)<<2 | (row[j]!=0)<<5 | (down[j]!=0)<<8;
+    for (int j=0; j<x; ++j) {
+        index = (index>>1 & 0xdb) | (up[j+1]!=0)<<2 | (row[j+1]!=0)<<5 | (down[j+1]!=0)<<8;
+        out[j] = table[index];
+    }
+}
+
+///\brief Chooses the best kernel of a built-in rule for this CPU
+///
+///The vector kernels are compiled for their instruction set only, so the library
+///runs on any x86-64 and picks them at runtime.
+RowKernel cpuKernel(BuiltinRule rule, const char** name) {
+    //cerr<<"Inside cpuKernel"<<endl;
+    if (lookupRule(ruleTable(rule))) {
+        *name = "lookup table";
+        return lookupRow;
+    }
+    bool life = ruleTable(rule).states == 2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        *name = "AVX-512";
+        return life ? lifeRowAVX512 : tableRowAVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "AVX2";
+        return life ? lifeRowAVX2 : tableRowAVX2;
+    }
+    *name = "scalar";
+    return life ? lifeRow : tableRow;
+}
+
+///4 words of bit planes in an AVX2 register
+typedef uint64_t words4 __attribute__((vector_size(32)));
+///8 words of bit planes in an AVX-512 register
+typedef uint64_t words8 __attribute__((vector_size(64)));
+
+///\brief Loads the words at p into v
+///
+///The words go by reference: these helpers have no target of their own, and passing
+///an AVX vector by value outside the kernels would change the ABI.
+template<class V> __attribute__((always_inline)) inline void loadWords(V& v, const uint64_t* p) {
+    memcpy(&v, p, sizeof(V));
+}
+
+template<class V> __attribute__((always_inline)) inline void storeWords(uint64_t* p, const V& v) {
+    memcpy(p, &v, sizeof(V));
+}
+
+///\brief Word of the plane whose neighbours are counted: the cell plane, or the heads for Wireworld
+template<class V, bool Heads> __attribute__((always_inline)) inline void countedWord(V& v, const uint64_t* p, long planeStride) {
+    loadWords(v, p);
+    if (!Heads) return;
+    V heads;
+    loadWords(heads, p+planeStride);
+    v = heads & ~v;
+}
+
+///\brief Counts the neighbours of the cells of a word, in bit-sliced form
+///
+///Same carry-save adders of the bit-packed shader: the neighbour words are shifted so
+///that each bit lines up with its cell, then added with full adders into the bits s0,
+///s1, s2 and s3 of the count.
+template<class V, bool Heads> __attribute__((always_inline)) inline void countNeighbours(const uint64_t* row, long stride, long planeStride, V& s0, V& s1, V& s2, V& s3) {
+    const uint64_t* up = row-stride;
+    const uint64_t* down = row+stride;
+    V n, c, s, nw, ne, sw, se, w, e;
+    countedWord<V, Heads>(n, up, planeStride);
+    countedWord<V, Heads>(c, row, planeStride);
+    countedWord<V, Heads>(s, down, planeStride);
+    countedWord<V, Heads>(nw, up-1, planeStride);
+    countedWord<V, Heads>(ne, up+1, planeStride);
+    countedWord<V, Heads>(sw, down-1, planeStride);
+    countedWord<V, Heads>(se, down+1, planeStride);
+    countedWord<V, Heads>(w, row-1, planeStride);
+    countedWord<V, Heads>(e, row+1, planeStride);
+    nw = (n << 1) | (nw >> 63), ne = (n >> 1) | (ne << 63);
+    sw = (s << 1) | (sw >> 63), se = (s >> 1) | (se << 63);
+    w = (c << 1) | (w >> 63), e = (c >> 1) | (e << 63);
+    V upSum = nw ^ n ^ ne, upCarry = (nw & n) | (ne & (nw ^ n));
+    V downSum = sw ^ s ^ se, downCarry = (sw & s) | (se & (sw ^ s));
+    V we = w ^ e;
+    V onesCarry = (upSum & downSum) | (we & (upSum ^ downSum));
+    V twos = upCarry ^ downCarry ^ (w & e), twosCarry = (upCarry & downCarry) | ((w & e) & (upCarry ^ downCarry));
+    s0 = upSum ^ downSum ^ we;
+    s1 = twos ^ onesCarry;
+    s2 = twosCarry ^ (twos & onesCarry);
+    s3 = twosCarry & twos & onesCarry;
+}
+
+///\brief Two state rule on one plane, see struct_rule::life
+///
+///Branch-free: each count n adds its minterm s3..s0 == n, masked by the cells it makes live.
+///When life is a compile-time constant only the minterms of the rule are left.
+template<class V> __attribute__((always_inline)) inline void lifeWords(const uint64_t* row, uint64_t* out, long stride, long planeStride, uint32_t life) {
+    V s0, s1, s2, s3;
+    countNeighbours<V, false>(row, stride, planeStride, s0, s1, s2, s3);
+    V c, next = V();
+    loadWords(c, row);
+#pragma GCC unroll 9
+    for (int n=0; n<9; ++n) {
+        V count = (n&1 ? s0 : ~s0) & (n&2 ? s1 : ~s1) & (n&4 ? s2 : ~s2) & (n&8 ? s3 : ~s3);
+        uint64_t born = -(uint64_t)((life >> n) & 1), survives = -(uint64_t)((life >> (9+n)) & 1);
+        next |= count & ((c & survives) | (~c & born));
+    }
+    storeWords<V>(out, next);
+}
+
+///\brief Wireworld on two planes: blank 00, copper 01, head 10, tail 11 (plane 1, plane 0)
+///
+///Heads become tails and tails copper, copper becomes an head with 1 or 2 head neighbours.
+template<class V> __attribute__((always_inline)) inline void wireworldWords(const uint64_t* row, uint64_t* out, long stride, long planeStride) {
+    V s0, s1, s2, s3;
+    countNeighbours<V, true>(row, stride, planeStride, s0, s1, s2, s3);
+    V b0, b1;
+    loadWords(b0, row);
+    loadWords(b1, row+planeStride);
+    V copper = b0 & ~b1, fires = (s0 ^ s1) & ~s2 & ~s3;
+    storeWords<V>(out, b1 | (copper & ~fires));
+    storeWords<V>(out+planeStride, (b1 & ~b0) | (copper & fires));
+}
+
+///\brief Births and survivals of the kernels, read from the rule when it is compiled
+struct RuntimeLife {
+    uint32_t life;
+    RuntimeLife(uint32_t l) : life(l) {}
+    operator uint32_t() const { return life; }
+};
+
+///\brief Births and survivals of the kernels of a common rule, built at compile time
+template<uint32_t Life> struct ConstantLife {
+    ConstantLife(uint32_t) {}
+    constexpr operator uint32_t() const { return Life; }
+};
+
+template<class L> void lifeSliced(const uint64_t* row, uint64_t* out, long stride, long planeStride, int words, uint64_t lastMask, uint32_t life) {
+    L table(life);
+    for (int k=0; k<words; ++k) lifeWords<uint64_t>(row+k, out+k, stride, planeStride, table);
+    out[words-1] &= lastMask;
+}
+
+void wireworldSliced(const uint64_t* row, uint64_t* out, long stride, long planeStride, int words, uint64_t lastMask, uint32_t) {
+    for (int k=0; k<words; ++k) wireworldWords<uint64_t>(row+k, out+k, stride, planeStride);
+    out[words-1] &= lastMask;
+    out[planeStride+words-1] &= lastMask;
+}
+
+template<class L> __attribute__((target("avx2")))
+void lifeSlicedAVX2(const uint64_t* row, uint64_t* out, long stride, long planeStride, int words, uint64_t lastMask, uint32_t life) {
+    L table(life);
+    int k=0;
+    for (; k+4<=words; k+=4) lifeWords<words4>(row+k, out+k, stride, planeStride, table);
+    for (; k<words; ++k) lifeWords<uint64_t>(row+k, out+k, stride, planeStride, table);
+    out[words-1] &= lastMask;
+}
+
+__attribute__((target("avx2")))
+void wireworldSlicedAVX2(const uint64_t* row, uint64_t* out, long stride, long planeStride, int words, uint64_t lastMask, uint32_t) {
+    int k=0;
+    for (; k+4<=words; k+=4) wireworldWords<words4>(row+k, out+k, stride, planeStride);
+    for (; k<words; ++k) wireworldWords<uint64_t>(row+k, out+k, stride, planeStride);
+    out[words-1] &= lastMask;
+    out[planeStride+words-1] &= lastMask;
+}
+
+template<class L> __attribute__((target("avx512f,avx512bw")))
+void lifeSlicedAVX512(const uint64_t* row, uint64_t* out, long stride, long planeStride, int words, uint64_t lastMask, uint32_t life) {
+    L table(life);
+    int k=0;
+    for (; k+8<=words; k+=8) lifeWords<words8>(row+k, out+k, stride, planeStride, table);
+    for (; k+4<=words; k+=4) lifeWords<words4>(row+k, out+k, stride, planeStride, table);
+    for (; k<words; ++k) lifeWords<uint64_t>(row+k, out+k, stride, planeStride, table);
+    out[words-1] &= lastMask;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void wireworldSlicedAVX512(const uint64_t* row, uint64_t* out, long stride, long planeStride, int words, uint64_t lastMask, uint32_t) {
+    int k=0;
+    for (; k+8<=words; k+=8) wireworldWords<words8>(row+k, out+k, stride, planeStride);
+    for (; k+4<=words; k+=4) wireworldWords<words4>(row+k, out+k, stride, planeStride);
+    for (; k<words; ++k) wireworldWords<uint64_t>(row+k, out+k, stride, planeStride);
+    out[words-1] &= lastMask;
+    out[planeStride+words-1] &= lastMask;
+}
+
+///instruction sets of the kernels
+enum Isa { SCALAR, AVX2, AVX512 };
+
+///\brief Two state rules whose bit-sliced kernels are specialized at compile time
+///
+///Life, HighLife, Day & Night, Seeds, Life without death, Replicator, Morley and 2x2;
+///the other rules run the same kernels with their table read at runtime.
+constexpr uint32_t commonRules[] = {
+    lifeTable("B3/S23"), lifeTable("B36/S23"), lifeTable("B3678/S34678"), lifeTable("B2/S"),
+    lifeTable("B3/S012345678"), lifeTable("B1357/S1357"), lifeTable("B368/S245"), lifeTable("B36/S125")
+};
+const int commonRuleCount = sizeof(commonRules)/sizeof(commonRules[0]);
+
+template<class L> SlicedKernel lifeKernel(Isa isa) {
+    if (isa == AVX512) return lifeSlicedAVX512<L>;
+    if (isa == AVX2) return lifeSlicedAVX2<L>;
+    return lifeSliced<L>;
+}
+
+///\brief The specialized kernel of commonRules[I] or of a later one, the runtime kernel if none matches
+template<int I> SlicedKernel commonKernel(uint32_t life, Isa isa) {
+    if (life == commonRules[I]) return lifeKernel<ConstantLife<commonRules[I]> >(isa);
+    return commonKernel<I+1>(life, isa);
+}
+
+template<> SlicedKernel commonKernel<commonRuleCount>(uint32_t, Isa isa) {
+    return lifeKernel<RuntimeLife>(isa);
+}
+
+///\brief Chooses the best bit-sliced kernel of a built-in rule for this CPU
+SlicedKernel slicedKernel(BuiltinRule rule, const char** name) {
+    //cerr<<"Inside slicedKernel"<<endl;
+    __builtin_cpu_init();
+    Isa isa = SCALAR;
+    *name = "bit-sliced scalar";
+    if (__builtin_cpu_supports("avx512bw")) {
+        isa = AVX512;
+        *name = "bit-sliced AVX-512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        isa = AVX2;
+        *name = "bit-sliced AVX2";
+    }
+    if (rule == WIREWORLD) return isa == AVX512 ? wireworldSlicedAVX512 : isa == AVX2 ? wireworldSlicedAVX2 : wireworldSliced;
+    return commonKernel<0>(ruleTable(rule).life, isa);
+}
+
+///@return the bit planes of the states of a rule, 0 if it has no bit-sliced kernel
+int statePlanes(BuiltinRule rule) {
+    if (rule == WIREWORLD) return 2;
+    return ruleTable(rule).states == 2 && ruleTable(rule).totalistic ? 1 : 0;
+}
+
+///\brief Runs a generation at a time on the pool, swapping A and B after each one
+///
+///With engine.active_tiles the worklist of each generation only holds the tiles that
+///changed in the last one, or have a neighbour that did: the others are the same in A and B.
+///@param[in] tiles_x, tiles_y: tiles of the matrix in each direction\n
+///@param[in] width, height: cells of a tile in each direction, for activity()\n
+///@param[in] tile: computes the tile (tx, ty) of the next generation from A into B,
+///returns TRUE if it changed
+///@return the number of generations computed
+template<class T> long evolve(ThreadPool& pool, long iterations, int tiles_x, int tiles_y, int width, int height,
+                              T*& A, T*& B, const function<bool(const T*, T*, int, int)>& tile) {
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    int tiles = tiles_x*tiles_y;
+    vector<unsigned char> changed(tiles, 1), next(tiles, 0);
+    vector<int> worklist;
+    long long updates = 0;
+    long n;
+    for (n=0; n!=iterations; ++n) {
+        TraceScope scope("generation");
+        worklist.clear();
+        for (int ty=0; ty<tiles_y; ++ty)
+            for (int tx=0; tx<tiles_x; ++tx) {
+                bool active = !engine.active_tiles || n == 0;
+                for (int dy=-1; dy<=1 && !active; ++dy)
+                    for (int dx=-1; dx<=1 && !active; ++dx)
+                        if (ty+dy >= 0 && ty+dy < tiles_y && tx+dx >= 0 && tx+dx < tiles_x)
+                            active = changed[(ty+dy)*tiles_x+tx+dx];
+                if (active) worklist.push_back(ty*tiles_x+tx);
+            }
+        pool.parallelFor(worklist.size(), [&](int i) {
+            int t = worklist[i];
+            next[t] = tile(A, B, t%tiles_x, t/tiles_x);
+        });
+        updates += worklist.size();
+        changed.swap(next);
+        fill(next.begin(), next.end(), 0);
+        T* tmp=A;
+        A=B;
+        B=tmp;
+    }
+
+    lastActivity.tiles_x = tiles_x;
+    lastActivity.tiles_y = tiles_y;
+    lastActivity.tile_width = width;
+    lastActivity.tile_height = height;
+    lastActivity.updates = updates;
+    lastActivity.total = (long long)n*tiles;
+    lastActivityMap = changed;
+    lastTiming.compute = chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    return n;
+}
+
+///\brief Runs a built-in rule with one byte per cell
+long runBytes(ThreadPool& pool, unsigned char* states, int x, int y, BuiltinRule rule, long iterations) {
+    //cerr<<"Inside runBytes"<<endl;
+    const char* isa;
+    RowKernel kernel = cpuKernel(rule, &isa);
+    const struct_rule& table = ruleTable(rule);
+    cout<<"CPU - "<<isa<<" - "<<pool.size()<<" threads, x="<<x<<", y="<<y<<", numIter="<<iterations<<endl;
+    snprintf(lastTiming.renderer, sizeof(lastTiming.renderer), "CPU %s", isa);
+
+    //cerr<<"planar states with a zero border"<<endl;
+    int w = x+2;
+    vector<unsigned char> bufferA((size_t)w*(y+2), 0), bufferB((size_t)w*(y+2), 0);
+    unsigned char* A = &bufferA[0];
+    unsigned char* B = &bufferB[0];
+    for (int i=0; i<y; ++i)
+        for (int j=0; j<x; ++j) {
+            unsigned char c = states[(size_t)x*i+j];
+            A[(size_t)w*(i+1)+j+1] = table.states == 2 ? c!=0 : c;
+        }
+
+    long n = evolve<unsigned char>(pool, iterations, (x+tileCells-1)/tileCells, (y+bandRows-1)/bandRows, tileCells, bandRows, A, B,
+                                   [&](const unsigned char* from, unsigned char* to, int tx, int ty) {
+        int j = tx*tileCells+1;
+        int cells = x+1-j < tileCells ? x+1-j : tileCells;
+        bool changed = !engine.active_tiles;
+        for (int i = ty*bandRows+1; i <= y && i <= (ty+1)*bandRows; ++i) {
+            size_t row = (size_t)w*i+j;
+            kernel(from+row-w, from+row, from+row+w, to+row, cells, table);
+            changed = changed || memcmp(from+row, to+row, cells);
+        }
+        return changed;
+    });
+
+    for (int i=0; i<y; ++i) memcpy(states+(size_t)x*i, A+(size_t)w*(i+1)+1, x);
+    return n;
+}
+
+///\brief Next state of the 2x2 cells at the centre of each 4x4 square of cells
+///
+///Bit 4*r+k of the index is the cell in row r and column k of the square, bits 0 and 1 of
+///the entry the cells of its second row, bits 2 and 3 the ones of the third.
+void blockTable(const struct_rule& rule, vector<unsigned char>& table) {
+    table.resize(65536);
+    for (int i=0; i<65536; ++i) {
+        unsigned char next = 0;
+        for (int a=0; a<2; ++a)
+            for (int b=0; b<2; ++b) {
+                int index = 0;
+                for (int dy=0; dy<3; ++dy) index |= ((i >> (4*(a+dy)+b)) & 7) << 3*dy;
+                next |= rule.neighbourhood[index] << (2*a+b);
+            }
+        table[i] = next;
+    }
+}
+
+///\brief The cells p[-1] ... p[2], 0 or 1 each, as the bits of a nibble
+///
+///The multiplication moves bit 0 of byte k to bit 24+k, the other products never reach those bits.
+inline unsigned int cellNibble(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p-1, 4);
+    return (v * 0x01020408u) >> 24 & 15;
+}
+
+///\brief Computes two rows of a two state rule on its blocks table, 2x2 cells per lookup
+///@param[in] rows: 2, or 1 when the second row is the zero border
+void blockRows(const unsigned char* up, const unsigned char* row, unsigned char* out, long w, int x, int rows, const unsigned char* table) {
+    for (int j=0; j<x; j+=2) {
+        unsigned int next = table[cellNibble(up+j) | cellNibble(row+j)<<4 | cellNibble(row+w+j)<<8 | cellNibble(row+2*w+j)<<12];
+        out[j] = next & 1;
+        if (j+1 < x) out[j+1] = next>>1 & 1;
+        if (rows < 2) continue;
+        out[w+j] = next>>2 & 1;
+        if (j+1 < x) out[w+j+1] = next>>3;
+    }
+}
+
+///\brief Runs a two state rule on its neighbourhood table, see struct_engine::lookup_table
+long runBlocks(ThreadPool& pool, unsigned char* states, int x, int y, BuiltinRule rule, long iterations) {
+    //cerr<<"Inside runBlocks"<<endl;
+    vector<unsigned char> table;
+    blockTable(ruleTable(rule), table);
+    cout<<"CPU - lookup table 2x2 - "<<pool.size()<<" threads, x="<<x<<", y="<<y<<", numIter="<<iterations<<endl;
+    strcpy(lastTiming.renderer, "CPU lookup table 2x2");
+
+    //cerr<<"planar states with a zero border, and a row more read by the last blocks"<<endl;
+    int w = x+2;
+    vector<unsigned char> bufferA((size_t)w*(y+3)+4, 0), bufferB((size_t)w*(y+3)+4, 0);
+    unsigned char* A = &bufferA[0];
+    unsigned char* B = &bufferB[0];
+    for (int i=0; i<y; ++i)
+        for (int j=0; j<x; ++j) A[(size_t)w*(i+1)+j+1] = states[(size_t)x*i+j]!=0;
+
+    long n = evolve<unsigned char>(pool, iterations, (x+tileCells-1)/tileCells, (y+bandRows-1)/bandRows, tileCells, bandRows, A, B,
+                                   [&](const unsigned char* from, unsigned char* to, int tx, int ty) {
+        int j = tx*tileCells+1;
+        int cells = x+1-j < tileCells ? x+1-j : tileCells;
+        bool changed = !engine.active_tiles;
+        for (int i = ty*bandRows+1; i <= y && i <= (ty+1)*bandRows; i+=2) {
+            size_t row = (size_t)w*i+j;
+            int rows = i < y ? 2 : 1;
+            blockRows(from+row-w, from+row, to+row, w, cells, rows, &table[0]);
+            changed = changed || memcmp(from+row, to+row, cells) || (rows == 2 && memcmp(from+row+w, to+row+w, cells));
+        }
+        return changed;
+    });
+
+    for (int i=0; i<y; ++i) memcpy(states+(size_t)x*i, A+(size_t)w*(i+1)+1, x);
+    return n;
+}
+
+///\brief Runs a built-in rule on bit planes, 64 cells per word
+long runSliced(ThreadPool& pool, unsigned char* states, int x, int y, BuiltinRule rule, long iterations) {
+    //cerr<<"Inside runSliced"<<endl;
+    const char* isa;
+    SlicedKernel kernel = slicedKernel(rule, &isa);
+    uint32_t life = ruleTable(rule).life;
+    cout<<"CPU - "<<isa<<" - "<<pool.size()<<" threads, x="<<x<<", y="<<y<<", numIter="<<iterations<<endl;
+    snprintf(lastTiming.renderer, sizeof(lastTiming.renderer), "CPU %s", isa);
+
+    //cerr<<"bit planes with a zero border"<<endl;
+    int planes = statePlanes(rule);
+    int words = (x+63)/64;
+    long stride = words+2;
+    long planeStride = stride*(y+2);
+    uint64_t lastMask = x%64 ? (1ull<<(x%64))-1 : ~0ull;
+    vector<uint64_t> bufferA(planes*planeStride, 0), bufferB(planes*planeStride, 0);
+    uint64_t* A = &bufferA[0];
+    uint64_t* B = &bufferB[0];
+    for (int i=0; i<y; ++i)
+        for (int k=0; k<words; ++k) {
+            const unsigned char* cells = states+(size_t)x*i+64*k;
+            int n = x-64*k < 64 ? x-64*k : 64;
+            for (int p=0; p<planes; ++p) {
+                uint64_t word = 0;
+                for (int b=0; b<n; ++b)
+                    word |= (uint64_t)(planes == 1 ? cells[b]!=0 : (cells[b]>>p) & 1)<<b;
+                A[p*planeStride+stride*(i+1)+1+k] = word;
+            }
+        }
+
+    long n = evolve<uint64_t>(pool, iterations, (words+tileWords-1)/tileWords, (y+bandRows-1)/bandRows, 64*tileWords, bandRows, A, B,
+                              [&](const uint64_t* from, uint64_t* to, int tx, int ty) {
+        int k = tx*tileWords+1;
+        int count = words+1-k < tileWords ? words+1-k : tileWords;
+        uint64_t mask = k+count == words+1 ? lastMask : ~0ull;
+        bool changed = !engine.active_tiles;
+        for (int i = ty*bandRows+1; i <= y && i <= (ty+1)*bandRows; ++i) {
+            long row = stride*i+k;
+            kernel(from+row, to+row, stride, planeStride, count, mask, life);
+            for (int p=0; p<planes && !changed; ++p)
+                changed = memcmp(from+row+p*planeStride, to+row+p*planeStride, count*sizeof(uint64_t));
+        }
+        return changed;
+    });
+
+    for (int i=0; i<y; ++i)
+        for (int k=0; k<words; ++k) {
+            unsigned char* cells = states+(size_t)x*i+64*k;
+            int n = x-64*k < 64 ? x-64*k : 64;
+            for (int b=0; b<n; ++b) cells[b] = 0;
+            for (int p=0; p<planes; ++p) {
+                uint64_t word = A[p*planeStride+stride*(i+1)+1+k];
+                for (int b=0; b<n; ++b) cells[b] |= ((word>>b) & 1)<<p;
+            }
+        }
+    return n;
+}
+
+///\brief Runs a built-in rule on the CPU backend
+///
+///The matrix is split in tiles of bandRows rows, the tiles of each generation are shared
+///by a pool of engine.cpu_threads threads (only the active ones with engine.active_tiles). Cells are bit-sliced unless
+///engine.cpu_bit_sliced is FALSE or the rule has more than two states (WIREWORLD excepted), two state rules
+///run 2x2 cells at a time on their neighbourhood table with engine.lookup_table.
+///@param[in,out] states: one byte per cell, overwritten with the final state\n
+///@param[in] x: width of the automaton\n
+///@param[in] y: height of the automaton\n
+///@param[in] rule: the built-in rule\n
+///@param[in] iterations: length of the computation in generations
+void runCPU(unsigned char* states, int x, int y, BuiltinRule rule, long iterations) {
+    //cerr<<"Inside runCPU"<<endl;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    memset(&lastTiming, 0, sizeof(lastTiming));
+    long n;
+    {
+        TraceScope scope("runCPU");
+        ThreadPool pool(engine.cpu_threads);
+        if (lookupRule(ruleTable(rule))) n = runBlocks(pool, states, x, y, rule, iterations);
+        else if (engine.cpu_bit_sliced && statePlanes(rule) > 0) n = runSliced(pool, states, x, y, rule, iterations);
+        else n = runBytes(pool, states, x, y, rule, iterations);
+    }
+    lastTiming.total = chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    lastTiming.setup = lastTiming.total-lastTiming.compute;
+    lastTiming.generations = n;
+    lastTiming.cells = (long long)x*y;
+    if (lastTiming.compute > 0) cout<<"CPU Iterations/sec: "<<(long)(n/lastTiming.compute)<<endl;
+    totals.generations += n;
+    traceCounters();
+    writeTrace();
+}
+}//END NAMESPACE
@@ -0,0 +1,102 @@
+///\file GLCAcpu.h
+///\brief Multi-threaded CPU engine of GLCAlib.
+///
+///Internal interface between GLCAlib.cpp and the CPU backend, not part of the public API.
+
+#ifndef GLCAcpu_H
+#define GLCAcpu_H
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "GLCAlib.h"
+#include "GLCArule.h"
+
+namespace GLCAlib {
+///\brief Pool of threads running the bands of a generation, with work stealing
+///
+///Each thread starts from its own contiguous range of tasks, for cache locality, and
+///when it runs out steals single tasks from the ranges of the other threads.
+///The calling thread takes part in the work as thread 0.
+class ThreadPool {
+public:
+    ///@param[in] threads: number of threads, calling thread included (0 = one per core)
+    ThreadPool(int threads);
+    ~ThreadPool();
+    ///\brief Runs task(0) ... task(tasks-1) on the pool and waits for all of them
+    void parallelFor(int tasks, const std::function<void(int)>& task);
+    ///@return the number of threads, calling thread included
+    int size() const;
+
+private:
+    ///range of tasks owned by a thread, on its own cache line
+    struct alignas(64) Range {
+        std::atomic<int> next;
+        int end;
+    };
+    void worker(int id);
+    void work(int id);
+
+    std::vector<std::thread> threads;
+    std::vector<Range> ranges;
+    const std::function<void(int)>* job;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    long epoch;
+    int pending;
+    bool quit;
+};
+
+///\brief Computes one row of a built-in rule on planar uint8 states
+///
+///All pointers address the first cell of a row with a zero cell on both sides.
+///@param[in] up: row above\n
+///@param[in] row: current row\n
+///@param[in] down: row below\n
+///@param[out] out: next generation of row\n
+///@param[in] x: cells in the row\n
+///@param[in] rule: table of the rule
+typedef void (*RowKernel)(const unsigned char* up, const unsigned char* row, const unsigned char* down, unsigned char* out, int x, const struct_rule& rule);
+
+///\brief Chooses the best kernel of a built-in rule for this CPU (scalar, AVX2 or AVX-512)
+///@param[out] name: instruction set of the chosen kernel
+RowKernel cpuKernel(BuiltinRule rule, const char** name);
+
+///\brief Computes one row of a built-in rule on bit-sliced states
+///
+///Bit p of the state of cell 64*k+i is bit i of word k of plane p. Rows have a zero
+///word on both sides, and the planes a zero row above and below.
+///@param[in] row: first word of the row in plane 0\n
+///@param[out] out: first word of the next generation of row in plane 0\n
+///@param[in] stride: words between two rows\n
+///@param[in] planeStride: words between two planes\n
+///@param[in] words: words in the row\n
+///@param[in] lastMask: cells of the last word that belong to the automaton\n
+///@param[in] life: births and survivals of a two state rule, see struct_rule::life
+typedef void (*SlicedKernel)(const uint64_t* row, uint64_t* out, long stride, long planeStride, int words, uint64_t lastMask, uint32_t life);
+
+///\brief Chooses the best bit-sliced kernel of a built-in rule for this CPU (scalar, AVX2 or AVX-512)
+///@param[out] name: instruction set of the chosen kernel
+SlicedKernel slicedKernel(BuiltinRule rule, const char** name);
+
+///activity of the last computation, see activity()
+extern struct_activity lastActivity;
+///times of the last computation, see timing()
+extern struct_timing lastTiming;
+///tiles that changed in the last pass of the last computation
+extern std::vector<unsigned char> lastActivityMap;
+
+///\brief Runs a built-in rule on the CPU backend
+///@param[in,out] states: one byte per cell, overwritten with the final state\n
+///@param[in] x: width of the automaton\n
+///@param[in] y: height of the automaton\n
+///@param[in] rule: the built-in rule\n
+///@param[in] iterations: length of the computation in generations
+void runCPU(unsigned char* states, int x, int y, BuiltinRule rule, long iterations);
+}
+
+#endif
@@ -0,0 +1,375 @@
+///\file GLCAhash.cpp
+///\brief HashLife engine of GLCAlib.
+///
+///Implements the algorithm of Gosper [15] for the built-in rules: the universe is a
+///quadtree of canonical nodes kept in an hash table, and the result of each node (its
+///centre advanced in time) is memoized in the node itself.
+
+//includes
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include "GLCAlib.h"
+#include "GLCArule.h"
+
+using namespace std;
+namespace GLCAlib {
+///nodes allocated at once
+const int nodeBlock = 4096;
+
+///\brief A square of 2^level cells
+///
+///Leaves (level 0) are single cells, the other nodes have four children of the level below.
+struct Node {
+    ///nw, ne, sw, se (NULL for leaves)
+    Node* child[4];
+    ///the centre of the node, advanced 2^min(stepLog, level-2) generations (NULL if not computed yet)
+    Node* result;
+    ///next node in the same bucket, or in the free list
+    Node* next;
+    int level;
+    ///state of the cell, for leaves
+    unsigned char state;
+    bool marked;
+};
+
+struct HashLife::Universe {
+    const struct_rule& rule;
+    long maxNodes;
+    long count;
+    vector<Node*> buckets;
+    vector<Node*> blocks;
+    Node* freeList;
+    ///a leaf per state, and one for the states the rule does not know
+    vector<Node> leaves;
+    ///canonical empty node of each level
+    vector<Node*> empties;
+    Node* root;
+    ///log2 of the generations of a step
+    int stepLog;
+    long long generation;
+
+    Universe(BuiltinRule r, long m);
+    ~Universe();
+    Node* join(Node* nw, Node* ne, Node* sw, Node* se);
+    Node* empty(int level);
+    Node* build(const unsigned char* states, int x, int y, int level, long ox, long oy);
+    void extract(Node* n, unsigned char* states, int x, int y, long ox, long oy) const;
+    Node* expand(Node* n);
+    bool centred(Node* n);
+    Node* centre(Node* n);
+    Node* centreHorizontal(Node* w, Node* e);
+    Node* centreVertical(Node* n, Node* s);
+    Node* base(Node* n);
+    Node* successor(Node* n);
+    void setStep(int k);
+    void mark(Node* n);
+    void collect();
+    void rehash();
+};
+
+///Hash of a node made of the given children
+inline size_t hashChildren(Node* nw, Node* ne, Node* sw, Node* se) {
+    uint64_t h = (uintptr_t)nw;
+    h = h*0x9E3779B97F4A7C15ull + (uintptr_t)ne;
+    h = h*0x9E3779B97F4A7C15ull + (uintptr_t)sw;
+    h = h*0x9E3779B97F4A7C15ull + (uintptr_t)se;
+    return h ^ (h >> 29);
+}
+
+HashLife::Universe::Universe(BuiltinRule r, long m) : rule(ruleTable(r)), maxNodes(m), count(0), buckets(1<<16, (Node*)NULL),
+                                                      freeList(NULL), leaves(rule.states+1), root(NULL), stepLog(0), generation(0) {
+    if (rule.states == 2 ? rule.neighbourhood[0] != 0 : rule.next[rule.counted == 0 ? 8 : 0] != 0) {
+        cout<<"HashLife needs a rule that keeps the empty space empty"<<endl;
+        exit(1);
+    }
+    for (int s=0; s<=rule.states; ++s) {
+        memset(&leaves[s], 0, sizeof(Node));
+        leaves[s].state = s;
+    }
+    empties.push_back(&leaves[0]);
+}
+
+HashLife::Universe::~Universe() {
+    for (size_t i=0; i<blocks.size(); ++i) delete[] blocks[i];
+}
+
+///\brief Returns the canonical node with the given children, creating it if needed
+Node* HashLife::Universe::join(Node* nw, Node* ne, Node* sw, Node* se) {
+    size_t h = hashChildren(nw, ne, sw, se) & (buckets.size()-1);
+    for (Node* n = buckets[h]; n; n = n->next)
+        if (n->child[0]==nw && n->child[1]==ne && n->child[2]==sw && n->child[3]==se) return n;
+
+    if (!freeList) {
+        //cerr<<"allocate a block of nodes"<<endl;
+        Node* block = new Node[nodeBlock];
+        blocks.push_back(block);
+        for (int i=0; i<nodeBlock; ++i) {
+            block[i].next = freeList;
+            freeList = &block[i];
+        }
+    }
+    Node* n = freeList;
+    freeList = n->next;
+    n->child[0] = nw;
+    n->child[1] = ne;
+    n->child[2] = sw;
+    n->child[3] = se;
+    n->result = NULL;
+    n->level = nw->level+1;
+    n->state = 0;
+    n->marked = false;
+    n->next = buckets[h];
+    buckets[h] = n;
+    if (++count > (long)buckets.size()) rehash();
+    return n;
+}
+
+///Doubles the buckets when the table gets full
+void HashLife::Universe::rehash() {
+    //cerr<<"Inside rehash"<<endl;
+    vector<Node*> old(buckets.size()*2, (Node*)NULL);
+    old.swap(buckets);
+    for (size_t i=0; i<old.size(); ++i)
+        for (Node* n = old[i]; n; ) {
+            Node* next = n->next;
+            size_t h = hashChildren(n->child[0], n->child[1], n->child[2], n->child[3]) & (buckets.size()-1);
+            n->next = buckets[h];
+            buckets[h] = n;
+            n = next;
+        }
+}
+
+Node* HashLife::Universe::empty(int level) {
+    while ((int)empties.size() <= level) {
+        Node* e = empties.back();
+        empties.push_back(join(e, e, e, e));
+    }
+    return empties[level];
+}
+
+///\brief Builds the node of the square of 2^level cells whose top-left cell is (ox,oy)
+Node* HashLife::Universe::build(const unsigned char* states, int x, int y, int level, long ox, long oy) {
+    long size = 1l<<level;
+    if (ox >= x || oy >= y || ox+size <= 0 || oy+size <= 0) return empty(level);
+    if (level == 0) {
+        unsigned char c = states[(long)x*oy+ox];
+        if (rule.states == 2) c = c!=0;
+        return &leaves[min((int)c, rule.states)];
+    }
+    long half = size/2;
+    return join(build(states, x, y, level-1, ox, oy), build(states, x, y, level-1, ox+half, oy),
+                build(states, x, y, level-1, ox, oy+half), build(states, x, y, level-1, ox+half, oy+half));
+}
+
+///\brief Copies the cells of node n, whose top-left cell is (ox,oy), that fall in the window
+void HashLife::Universe::extract(Node* n, unsigned char* states, int x, int y, long ox, long oy) const {
+    long size = 1l<<n->level;
+    if (ox >= x || oy >= y || ox+size <= 0 || oy+size <= 0) return;
+    if (n->level < (int)empties.size() && n == empties[n->level]) return;
+    if (n->level == 0) {
+        states[(long)x*oy+ox] = n->state;
+        return;
+    }
+    long half = size/2;
+    extract(n->child[0], states, x, y, ox, oy);
+    extract(n->child[1], states, x, y, ox+half, oy);
+    extract(n->child[2], states, x, y, ox, oy+half);
+    extract(n->child[3], states, x, y, ox+half, oy+half);
+}
+
+///Surrounds n with blank cells, the centre stays at the origin
+Node* HashLife::Universe::expand(Node* n) {
+    Node* e = empty(n->level-1);
+    return join(join(e, e, e, n->child[0]), join(e, e, n->child[1], e),
+                join(e, n->child[2], e, e), join(n->child[3], e, e, e));
+}
+
+///TRUE if all the cells of n are in its central square of half size
+bool HashLife::Universe::centred(Node* n) {
+    Node* e = empty(n->level-2);
+    Node** c = n->child;
+    return c[0]->child[0]==e && c[0]->child[1]==e && c[0]->child[2]==e &&
+           c[1]->child[0]==e && c[1]->child[1]==e && c[1]->child[3]==e &&
+           c[2]->child[0]==e && c[2]->child[2]==e && c[2]->child[3]==e &&
+           c[3]->child[1]==e && c[3]->child[2]==e && c[3]->child[3]==e;
+}
+
+Node* HashLife::Universe::centre(Node* n) {
+    return join(n->child[0]->child[3], n->child[1]->child[2], n->child[2]->child[1], n->child[3]->child[0]);
+}
+
+Node* HashLife::Universe::centreHorizontal(Node* w, Node* e) {
+    return join(w->child[1], e->child[0], w->child[3], e->child[2]);
+}
+
+Node* HashLife::Universe::centreVertical(Node* n, Node* s) {
+    return join(n->child[2], n->child[3], s->child[0], s->child[1]);
+}
+
+///\brief Next generation of the central 2x2 cells of a 4x4 node, by the rule itself
+Node* HashLife::Universe::base(Node* n) {
+    unsigned char c[4][4];
+    for (int i=0; i<4; ++i)
+        for (int j=0; j<4; ++j)
+            c[i][j] = n->child[(i/2)*2+j/2]->child[(i%2)*2+j%2]->state;
+    Node* out[4];
+    for (int i=1; i<3; ++i)
+        for (int j=1; j<3; ++j) {
+            int count = 0, index = 0;
+            for (int di=-1; di<=1; ++di)
+                for (int dj=-1; dj<=1; ++dj) {
+                    if (di || dj) count += c[i+di][j+dj]==rule.counted;
+                    index |= c[i+di][j+dj] << (3*(di+1)+dj+1);
+                }
+            int next;
+            if (rule.states == 2) next = rule.neighbourhood[index];
+            else next = c[i][j] < rule.states ? rule.next[9*c[i][j]+count] : 0;
+            out[(i-1)*2+j-1] = &leaves[next];
+        }
+    return join(out[0], out[1], out[2], out[3]);
+}
+
+///\brief The central half of n advanced 2^min(stepLog, level-2) generations
+///
+///The nine overlapping subsquares of half size are advanced (at full speed, or just
+///centred for slower steps), then joined in four squares that are advanced again.
+Node* HashLife::Universe::successor(Node* n) {
+    if (n->result) return n->result;
+    if (n == empty(n->level)) return n->result = empty(n->level-1);
+    if (n->level == 2) return n->result = base(n);
+
+    Node** c = n->child;
+    Node* sub[9] = { c[0], centreHorizontal(c[0], c[1]), c[1],
+                     centreVertical(c[0], c[2]), centre(n), centreVertical(c[1], c[3]),
+                     c[2], centreHorizontal(c[2], c[3]), c[3] };
+    for (int i=0; i<9; ++i)
+        sub[i] = stepLog >= n->level-2 ? successor(sub[i]) : centre(sub[i]);
+    Node* r = join(successor(join(sub[0], sub[1], sub[3], sub[4])), successor(join(sub[1], sub[2], sub[4], sub[5])),
+                   successor(join(sub[3], sub[4], sub[6], sub[7])), successor(join(sub[4], sub[5], sub[7], sub[8])));
+    return n->result = r;
+}
+
+///\brief Changes the length of a step, dropping the results computed for the old one
+///
+///Nodes up to level min(old, new)+2 always run at full speed, so their results are kept.
+void HashLife::Universe::setStep(int k) {
+    if (k == stepLog) return;
+    int keep = (k < stepLog ? k : stepLog)+2;
+    for (size_t i=0; i<buckets.size(); ++i)
+        for (Node* n = buckets[i]; n; n = n->next)
+            if (n->level > keep) n->result = NULL;
+    stepLog = k;
+}
+
+void HashLife::Universe::mark(Node* n) {
+    while (n && !n->marked) {
+        n->marked = true;
+        if (n->level > 0)
+            for (int i=0; i<4; ++i) mark(n->child[i]);
+        n = n->result;
+    }
+}
+
+///\brief Mark and sweep: frees the nodes not reachable from the root, the empty nodes or kept results
+void HashLife::Universe::collect() {
+    //cerr<<"Inside collect"<<endl;
+    for (size_t i=0; i<empties.size(); ++i) mark(empties[i]);
+    mark(root);
+    for (size_t i=0; i<buckets.size(); ++i) {
+        Node** link = &buckets[i];
+        while (*link) {
+            Node* n = *link;
+            if (n->marked) {
+                n->marked = false;
+                link = &n->next;
+            } else {
+                *link = n->next;
+                n->next = freeList;
+                freeList = n;
+                --count;
+            }
+        }
+    }
+    for (size_t s=0; s<leaves.size(); ++s) leaves[s].marked = false;
+}
+
+HashLife::HashLife(BuiltinRule rule, long maxNodes) : universe(new Universe(rule, maxNodes)) {
+    universe->root = universe->empty(3);
+}
+
+HashLife::~HashLife() {
+    delete universe;
+}
+
+void HashLife::load(const unsigned char* states, int x, int y) {
+    //cerr<<"Inside HashLife::load"<<endl;
+    int level = 3;
+    while ((1l<<(level-1)) < x || (1l<<(level-1)) < y) ++level;
+    long half = 1l<<(level-1);
+    universe->root = universe->build(states, x, y, level, -half, -half);
+    universe->generation = 0;
+    universe->collect();
+}
+
+void HashLife::load(const float* image, int x, int y, const float palette[][4], int colors) {
+    vector<unsigned char> states((size_t)x*y);
+    encodeStates(image, &states[0], x*y, palette, colors);
+    load(&states[0], x, y);
+}
+
+void HashLife::save(unsigned char* states, int x, int y) const {
+    //cerr<<"Inside HashLife::save"<<endl;
+    memset(states, 0, (size_t)x*y);
+    long half = 1l<<(universe->root->level-1);
+    universe->extract(universe->root, states, x, y, -half, -half);
+}
+
+void HashLife::save(float* image, int x, int y, const float palette[][4], int colors) const {
+    vector<unsigned char> states((size_t)x*y);
+    save(&states[0], x, y);
+    decodeStates(&states[0], image, x*y, palette, colors);
+}
+
+///\brief Advances the universe by 2^k generations
+///
+///The root is expanded until the pattern lies in its central quarter and it is large
+///enough for the step, so that the result (its central half) holds the whole pattern.
+void HashLife::step(int k) {
+    //cerr<<"Inside HashLife::step"<<endl;
+    Universe* u = universe;
+    if (u->count > u->maxNodes) {
+        u->collect();
+        if (u->count > u->maxNodes/2) {
+            //cerr<<"drop all the memoized results"<<endl;
+            for (size_t i=0; i<u->buckets.size(); ++i)
+                for (Node* n = u->buckets[i]; n; n = n->next) n->result = NULL;
+            u->collect();
+        }
+    }
+    u->setStep(k);
+    while (u->root->level < k+3 || !u->centred(u->root)) u->root = u->expand(u->root);
+    u->root = u->successor(u->expand(u->root));
+    u->generation += 1ll<<k;
+}
+
+void HashLife::run(long long generations) {
+    for (int k=0; generations>>k; ++k)
+        if ((generations>>k) & 1) step(k);
+}
+
+long long HashLife::generation() const {
+    return universe->generation;
+}
+
+long HashLife::nodes() const {
+    return universe->count;
+}
+
+void HashLife::collect() {
+    universe->collect();
+}
+}//END NAMESPACE
@@ -0,0 +1,269 @@
+///\file GLCAhist.cpp
+///\brief History recorder and reader of GLCAlib.
+///
+///A history is a sequence of records of the texels of a computation: keyframes hold the
+///whole state, deltas only the tiles that changed since the previous record, and both
+///are compressed with zlib [16]. The index of the records is written at the end of the file.
+
+//includes
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <zlib.h>
+#include "GLCAlib.h"
+#include "GLCAio.h"
+
+using namespace std;
+namespace GLCAlib {
+///texels on each side of the tiles of the deltas
+const int historyTile = 32;
+///first bytes of a history file
+const char historyMagic[8] = { 'G', 'L', 'C', 'A', 'h', 'i', 's', 't' };
+///last bytes of a history file with its index
+const char indexMagic[8] = { 'G', 'L', 'C', 'A', 'i', 'n', 'd', 'x' };
+
+///\brief Last bytes of a history file: where the index starts and its entries
+struct struct_historyTrailer {
+    uint64_t offset, count;
+    char magic[8];
+};
+
+///\brief Copies the texels of a tile between a state and a packed buffer
+///@param[in] toTile: if TRUE copies from state to tile, otherwise from tile to state
+///@return the bytes of the tile
+size_t copyTile(const struct_historyHeader& header, int t, unsigned char* state, unsigned char* tile, bool toTile) {
+    int tiles_x = (header.identity.texels_x+header.tile-1)/header.tile;
+    size_t texelBytes = header.identity.texelBytes/(header.identity.texels_x*header.identity.y);
+    long x0 = (long)(t%tiles_x)*header.tile, y0 = (long)(t/tiles_x)*header.tile;
+    long w = min<long>(header.tile, header.identity.texels_x-x0), h = min<long>(header.tile, header.identity.y-y0);
+    size_t rowBytes = w*texelBytes;
+    for (long r=0; r<h; ++r) {
+        unsigned char* row = state+((y0+r)*header.identity.texels_x+x0)*texelBytes;
+        if (toTile) memcpy(tile+r*rowBytes, row, rowBytes);
+        else memcpy(row, tile+r*rowBytes, rowBytes);
+    }
+    return h*rowBytes;
+}
+
+HistoryWriter::HistoryWriter(const char* filename, const struct_checkpointHeader& identity, int keyframes) {
+    //cerr<<"Inside HistoryWriter "<<filename<<endl;
+    file = fopen(filename, "wb");
+    if (!file) {
+        cout<<"Can not create "<<filename<<endl;
+        exit(1);
+    }
+    header.identity = identity;
+    memcpy(header.identity.magic, historyMagic, sizeof(historyMagic));
+    header.identity.version = 1;
+    header.identity.bits = 8;
+    header.tile = historyTile;
+    header.keyframes = keyframes > 0 ? keyframes : 1;
+    fwrite(&header, sizeof(header), 1, file);
+    tiles_x = (identity.texels_x+historyTile-1)/historyTile;
+    tiles_y = (identity.y+historyTile-1)/historyTile;
+    previous.resize(identity.texelBytes);
+    sinceKeyframe = 0;
+}
+
+HistoryWriter::~HistoryWriter() {
+    //cerr<<"Inside ~HistoryWriter"<<endl;
+    struct_historyTrailer trailer;
+    trailer.offset = ftell(file);
+    trailer.count = index.size();
+    memcpy(trailer.magic, indexMagic, sizeof(indexMagic));
+    if (!index.empty()) fwrite(&index[0], sizeof(struct_historyIndex), index.size(), file);
+    fwrite(&trailer, sizeof(trailer), 1, file);
+    fclose(file);
+}
+
+void HistoryWriter::record(long generation, const unsigned char* texels) {
+    //cerr<<"Inside HistoryWriter::record "<<generation<<endl;
+    struct_historyRecord record;
+    record.generation = generation;
+    record.keyframe = index.empty() || sinceKeyframe+1 >= header.keyframes;
+    record.tiles = 0;
+    const unsigned char* raw = texels;
+    if (!record.keyframe) {
+        //cerr<<"collect the changed tiles"<<endl;
+        vector<unsigned char> tile(historyTile*historyTile*(header.identity.texelBytes/(header.identity.texels_x*header.identity.y)));
+        vector<unsigned char> old(tile.size());
+        payload.clear();
+        for (int t=0; t<tiles_x*tiles_y; ++t) {
+            size_t bytes = copyTile(header, t, (unsigned char*)texels, &tile[0], true);
+            copyTile(header, t, &previous[0], &old[0], true);
+            if (memcmp(&tile[0], &old[0], bytes) == 0) continue;
+            uint32_t tileIndex = t;
+            payload.insert(payload.end(), (unsigned char*)&tileIndex, (unsigned char*)&tileIndex+sizeof(tileIndex));
+            payload.insert(payload.end(), tile.begin(), tile.begin()+bytes);
+            ++record.tiles;
+        }
+        //a delta larger than half a keyframe is not worth it
+        if (payload.size() > header.identity.texelBytes/2) record.keyframe = true;
+        else raw = payload.empty() ? NULL : &payload[0];
+    }
+    record.rawBytes = record.keyframe ? header.identity.texelBytes : payload.size();
+    if (record.keyframe) record.tiles = 0;
+    uLongf compressedBytes = compressBound(record.rawBytes);
+    compressed.resize(compressedBytes);
+    if (record.rawBytes > 0) compress2(&compressed[0], &compressedBytes, raw, record.rawBytes, Z_BEST_SPEED);
+    else compressedBytes = 0;
+    record.compressedBytes = compressedBytes;
+
+    struct_historyIndex entry;
+    entry.generation = generation;
+    entry.offset = ftell(file);
+    entry.keyframe = record.keyframe;
+    entry.unused = 0;
+    if (fwrite(&record, sizeof(record), 1, file) != 1 || fwrite(&compressed[0], 1, compressedBytes, file) != compressedBytes) {
+        cout<<"Can not write the history"<<endl;
+        exit(1);
+    }
+    //readers may open the file while it is recorded
+    fflush(file);
+    index.push_back(entry);
+    sinceKeyframe = record.keyframe ? 0 : sinceKeyframe+1;
+    memcpy(&previous[0], texels, header.identity.texelBytes);
+}
+
+///\brief The state of a History: the file, its index and the last state rebuilt
+struct History::Recording {
+    FILE* file;
+    struct_historyHeader header;
+    vector<struct_historyIndex> index;
+    ///texels of record current (-1 if none)
+    vector<unsigned char> state;
+    long current;
+    vector<unsigned char> compressed, payload;
+
+    ///\brief Applies record i to state
+    void apply(long i) {
+        struct_historyRecord record;
+        fseek(file, index[i].offset, SEEK_SET);
+        if (fread(&record, sizeof(record), 1, file) != 1) corrupted();
+        compressed.resize(record.compressedBytes);
+        if (record.compressedBytes && fread(&compressed[0], 1, record.compressedBytes, file) != record.compressedBytes) corrupted();
+        unsigned char* raw = &state[0];
+        if (!record.keyframe) {
+            payload.resize(record.rawBytes);
+            raw = payload.empty() ? NULL : &payload[0];
+        }
+        uLongf rawBytes = record.rawBytes;
+        if (record.rawBytes && (uncompress(raw, &rawBytes, &compressed[0], record.compressedBytes) != Z_OK || rawBytes != record.rawBytes)) corrupted();
+        for (size_t p=0; !record.keyframe && p<payload.size(); ) {
+            uint32_t t;
+            memcpy(&t, &payload[p], sizeof(t));
+            p += sizeof(t);
+            p += copyTile(header, t, &state[0], &payload[p], false);
+        }
+        current = i;
+    }
+
+    void corrupted() {
+        cout<<"The history is corrupted"<<endl;
+        exit(1);
+    }
+};
+
+History::History(const char* filename) {
+    //cerr<<"Inside History "<<filename<<endl;
+    recording = new Recording();
+    Recording& r = *recording;
+    r.file = fopen(filename, "rb");
+    if (!r.file || fread(&r.header, sizeof(r.header), 1, r.file) != 1 ||
+        memcmp(r.header.identity.magic, historyMagic, sizeof(historyMagic)) != 0 || r.header.identity.version != 1) {
+        cout<<filename<<" is not a history"<<endl;
+        exit(1);
+    }
+    r.state.resize(r.header.identity.texelBytes);
+    r.current = -1;
+
+    //cerr<<"read the index, or rebuild it if the recording was interrupted"<<endl;
+    struct_historyTrailer trailer;
+    fseek(r.file, 0, SEEK_END);
+    long size = ftell(r.file);
+    if (size >= (long)(sizeof(r.header)+sizeof(trailer)) && fseek(r.file, size-sizeof(trailer), SEEK_SET) == 0 &&
+        fread(&trailer, sizeof(trailer), 1, r.file) == 1 && memcmp(trailer.magic, indexMagic, sizeof(indexMagic)) == 0) {
+        r.index.resize(trailer.count);
+        fseek(r.file, trailer.offset, SEEK_SET);
+        if (trailer.count && fread(&r.index[0], sizeof(struct_historyIndex), trailer.count, r.file) != trailer.count) r.corrupted();
+        return;
+    }
+    struct_historyRecord record;
+    for (long offset = sizeof(r.header); fseek(r.file, offset, SEEK_SET) == 0 && fread(&record, sizeof(record), 1, r.file) == 1; ) {
+        long next = offset+sizeof(record)+record.compressedBytes;
+        //a record cut by the interruption is dropped
+        if (next > size) break;
+        struct_historyIndex entry;
+        entry.generation = record.generation;
+        entry.offset = offset;
+        entry.keyframe = record.keyframe;
+        entry.unused = 0;
+        r.index.push_back(entry);
+        offset = next;
+    }
+}
+
+History::~History() {
+    fclose(recording->file);
+    delete recording;
+}
+
+int History::width() const {
+    return recording->header.identity.x;
+}
+
+int History::height() const {
+    return recording->header.identity.y;
+}
+
+long History::records() const {
+    return recording->index.size();
+}
+
+long History::generation(long record) const {
+    return recording->index[record].generation;
+}
+
+long History::stateBytes() const {
+    const struct_checkpointHeader& identity = recording->header.identity;
+    //cerr<<"built-in two state rules are packed in R32UI texels"<<endl;
+    return identity.rule >= 0 && identity.format == R32UI ? identity.x*identity.y : identity.texelBytes;
+}
+
+long History::seekTexels(long generation, void* texels) {
+    //cerr<<"Inside History::seekTexels "<<generation<<endl;
+    Recording& r = *recording;
+    //cerr<<"the last record not after generation"<<endl;
+    long target = -1;
+    for (long lo=0, hi=r.index.size()-1; lo<=hi; ) {
+        long mid = (lo+hi)/2;
+        if (r.index[mid].generation <= generation) {
+            target = mid;
+            lo = mid+1;
+        } else
+            hi = mid-1;
+    }
+    if (target < 0) return -1;
+    long key = target;
+    while (!r.index[key].keyframe) --key;
+    if (r.current < key || r.current > target) r.apply(key);
+    while (r.current < target) r.apply(r.current+1);
+    memcpy(texels, &r.state[0], r.state.size());
+    return r.index[target].generation;
+}
+
+long History::seek(long generation, void* data) {
+    //cerr<<"Inside History::seek "<<generation<<endl;
+    const struct_checkpointHeader& identity = recording->header.identity;
+    if (identity.rule < 0 || identity.format != R32UI) return seekTexels(generation, data);
+    vector<unsigned int> words(identity.texels_x*identity.y);
+    long found = seekTexels(generation, &words[0]);
+    if (found < 0) return found;
+    unsigned char* states = (unsigned char*)data;
+    for (long i=0; i<identity.y; ++i)
+        for (long j=0; j<identity.x; ++j)
+            states[identity.x*i+j] = (words[identity.texels_x*i+j/32]>>(j%32)) & 1;
+    return found;
+}
+}
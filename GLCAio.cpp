@@ -0,0 +1,450 @@
+///\file GLCAio.cpp
+///\brief Image and checkpoint I/O of GLCAlib.
+///
+///RGBA files are raw bytes: they are read through a memory map, or in large blocks when
+///the file can not be mapped, written in large blocks, and converted from and to floats
+///by kernels vectorized for the available instruction set.\n
+///Checkpoints hold the texels of a computation, packed and compressed with zlib [16].
+///The program cache holds the binaries of the linked shader programs.
+
+//includes
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <immintrin.h>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "GLCAlib.h"
+#include "GLCAio.h"
+
+using namespace std;
+namespace GLCAlib {
+///bytes converted and written at once by saveImage
+const long ioBlock = 1<<20;
+///bytes given to zlib at once, its counters are 32 bits
+const uint64_t zlibChunk = 1u<<30;
+const char checkpointMagic[8] = { 'G', 'L', 'C', 'A', 'c', 'k', 'p', 't' };
+const char programMagic[8] = { 'G', 'L', 'C', 'A', 'p', 'r', 'o', 'g' };
+
+///\brief Converts bytes to floats between 0 and 1
+///
+///The division is the same of the old byte by byte loader, so the floats are identical.
+void bytesToFloatsScalar(const unsigned char* in, float* out, long length) {
+    for (long i=0; i<length; ++i) out[i] = (float)in[i]/255.0f;
+}
+
+///\brief Converts floats to bytes, clipping them between 0 and 1 and truncating 255*p
+void floatsToBytesScalar(const float* in, unsigned char* out, long length) {
+    for (long i=0; i<length; ++i) {
+        float p = in[i];
+        if (p>1) p=1;//clipping values
+        else if (!(p>=0)) p=0;//clipping values, NaN included
+        out[i] = (unsigned char)(255*p);
+    }
+}
+
+__attribute__((target("avx2")))
+void bytesToFloatsAVX2(const unsigned char* in, float* out, long length) {
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    long i=0;
+    for (; i+8<=length; i+=8) {
+        __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in+i)));
+        _mm256_storeu_ps(out+i, _mm256_div_ps(_mm256_cvtepi32_ps(b), scale));
+    }
+    bytesToFloatsScalar(in+i, out+i, length-i);
+}
+
+__attribute__((target("avx2")))
+void floatsToBytesAVX2(const float* in, unsigned char* out, long length) {
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), scale = _mm256_set1_ps(255.0f);
+    long i=0;
+    for (; i+32<=length; i+=32) {
+        __m256i v[4];
+        for (int k=0; k<4; ++k) {
+            //max returns its second operand for NaN
+            __m256 p = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in+i+8*k), zero), one);
+            v[k] = _mm256_cvttps_epi32(_mm256_mul_ps(p, scale));
+        }
+        //the packs work on 128 bit lanes, the permutation puts the bytes back in order
+        __m256i w = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+        w = _mm256_permutevar8x32_epi32(w, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)(out+i), w);
+    }
+    floatsToBytesScalar(in+i, out+i, length-i);
+}
+
+__attribute__((target("avx512f")))
+void bytesToFloatsAVX512(const unsigned char* in, float* out, long length) {
+    const __m512 scale = _mm512_set1_ps(255.0f);
+    long i=0;
+    for (; i+16<=length; i+=16) {
+        __m512i b = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(in+i)));
+        _mm512_storeu_ps(out+i, _mm512_div_ps(_mm512_cvtepi32_ps(b), scale));
+    }
+    bytesToFloatsScalar(in+i, out+i, length-i);
+}
+
+__attribute__((target("avx512f")))
+void floatsToBytesAVX512(const float* in, unsigned char* out, long length) {
+    const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f), scale = _mm512_set1_ps(255.0f);
+    long i=0;
+    for (; i+16<=length; i+=16) {
+        __m512 p = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(in+i), zero), one);
+        _mm_storeu_si128((__m128i*)(out+i), _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(_mm512_mul_ps(p, scale))));
+    }
+    floatsToBytesScalar(in+i, out+i, length-i);
+}
+
+void bytesToFloats(const unsigned char* in, float* out, long length) {
+    //cerr<<"Inside bytesToFloats"<<endl;
+    static void (*kernel)(const unsigned char*, float*, long) = NULL;
+    if (!kernel) {
+        __builtin_cpu_init();
+        kernel = __builtin_cpu_supports("avx512f") ? bytesToFloatsAVX512 :
+                 __builtin_cpu_supports("avx2") ? bytesToFloatsAVX2 : bytesToFloatsScalar;
+    }
+    kernel(in, out, length);
+}
+
+void floatsToBytes(const float* in, unsigned char* out, long length) {
+    //cerr<<"Inside floatsToBytes"<<endl;
+    static void (*kernel)(const float*, unsigned char*, long) = NULL;
+    if (!kernel) {
+        __builtin_cpu_init();
+        kernel = __builtin_cpu_supports("avx512f") ? floatsToBytesAVX512 :
+                 __builtin_cpu_supports("avx2") ? floatsToBytesAVX2 : floatsToBytesScalar;
+    }
+    kernel(in, out, length);
+}
+
+///\brief Reads up to length bytes of the file imname
+///
+///The file is mapped and handed to consume, or read in blocks of ioBlock bytes when it
+///can not be mapped; bytes missing at the end of the file are zeros.
+///@param[in] consume: called with consecutive parts of the file and their offset
+template<class Consume>
+void readImage(const char* imname, long length, Consume consume) {
+    int fd = open(imname, O_RDONLY);
+    if (fd < 0) {
+        cout<<"Can not open "<<imname<<endl;
+        exit(1);
+    }
+    struct stat info;
+    long size = fstat(fd, &info) == 0 && S_ISREG(info.st_mode) ? info.st_size : -1;
+    long done = size < length ? size : length;
+    void* mapped = done > 0 ? mmap(NULL, done, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (mapped != MAP_FAILED) {
+        madvise(mapped, done, MADV_SEQUENTIAL);
+        consume((const unsigned char*)mapped, 0, done);
+        munmap(mapped, done);
+    } else {
+        done = 0;
+        //cerr<<"not a regular file, read it in blocks"<<endl;
+        unsigned char* block = new unsigned char[ioBlock];
+        for (long got; done < length; done += got) {
+            got = read(fd, block, length-done < ioBlock ? length-done : ioBlock);
+            if (got <= 0) break;
+            consume(block, done, got);
+        }
+        delete[] block;
+    }
+    close(fd);
+    if (done < length) {
+        cout<<imname<<" is shorter than the image, the missing pixels are zeros"<<endl;
+        unsigned char zeros[4096] = {0};
+        for (; done < length; done += 4096) consume(zeros, done, length-done < 4096 ? length-done : 4096);
+    }
+}
+
+///\brief Writes length bytes to the file imname
+///@param[in] produce: fills a block with the bytes at an offset
+template<class Produce>
+void writeImage(const char* imname, long length, Produce produce) {
+    FILE* file = fopen(imname, "wb");
+    if (!file) {
+        cout<<"Can not create "<<imname<<endl;
+        exit(1);
+    }
+    unsigned char* block = new unsigned char[ioBlock];
+    for (long done = 0; done < length; done += ioBlock) {
+        long bytes = length-done < ioBlock ? length-done : ioBlock;
+        const unsigned char* p = produce(block, done, bytes);
+        if (fwrite(p, 1, bytes, file) != (size_t)bytes) {
+            cout<<"Can not write "<<imname<<endl;
+            exit(1);
+        }
+    }
+    delete[] block;
+    fclose(file);
+}
+
+void loadImage(float* p, char* imname, long length) {
+    //cerr<<"Inside loadImage "<<imname<<endl;
+    readImage(imname, length, [p](const unsigned char* bytes, long offset, long count) {
+        bytesToFloats(bytes, p+offset, count);
+    });
+}
+
+void loadImage(unsigned char* p, char* imname, long length) {
+    //cerr<<"Inside loadImage "<<imname<<endl;
+    readImage(imname, length, [p](const unsigned char* bytes, long offset, long count) {
+        memcpy(p+offset, bytes, count);
+    });
+}
+
+void saveImage(const float* p, char* imname, long length) {
+    //cerr<<"Inside saveImage "<<imname<<endl;
+    writeImage(imname, length, [p](unsigned char* block, long offset, long count) {
+        floatsToBytes(p+offset, block, count);
+        return (const unsigned char*)block;
+    });
+}
+
+void saveImage(const unsigned char* p, char* imname, long length) {
+    //cerr<<"Inside saveImage "<<imname<<endl;
+    writeImage(imname, length, [p](unsigned char*, long offset, long) {
+        return p+offset;
+    });
+}
+
+unsigned char* mapImage(char* imname, long length, bool write) {
+    //cerr<<"Inside mapImage "<<imname<<endl;
+    int fd = open(imname, write ? O_RDWR|O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) {
+        cout<<"Can not open "<<imname<<endl;
+        exit(1);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (write && info.st_size < length && ftruncate(fd, length) != 0)) {
+        cout<<"Can not resize "<<imname<<endl;
+        exit(1);
+    }
+    if (!write && info.st_size < length) {
+        cout<<imname<<" is shorter than the image"<<endl;
+        exit(1);
+    }
+    //a private mapping is copy on write: the buffer can be changed, the file is not
+    void* mapped = mmap(NULL, length, PROT_READ|PROT_WRITE, write ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        cout<<"Can not map "<<imname<<endl;
+        exit(1);
+    }
+    madvise(mapped, length, MADV_SEQUENTIAL);
+    return (unsigned char*)mapped;
+}
+
+void unmapImage(unsigned char* p, long length) {
+    //cerr<<"Inside unmapImage"<<endl;
+    munmap(p, length);
+}
+
+uint64_t hashSource(const char* source) {
+    uint64_t hash = 14695981039346656037ull;
+    for (; *source; ++source) hash = (hash ^ (unsigned char)*source) * 1099511628211ull;
+    return hash;
+}
+
+void saveCheckpoint(const char* filename, struct_checkpointHeader header, const unsigned char* texels) {
+    //cerr<<"Inside saveCheckpoint "<<filename<<endl;
+    memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.version = 1;
+    //cerr<<"pack small states in 2 or 4 bits"<<endl;
+    header.bits = 8;
+    if (header.format == R8UI) {
+        unsigned char all = 0;
+        for (uint64_t i=0; i<header.texelBytes; ++i) all |= texels[i];
+        header.bits = all < 4 ? 2 : all < 16 ? 4 : 8;
+    }
+    const unsigned char* data = texels;
+    vector<unsigned char> packed;
+    if (header.bits < 8) {
+        int perByte = 8/header.bits;
+        packed.assign((header.texelBytes+perByte-1)/perByte, 0);
+        for (uint64_t i=0; i<header.texelBytes; ++i)
+            packed[i/perByte] |= texels[i] << (i%perByte*header.bits);
+        data = &packed[0];
+        header.packedBytes = packed.size();
+    } else
+        header.packedBytes = header.texelBytes;
+
+    string temporary = string(filename)+".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        cout<<"Can not create "<<temporary<<endl;
+        exit(1);
+    }
+    //cerr<<"the header is written again once the stream size is known"<<endl;
+    fwrite(&header, sizeof(header), 1, file);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    deflateInit(&stream, Z_BEST_SPEED);
+    vector<unsigned char> block(ioBlock);
+    header.compressedBytes = 0;
+    uint64_t left = header.packedBytes;
+    int flush;
+    do {
+        uInt chunk = left < zlibChunk ? left : zlibChunk;
+        stream.next_in = (Bytef*)data;
+        stream.avail_in = chunk;
+        data += chunk;
+        left -= chunk;
+        flush = left ? Z_NO_FLUSH : Z_FINISH;
+        do {
+            stream.next_out = &block[0];
+            stream.avail_out = ioBlock;
+            deflate(&stream, flush);
+            size_t bytes = ioBlock-stream.avail_out;
+            if (fwrite(&block[0], 1, bytes, file) != bytes) {
+                cout<<"Can not write "<<temporary<<endl;
+                exit(1);
+            }
+            header.compressedBytes += bytes;
+        } while (stream.avail_out == 0);
+    } while (flush != Z_FINISH);
+    deflateEnd(&stream);
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fflush(file);
+    fsync(fileno(file));
+    fclose(file);
+    if (rename(temporary.c_str(), filename) != 0) {
+        cout<<"Can not rename "<<temporary<<" to "<<filename<<endl;
+        exit(1);
+    }
+}
+
+bool loadCheckpointHeader(const char* filename, struct_checkpointHeader* header) {
+    //cerr<<"Inside loadCheckpointHeader "<<filename<<endl;
+    FILE* file = fopen(filename, "rb");
+    if (!file) return false;
+    bool ok = fread(header, sizeof(*header), 1, file) == 1 &&
+              memcmp(header->magic, checkpointMagic, sizeof(header->magic)) == 0 && header->version == 1;
+    fclose(file);
+    return ok;
+}
+
+void loadCheckpoint(const char* filename, const struct_checkpointHeader& header, unsigned char* texels) {
+    //cerr<<"Inside loadCheckpoint "<<filename<<endl;
+    FILE* file = fopen(filename, "rb");
+    if (!file || fseek(file, sizeof(header), SEEK_SET) != 0) {
+        cout<<"Can not open "<<filename<<endl;
+        exit(1);
+    }
+    vector<unsigned char> packed;
+    unsigned char* data = texels;
+    if (header.bits < 8) {
+        packed.resize(header.packedBytes);
+        data = &packed[0];
+    }
+    if (header.compressedBytes == 0) {
+        //cerr<<"stored by the MPI mode"<<endl;
+        bool complete = fread(data, 1, header.packedBytes, file) == header.packedBytes;
+        fclose(file);
+        if (!complete) {
+            cout<<filename<<" is corrupted"<<endl;
+            exit(1);
+        }
+        return;
+    }
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    inflateInit(&stream);
+    vector<unsigned char> block(ioBlock);
+    uint64_t done = 0;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        if (stream.avail_in == 0) {
+            stream.avail_in = fread(&block[0], 1, ioBlock, file);
+            stream.next_in = &block[0];
+            if (stream.avail_in == 0) break;
+        }
+        uint64_t left = header.packedBytes-done;
+        uInt chunk = left < zlibChunk ? left : zlibChunk;
+        stream.next_out = data+done;
+        stream.avail_out = chunk;
+        status = inflate(&stream, Z_NO_FLUSH);
+        done += chunk-stream.avail_out;
+        if (status == Z_BUF_ERROR && done < header.packedBytes) status = Z_OK;
+    }
+    inflateEnd(&stream);
+    fclose(file);
+    if (status != Z_STREAM_END || done != header.packedBytes) {
+        cout<<filename<<" is corrupted"<<endl;
+        exit(1);
+    }
+    if (header.bits < 8) {
+        int perByte = 8/header.bits;
+        unsigned char mask = (1<<header.bits)-1;
+        for (uint64_t i=0; i<header.texelBytes; ++i)
+            texels[i] = (packed[i/perByte] >> (i%perByte*header.bits)) & mask;
+    }
+}
+
+bool checkpointInfo(const char* filename, struct_checkpoint* info) {
+    //cerr<<"Inside checkpointInfo "<<filename<<endl;
+    struct_checkpointHeader header;
+    if (!loadCheckpointHeader(filename, &header)) return false;
+    info->x = header.x;
+    info->y = header.y;
+    info->generation = header.generation;
+    info->format = (StateFormat)header.format;
+    info->rule = header.rule;
+    return true;
+}
+
+void saveProgramBinary(const char* filename, const string& key, uint32_t format, const vector<unsigned char>& binary) {
+    //cerr<<"Inside saveProgramBinary "<<filename<<endl;
+    struct_programHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, programMagic, sizeof(header.magic));
+    header.version = 1;
+    header.format = format;
+    header.keyBytes = key.size();
+    header.binaryBytes = binary.size();
+    //cerr<<"each process writes its own temporary file"<<endl;
+    string temporary = string(filename)+"."+to_string(getpid())+".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) return;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(key.data(), 1, key.size(), file) == key.size() &&
+              fwrite(&binary[0], 1, binary.size(), file) == binary.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), filename) != 0) remove(temporary.c_str());
+}
+
+bool loadProgramBinary(const char* filename, const string& key, uint32_t* format, vector<unsigned char>* binary) {
+    //cerr<<"Inside loadProgramBinary "<<filename<<endl;
+    FILE* file = fopen(filename, "rb");
+    if (!file) return false;
+    struct_programHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, programMagic, sizeof(header.magic)) == 0 && header.version == 1 &&
+              header.keyBytes == key.size() && header.binaryBytes > 0;
+    if (ok) {
+        string stored(key.size(), '\0');
+        ok = fread(&stored[0], 1, stored.size(), file) == stored.size() && stored == key;
+    }
+    if (ok) {
+        binary->resize(header.binaryBytes);
+        ok = fread(&(*binary)[0], 1, binary->size(), file) == binary->size();
+        *format = header.format;
+    }
+    fclose(file);
+    return ok;
+}
+
+bool makeDirectories(const string& path) {
+    for (size_t slash = path.find('/', 1); slash != string::npos; slash = path.find('/', slash+1))
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    mkdir(path.c_str(), 0755);
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+}
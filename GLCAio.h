@@ -0,0 +1,156 @@
+///\file GLCAio.h
+///\brief Checkpoint and history files of GLCAlib.
+///
+///Internal interface between GLCAlib.cpp and the I/O layer, not part of the public API.
+
+#ifndef GLCAio_H
+#define GLCAio_H
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "GLCAlib.h"
+
+namespace GLCAlib {
+///first bytes of a checkpoint file, "GLCAckpt"
+extern const char checkpointMagic[8];
+
+///\brief Header of a checkpoint file, followed by the zlib stream of the packed texels
+///
+///The texels are the ones of the texture, row by row. R8UI states are packed in 2 or 4 bits
+///when they fit, the lowest bits of each byte holding the first cell; the other formats
+///are stored as they are (built-in CONWAY texels already hold a bit per cell).
+///Checkpoints written in parallel by the MPI mode are not compressed: compressedBytes is 0
+///and the R8UI states follow the header as they are, one byte per cell for CONWAY too.
+struct struct_checkpointHeader {
+    ///"GLCAckpt"
+    char magic[8];
+    ///layout version of the file
+    int32_t version;
+    ///StateFormat of the texture
+    int32_t format;
+    ///BuiltinRule, -1 for shaders
+    int32_t rule;
+    ///bits of each byte of the texels in the packed data: 2, 4 or 8
+    int32_t bits;
+    ///cells in each direction, texels in each row
+    int64_t x, y, texels_x;
+    ///generation of the state
+    int64_t generation;
+    ///hash of the shader source, see hashSource()
+    uint64_t shaderHash;
+    ///bytes of the texels, of the packed texels and of the zlib stream
+    uint64_t texelBytes, packedBytes, compressedBytes;
+};
+
+///\brief 64 bit FNV-1a hash of a shader, identifies the rule of a checkpoint
+uint64_t hashSource(const char* source);
+
+///\brief Packs, compresses and writes a checkpoint
+///
+///The file is written next to filename and renamed over it only once complete, so a
+///crash while writing leaves the previous checkpoint intact.
+///@param[in] filename: the checkpoint file\n
+///@param[in] header: identity of the state, the sizes and the packing are filled here\n
+///@param[in] texels: the state, header.texelBytes bytes
+void saveCheckpoint(const char* filename, struct_checkpointHeader header, const unsigned char* texels);
+
+///\brief Reads the header of a checkpoint
+///@return FALSE if filename is missing or is not a checkpoint
+bool loadCheckpointHeader(const char* filename, struct_checkpointHeader* header);
+
+///\brief Reads the texels of a checkpoint
+///@param[in] filename: the checkpoint file\n
+///@param[in] header: its header, given by loadCheckpointHeader\n
+///@param[out] texels: header.texelBytes bytes
+void loadCheckpoint(const char* filename, const struct_checkpointHeader& header, unsigned char* texels);
+
+///first bytes of a file of the program cache, "GLCAprog"
+extern const char programMagic[8];
+
+///\brief Header of a file of the program cache, followed by its key and the program binary
+///
+///The key is the whole text the program was built from, so a file is only used for the
+///very program and driver it was written for; a hash of the key only names the file.
+struct struct_programHeader {
+    ///"GLCAprog"
+    char magic[8];
+    ///layout version of the file
+    int32_t version;
+    ///format of the binary, given by glGetProgramBinary
+    uint32_t format;
+    ///bytes of the key and of the binary
+    uint64_t keyBytes, binaryBytes;
+};
+
+///\brief Writes a program binary to the program cache
+///
+///As checkpoints the file is written aside and renamed over filename once complete, so
+///concurrent programs never read a partial binary. A cache that can not be written is
+///just left as it is.
+void saveProgramBinary(const char* filename, const std::string& key, uint32_t format, const std::vector<unsigned char>& binary);
+
+///\brief Reads a program binary from the program cache
+///@return FALSE if filename is missing, damaged or was written for another key
+bool loadProgramBinary(const char* filename, const std::string& key, uint32_t* format, std::vector<unsigned char>* binary);
+
+///\brief Creates a directory and the missing ones above it
+///@return FALSE if it does not exist in the end
+bool makeDirectories(const std::string& path);
+
+///\brief Header of a history file, followed by its records and its index
+struct struct_historyHeader {
+    ///identity of the states as for checkpoints, with magic "GLCAhist"
+    struct_checkpointHeader identity;
+    ///texels on each side of the tiles of the deltas
+    int32_t tile;
+    ///records between two keyframes
+    int32_t keyframes;
+};
+
+///\brief Header of a record, followed by its zlib stream
+///
+///Keyframes hold the texels, deltas the index (uint32) and texels of each changed tile.
+struct struct_historyRecord {
+    int64_t generation;
+    int32_t keyframe;
+    ///changed tiles of a delta
+    int32_t tiles;
+    ///bytes before and after compression
+    uint64_t rawBytes, compressedBytes;
+};
+
+///\brief Entry of the index written at the end of a history
+struct struct_historyIndex {
+    int64_t generation;
+    ///offset of the struct_historyRecord in the file
+    uint64_t offset;
+    int32_t keyframe;
+    int32_t unused;
+};
+
+///\brief Records a computation as keyframes and deltas of the changed tiles
+class HistoryWriter {
+public:
+    ///@param[in] filename: the history file, replaced\n
+    ///@param[in] identity: identity of the states, as for checkpoints\n
+    ///@param[in] keyframes: records between two keyframes
+    HistoryWriter(const char* filename, const struct_checkpointHeader& identity, int keyframes);
+    ///\brief Writes the index and closes the file
+    ~HistoryWriter();
+    ///\brief Appends a state, identity.texelBytes bytes, and flushes it to the file
+    void record(long generation, const unsigned char* texels);
+
+private:
+    FILE* file;
+    struct_historyHeader header;
+    std::vector<struct_historyIndex> index;
+    ///last recorded state, changed tiles and compressed record
+    std::vector<unsigned char> previous, payload, compressed;
+    int tiles_x, tiles_y;
+    long sinceKeyframe;
+};
+}
+
+#endif
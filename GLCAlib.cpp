@@ -5,83 +5,554 @@
 
 //includes
 #include <iostream>
-#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <deque>
+#include <map>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "GLCAlib.h"
+#include "GLCAcpu.h"
+#include "GLCAio.h"
+#include "GLCAtrace.h"
 
 using namespace std;
 namespace GLCAlib {
+bool initEGL(void);
+void closeEGL(void);
 void initGLEW(void);
-void initFBO(void);
-void initGLSL(void);
+void initFBO(Simulation::Instance& s);
+void bindFBO(Simulation::Instance& s);
+void initGLSL(Simulation::Instance& s);
+string programCacheDirectory(void);
+GLhandleARB linkProgram(const GLcharARB* source, GLenum type);
+void freePrograms(void);
+double secondsSince(chrono::steady_clock::time_point begin);
+void setComputation(Simulation::Instance& s, void* image, int x, int y, char* shader, int iterations, StateFormat format);
+void runComputation(Simulation::Instance& s, int argc, char** argv, bool gui);
+void createComputation(Simulation::Instance& s, Backend requested, bool attached);
+void useProgram(Simulation::Instance& s);
+void freeComputation(Simulation::Instance& s);
+void currentSimulations(void);
+void useSimulation(Simulation::Instance& s);
+void openSimulation(Simulation::Instance& s, const void* image, int x, int y, char* shader, StateFormat format);
+string computeShaderSource(Simulation::Instance& s, const char* rule);
+void initComputeTiles(Simulation::Instance& s);
+void initActiveTiles(Simulation::Instance& s);
+void finishActivity(Simulation::Instance& s);
+void initSnapshots(Simulation::Instance& s);
+void queueSnapshot(Simulation::Instance& s, bool snapshot, bool checkpoint, bool history);
+bool retireSnapshot(Simulation::Instance& s, bool wait);
+void drainSnapshots(Simulation::Instance& s);
+void finishSnapshots(Simulation::Instance& s);
+void snapshotWorker(Simulation::Instance& s);
+void initDisplayGLSL(Simulation::Instance& s);
 
 bool checkFramebufferStatus(void);
 void checkGLErrors(const char *label);
 void printInfoLog(GLhandleARB obj);
 
-void setupTexture (const GLuint texID);
-void createTextures(void);
-void transferToTexture(float* image, GLuint texID);
-void transferFromTexture(float* data);
+void setupTexture (Simulation::Instance& s, const GLuint texID);
+void setupTexture (Simulation::Instance& s, const GLuint texID, int width, int height);
+void createTextures(Simulation::Instance& s);
+void initBlocks(Simulation::Instance& s);
+void createBlocks(Simulation::Instance& s);
+void freeBlocks(Simulation::Instance& s);
+void exchangeHalos(Simulation::Instance& s);
+int typeBytes(Simulation::Instance& s, GLenum type);
+void initStaging(Simulation::Instance& s);
+void* mapStaging(Simulation::Instance& s);
+void uploadStaging(Simulation::Instance& s, int first, int textures, GLenum type);
+void freeStaging(Simulation::Instance& s);
+void transferToTexture(Simulation::Instance& s, void* image, int first, int textures);
+void readState(Simulation::Instance& s, GLenum type, void* pixels);
+void feedInput(Simulation::Instance& s);
+void resumeTextures(Simulation::Instance& s);
+long resumeStates(const char* checkpoint, unsigned char* states, int x, int y, long iterations);
+void transferFromTexture(Simulation::Instance& s, void* data);
 
+long generationsLeft(Simulation::Instance& s);
+int advance(Simulation::Instance& s, long generations);
+int step(Simulation::Instance& s, long generations);
+int stepCompute(Simulation::Instance& s, long generations);
+int stepBlocks(Simulation::Instance& s);
+void initEnsembleQuads(Simulation::Instance& s);
+void runEnsemble(int argc, char** argv, unsigned char* boards, int count, int x, int y, char* shader, int iterations, StateFormat format, int packed, int rule);
+void runBuiltin(int argc, char** argv, const char* checkpoint, unsigned char* states, int x, int y, BuiltinRule rule, bool gui, int iterations);
+void packCells(const unsigned char* states, unsigned int* words, int x, int y);
+void unpackCells(const unsigned int* words, unsigned char* states, int x, int y);
+void initHybrid(Simulation::Instance& s);
+void freeHybrid(Simulation::Instance& s);
+void loadHybridRows(Simulation::Instance& s, int first, int last);
+void storeHybridRows(Simulation::Instance& s, int first, int last, int tex);
+void syncHybrid(Simulation::Instance& s);
+int stepHybrid(Simulation::Instance& s);
+void balanceHybrid(Simulation::Instance& s);
 void run(void);
-void swap(void);
+void swap(Simulation::Instance& s);
 
 void display();
+void keyboard(unsigned char key, int x, int y);
+void special(int key, int x, int y);
+void showRecord(Simulation::Instance& s, long record);
 void reshape(int width, int height);
 
-///The data matrix (Texture)
-float* data;
-///Width of the matrix
-int texSize_x;
-///Height of the matrix
-int texSize_y;
-///Size of the image (4*x*y being RGBA)
-int N;
-///If TRUE displays the Automata evolution
-bool withgui;
-///number of iterations required
-int numIterations=0;
-long countIterations=0;
-
-///timing vars
-time_t start, end;
+///times of the last computation, see timing()
+struct_timing lastTiming;
 /////needed for real-time performance extimation
 //long lastc, lasti;
 
-///number of iterations between 2 successive visualizations\n
-///lower is smoother and slower.
-int refrashrate=1;
-
-///texture identifiers
-GLuint TexID_A[2];
+///engine tunables, see GLCAlib.h
+struct_engine engine = {
+    60.0f,    // refresh_fps
+    1,        // refresh_generations
+    NULL,     // palette
+    0,        // palette_colors
+    FRAGMENT, // backend
+    1,        // steps_per_pass
+    0,        // cpu_threads
+    true,     // cpu_bit_sliced
+    true,     // active_tiles
+    0,        // snapshot_generations
+    NULL,     // snapshot
+    NULL,     // snapshot_user
+    3,        // snapshot_buffers
+    0,        // input_generations
+    NULL,     // input
+    NULL,     // input_user
+    false,    // byte_image
+    0,        // checkpoint_generations
+    NULL,     // checkpoint_file
+    NULL,     // history_file
+    1,        // history_generations
+    100,      // history_keyframes
+    0,        // block_size
+    0.5f,     // hybrid_gpu_share
+    false,    // lookup_table
+    NULL,     // program_cache
+    NULL      // trace_file
+};
 
 ///\brief ping-pong management vars
 ///In the shader, textures are  alternatively read-only and write-only
-int writeTex = 0;
-int readTex = 1;
 GLenum attachmentpoints[] = { GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT };
 
-///GLSL vars
-GLhandleARB programObject;
-GLhandleARB shaderObject;
-GLint Param_A;
+///\brief A block of a matrix larger than the textures
+///
+///Each block has its own textures and framebuffer; the textures hold the cells of the
+///block surrounded by a halo one texel wide.
+struct struct_block {
+    GLuint tex[2];
+    GLuint fb;
+    ///first texel of the block in the matrix and texels of the block, halo excluded
+    int x, y, w, h;
+};
 
-///FBO identifier
-GLuint fb;
+///largest side of the matrix of an ensemble when engine.block_size is 0
+const int ensembleSize = 8192;
 
-///handle the (eventually offscreen) window
-GLuint glutWindowHandle;
+///the split line of the hybrid backend is moved every hybridBalance generations, from the times measured meanwhile
+const int hybridBalance = 16;
+const int hybridBandRows = 16;
+
+///workgroups of the compute backend have computeThreads x computeThreads invocations
+const int computeThreads = 16;
+
+///activity of the last computation, also set by the CPU backend
+struct_activity lastActivity;
+vector<unsigned char> lastActivityMap;
+
+///\brief Lists the active tiles and clears the change flags of the current pass
+///
+///The list starts with the arguments of the indirect dispatch (groups x, y, z) and the
+///64 bit count of the tile updates. A pass of k generations carries the changes up to
+///k cells away, so a tile is active when one of the tiles within glca_reach = ceil(k/TILE)
+///of it changed in the last pass.
+const char* compactShader =
+    "#version 430\n"
+    "layout(local_size_x = 64) in;"
+    "layout(std430, binding = 0) readonly buffer glca_last { uint changed[]; };"
+    "layout(std430, binding = 1) writeonly buffer glca_next { uint next[]; };"
+    "layout(std430, binding = 2) buffer glca_active { uint groups; uint groups_y; uint groups_z; uint updates; uint updates_hi; uint list[]; };"
+    "uniform ivec2 glca_tiles;"
+    "uniform bool glca_all;"
+    "uniform int glca_reach;"
+    "void main() {"
+    "    int i = int(gl_GlobalInvocationID.x);"
+    "    if (i >= glca_tiles.x*glca_tiles.y) return;"
+    "    ivec2 t = ivec2(i % glca_tiles.x, i / glca_tiles.x);"
+    "    bool live = glca_all;"
+    "    for (int dy = -glca_reach; dy <= glca_reach; ++dy)"
+    "        for (int dx = -glca_reach; dx <= glca_reach; ++dx) {"
+    "            ivec2 n = t + ivec2(dx, dy);"
+    "            if (all(greaterThanEqual(n, ivec2(0))) && all(lessThan(n, glca_tiles)) && changed[n.y*glca_tiles.x + n.x] != 0u) live = true;"
+    "        }"
+    "    next[i] = 0u;"
+    "    if (live) {"
+    "        list[atomicAdd(groups, 1u)] = uint(i);"
+    "        if (atomicAdd(updates, 1u) == 0xffffffffu) atomicAdd(updates_hi, 1u);"
+    "    }"
+    "}";
+
+///\brief A readback in flight, checkpoints and records are read in the type of the texture
+struct struct_readback {
+    GLuint pbo;
+    GLsync fence;
+    long generation;
+    bool snapshot, checkpoint, history;
+    GLenum type;
+    int texelBytes;
+};
+///\brief A snapshot copied from a pixel buffer, cells holds the unpacked bit-packed cells
+struct struct_frame {
+    vector<unsigned char> data, cells;
+    long generation;
+    bool snapshot, checkpoint, history;
+};
 
 ///struct for variable parts of GL calls (texture format, float format etc)
 struct struct_textureParameters {
-    char* name;
+    const char* name;
     GLenum texTarget;
     GLenum texInternalFormat;
     GLenum texFormat;
+    GLenum texType;
+    const char* imageFormat;
     char* shader_source;
+    int texelBytes;
+};
+
+///GL parameters of each StateFormat
+const struct struct_stateFormat {
+    const char* name;
+    GLenum texInternalFormat;
+    GLenum texFormat;
+    GLenum texType;
+    const char* imageFormat;
+    int texelBytes;
+} stateFormats[] = {
+    { "TEXRECT - float_ARB - RGBA - 32", GL_RGBA32F_ARB, GL_RGBA, GL_FLOAT, "rgba32f", 16 },
+    { "TEXRECT - unorm - RGBA - 8", GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, "rgba8", 4 },
+    { "TEXRECT - unorm - RG - 8", GL_RG8, GL_RG, GL_UNSIGNED_BYTE, "rg8", 2 },
+    { "TEXRECT - uint - R - 8", GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_BYTE, "r8ui", 1 },
+    { "TEXRECT - uint - R - 32", GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, "r32ui", 4 }
+};
+
+///\brief The state of a computation
+///
+///init runs its computation on an instance of its own, each Simulation keeps one, and the
+///engine functions work on the instance they are given. Instances are value-initialized:
+///the members without an initializer start at zero.
+struct Simulation::Instance {
+    ///The data matrix (Texture), its layout depends on the state format
+    void* data;
+    ///Width of the matrix
+    int texSize_x;
+    ///Height of the matrix
+    int texSize_y;
+    ///Size of the image (4*x*y being RGBA)
+    long N;
+    ///\brief Built-in rules may pack several cells in each texel
+    ///Only affects the GUI, the computation sees texels
+    int cellsPerTexel = 1;
+    ///Width of the matrix in cells
+    int cells_x;
+    ///If TRUE displays the Automata evolution
+    bool withgui;
+    ///number of iterations required
+    int numIterations;
+    long countIterations;
+
+    ///the backend actually used, engine.backend may not be supported
+    Backend backend;
+
+    ///time at which the GUI has to be refreshed next
+    chrono::steady_clock::time_point nextFrame;
+    ///window size, the state is stretched to fill it
+    int winSize_x, winSize_y;
+    ///title of the GUI window, replaced by the generation while scrubbing
+    string windowTitle;
+
+    ///texture identifiers
+    GLuint TexID_A[2];
+    ///\brief ping-pong management vars
+    ///In the shader, textures are  alternatively read-only and write-only
+    int writeTex = 0;
+    int readTex = 1;
+
+    ///\brief block vars
+    ///A matrix larger than the textures is split into blocks_x*blocks_y blocks, see
+    ///struct_block. Empty when the matrix fits in TexID_A.
+    vector<struct_block> blocks;
+    int blocks_x, blocks_y;
+    ///location of glca_offset, the position of the textures of a block in the matrix
+    GLint Param_offset;
+
+    ///\brief ensemble vars
+    ///The boards of an ensemble are packed in the matrix in ensembleColumns columns, each
+    ///followed by a gutter one texel wide that is never written, so that the boards see an
+    ///empty border as a single matrix does. All of them are drawn by a single call.
+    int ensembleBoards;
+    int ensembleColumns;
+    ///texels of each board
+    int board_x, board_y;
+    ///vertex buffer of the quads of the boards
+    GLuint ensembleQuads;
+    ///location of glca_stride, the texels between the first columns of two boards
+    GLint Param_stride;
+
+    ///\brief hybrid backend vars
+    ///The GPU computes the rows [0, hybridSplit) of the textures and the threads of hybridPool
+    ///the rows [hybridSplit, y) of hybridCells, planar bytes with a zero border as in the CPU
+    ///backend. The other rows of the textures and of hybridCells are stale, but for the halos.
+    int hybridSplit;
+    vector<unsigned char> hybridCells[2];
+    int hybridCurrent;
+    ThreadPool* hybridPool;
+    RowKernel hybridKernel;
+    GLuint hybridQuery;
+    double hybridGPUTime, hybridCPUTime;
+    int hybridGenerations;
+
+    ///GLSL vars
+    GLhandleARB programObject;
+    GLint Param_A;
+    GLint Param_size;
+
+    ///\brief compute backend vars
+    ///Each workgroup of computeThreads x computeThreads invocations computes a tile of
+    ///computeTile x computeTile cells for computeHalo generations, reading them once
+    ///from texture_A together with an halo of computeHalo cells
+    int computeTile;
+    int computeHalo;
+    GLint Param_steps;
+
+    ///\brief active tiles vars
+    ///A compaction pass lists the tiles to compute from the change flags of the last pass,
+    ///then the rule is dispatched indirectly on the list.
+    bool activeTiles;
+    int tiles_x, tiles_y;
+    ///change flags of the last pass and of the current one, header and list of the active tiles
+    GLuint activeBuffers[3];
+    GLhandleARB compactProgram;
+    GLint Param_compactTiles, Param_compactAll, Param_compactReach, Param_tilesX;
+    ///steps of the last pass: a tile that did not change in k steps may change in less
+    int lastSteps;
+    ///passes computed so far
+    long long passes;
+
+    ///\brief snapshot vars
+    ///Each snapshot is read back into the next pixel buffer object of a ring and guarded by
+    ///a fence; it is mapped only once the fence is signaled, and its copy is handed to a
+    ///worker thread that runs engine.snapshot, so the computation never waits for it.
+    ///Checkpoints and the records of the history take the same way and are written by the worker.
+    bool snapshotting, checkpointing, recording;
+    long nextSnapshot, nextCheckpoint, nextHistory;
+    vector<struct_readback> snapshotRing;
+    ///oldest readback in flight and number of readbacks in flight
+    int snapshotHead, snapshotPending;
+    ///frames waiting for the worker and frames free to be filled, at most one per pixel buffer
+    deque<struct_frame*> snapshotQueue;
+    vector<struct_frame*> snapshotFree;
+    mutex snapshotMutex;
+    condition_variable snapshotReady, snapshotDone;
+    bool snapshotQuit;
+    std::thread snapshotThread;
+    ///identity of the checkpoints and of the history of the running computation
+    struct_checkpointHeader checkpointHeader;
+    ///recorder of engine.history_file
+    HistoryWriter* historyWriter;
+
+    ///\brief scrub vars
+    ///While scrubbing the computation is paused and the record scrubRecord is shown from the
+    ///texture written by the next pass, so the current state is left untouched
+    History* scrubHistory;
+    long scrubRecord;
+
+    ///\brief resume vars
+    ///The StateFormat and the BuiltinRule (-1 for shaders) of the computation, and the
+    ///checkpoint it resumes from (NULL for a new computation)
+    StateFormat stateFormat;
+    int builtinRule = -1;
+    const char* resumeFile;
+
+    ///\brief upload vars
+    ///States reach the textures through two pixel unpack buffers, used in turn and
+    ///persistently mapped when possible; a fence keeps each buffer from being written
+    ///while an upload may still read it. They are created by the first upload that needs
+    ///them, and those of the initial state freed once it is in the textures.
+    GLuint stagingBuffers[2];
+    GLsync stagingFences[2];
+    void* stagingMapped[2];
+    int staging;
+    bool stagingPersistent;
+    ///TRUE when engine.input has to be called, at generation nextInput
+    bool inputting;
+    long nextInput;
+    ///cells written by engine.input when the texture packs them
+    vector<unsigned char> inputCells;
+
+    ///\brief display vars
+    ///Integer states can not be textured by the fixed function pipeline,
+    ///they are mapped to colors through a palette texture
+    GLhandleARB displayProgram;
+    GLuint paletteTex;
+
+    ///FBO identifier
+    GLuint fb;
+
+    ///GL parameters of the state format
+    struct_textureParameters textureParameters;
+
+    ///\brief Simulation vars
+    ///The rule, textureParameters.shader_source points to it
+    string source;
+    ///cells of a two state rule, packed as in the texture
+    vector<unsigned int> words;
+    ///size of the automaton in cells
+    int x, y;
+};
+
+///the computation displayed by the GUI, the GLUT callbacks take no arguments
+Simulation::Instance* displayed = NULL;
+
+///handle the (eventually offscreen) window
+GLuint glutWindowHandle;
+
+///\brief headless context vars
+///Used instead of a GLUT window when no GUI is requested
+EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+EGLContext eglContext = EGL_NO_CONTEXT;
+EGLSurface eglSurface = EGL_NO_SURFACE;
+
+///\brief simulation vars
+///live simulations, the context stays until the last one is destroyed
+int simulations = 0;
+///hidden window of the simulations when no EGL context is available
+int simulationWindow = 0;
+///programs linked in the headless context, by backend and source
+map<string, GLhandleARB> programCache;
+
+///\brief Bit-packed two state rules, 32 cells per texel
+///
+///Bit i of a texel is the cell 32*s+i of the row. The live neighbours of the 32 cells
+///are counted in parallel: the neighbour words are shifted so that each bit lines up with
+///its cell, then added with a tree of bitwise full adders into the bit-planes b0..b3 of
+///the count. %s is the next state, an OR of the counts of the rule written by ruleSource.
+///The cells that pad the last word of each row must stay dead: %d is the index of that word
+///and %uu the mask of its valid cells.
+const char* lifeShader =
+    "#version 150 compatibility\n"
+    "uniform usampler2DRect texture_A;"
+    "uniform vec2 glca_offset;"
+    "uniform int glca_stride;"
+    "out uvec4 state;"
+    "uint word(float dx, float dy) { return texture(texture_A, gl_TexCoord[0].st + vec2(dx, dy)).r; }"
+    "uvec2 add(uint a, uint b, uint c) { return uvec2(a ^ b ^ c, (a & b) | (c & (a ^ b))); }"
+    "void main(void) {"
+    "    uint n = word(0.0, -1.0), c = word(0.0, 0.0), s = word(0.0, 1.0);"
+    "    uvec2 up = add((n << 1) | (word(-1.0, -1.0) >> 31), n, (n >> 1) | (word(1.0, -1.0) << 31));"
+    "    uvec2 down = add((s << 1) | (word(-1.0, 1.0) >> 31), s, (s >> 1) | (word(1.0, 1.0) << 31));"
+    "    uint w = (c << 1) | (word(-1.0, 0.0) >> 31), e = (c >> 1) | (word(1.0, 0.0) << 31);"
+    "    uvec2 ones = add(up.x, down.x, w ^ e);"
+    "    uvec2 twos = add(up.y, down.y, w & e);"
+    "    uint b0 = ones.x, b1 = twos.x ^ ones.y, carry = twos.x & ones.y;"
+    "    uint b2 = twos.y ^ carry, b3 = twos.y & carry;"
+    "    uint next = %s;"
+    "    if (int(gl_TexCoord[0].s + glca_offset.x) %% glca_stride == %d) next &= %uu;"
+    "    state = uvec4(next);"
+    "}";
+
+///\brief Rules on R8UI states, driven by their transition table
+///
+///%s is the table of ruleSource, 9 counts per state and a last row of zeros where the
+///states the rule does not know end up; %d is the counted state and the number of states.
+const char* tableShader =
+    "#version 150 compatibility\n"
+    "uniform usampler2DRect texture_A;"
+    "out uvec4 state;"
+    "const uint glca_table[] = uint[](%s);"
+    "uint counted(float dx, float dy) { return texture(texture_A, gl_TexCoord[0].st + vec2(dx, dy)).r == %du ? 1u : 0u; }"
+    "void main(void) {"
+    "    uint c = texture(texture_A, gl_TexCoord[0].st).r;"
+    "    uint n = counted(-1.0, -1.0) + counted(0.0, -1.0) + counted(1.0, -1.0) + counted(-1.0, 0.0) +"
+    "             counted(1.0, 0.0) + counted(-1.0, 1.0) + counted(0.0, 1.0) + counted(1.0, 1.0);"
+    "    state = uvec4(glca_table[min(c, %du)*9u + n]);"
+    "}";
+
+///\brief Two state rules on R8UI states, driven by the table of their 3x3 neighbourhoods
+///
+///The 9 cells make the index of a bit of the table, packed by ruleSource in the 16 words
+///of %s: each cell costs a fetch and an OR, whatever the rule.
+const char* lookupShader =
+    "#version 150 compatibility\n"
+    "uniform usampler2DRect texture_A;"
+    "out uvec4 state;"
+    "const uint glca_table[] = uint[](%s);"
+    "uint cell(float dx, float dy, uint bit) { return min(texture(texture_A, gl_TexCoord[0].st + vec2(dx, dy)).r, 1u) << bit; }"
+    "void main(void) {"
+    "    uint i = cell(-1.0, -1.0, 0u) | cell(0.0, -1.0, 1u) | cell(1.0, -1.0, 2u) |"
+    "             cell(-1.0, 0.0, 3u) | cell(0.0, 0.0, 4u) | cell(1.0, 0.0, 5u) |"
+    "             cell(-1.0, 1.0, 6u) | cell(0.0, 1.0, 7u) | cell(1.0, 1.0, 8u);"
+    "    state = uvec4((glca_table[i >> 5] >> (i & 31u)) & 1u);"
+    "}";
+
+///\brief Generates the shader of a built-in rule
+///
+///Two state rules are bit-packed (see lifeShader), with the live counts of the rule
+///as minterms of b0..b3, or look their neighbourhood up (see lookupShader); the others
+///look their table up (see tableShader).
+///@param[in] x: width of the automaton in cells
+string ruleSource(BuiltinRule rule, int x) {
+    //cerr<<"Inside ruleSource"<<endl;
+    const struct_rule& table = ruleTable(rule);
+    string expression;
+    vector<char> source;
+    if (lookupRule(table)) {
+        for (int k=0; k<16; ++k) {
+            unsigned int word = 0;
+            for (int b=0; b<32; ++b) word |= (unsigned int)table.neighbourhood[32*k+b] << b;
+            char next[16];
+            sprintf(next, "%uu", word);
+            expression += (k ? ", " : "") + string(next);
+        }
+        source.resize(strlen(lookupShader)+expression.size()+32);
+        sprintf(&source[0], lookupShader, expression.c_str());
+        return &source[0];
+    }
+    if (table.states == 2) {
+        for (int n=0; n<9; ++n) {
+            bool born = (table.life>>n) & 1, survives = (table.life>>(9+n)) & 1;
+            if (!born && !survives) continue;
+            char count[64];
+            sprintf(count, "(%s%sb0 & %sb1 & %sb2 & %sb3)", born ? (survives ? "" : "~c & ") : "c & ",
+                    n&1 ? "" : "~", n&2 ? "" : "~", n&4 ? "" : "~", n&8 ? "" : "~");
+            expression += (expression.empty() ? "" : " | ") + string(count);
+        }
+        if (expression.empty()) expression = "0u";
+        int words_x = (x+31)/32;
+        unsigned int lastMask = x%32 ? (1u<<(x%32))-1 : 0xffffffffu;
+        source.resize(strlen(lifeShader)+expression.size()+32);
+        sprintf(&source[0], lifeShader, expression.c_str(), words_x-1, lastMask);
+        return &source[0];
+    }
+    for (int i=0; i<9*(table.states+1); ++i) {
+        char next[8];
+        sprintf(next, "%uu", i < 9*table.states ? (unsigned int)table.next[i] : 0u);
+        expression += (i ? ", " : "") + string(next);
+    }
+    source.resize(strlen(tableShader)+expression.size()+32);
+    sprintf(&source[0], tableShader, expression.c_str(), table.counted, table.states);
+    return &source[0];
 }
-textureParameters;
 
 ///\brief Initialize OpenGL and executes the given shader
 ///@param[in] arc: number of parameters on the commend line\n
@@ -92,98 +563,726 @@ textureParameters;
 ///@param[in] shader: the program executed on the GPU
 ///@param[in] gui: if TRUE, visualizes the computation evolution
 ///@param[in] iterations: length of the computation in generations
-void init(int argc, char** argv, float* image, int x, int y, char* shader, bool gui=true, int iterations=0) {
+///@param[in] format: how the state is stored, see StateFormat
+void init(int argc, char** argv, void* image, int x, int y, char* shader, bool gui, int iterations, StateFormat format) {
     //cerr<<"main"<<endl;
-    textureParameters.name				= "TEXRECT - float_ARB - RGBA - 32";
-    textureParameters.texTarget			= GL_TEXTURE_RECTANGLE_ARB;
-    textureParameters.texInternalFormat	= GL_RGBA32F_ARB;
-    textureParameters.texFormat			= GL_RGBA;
-    textureParameters.shader_source		= shader;
-
-	//cerr<<"assign parameters to global variables"<<endl;
-    data=image;
-    texSize_x=x;
-    texSize_y=y;
-    N=4*texSize_x*texSize_y;
-    numIterations=iterations;
-    withgui=gui;
+    Simulation::Instance s{};
+    setComputation(s, image, x, y, shader, iterations, format);
+    runComputation(s, argc, argv, gui);
+}
+
+///\brief Runs the computation set by setComputation, then reads its state back into its data
+///@param[in] argc: number of parameters on the commend line\n
+///@param[in] argv: holds parameters passed on the commend line\n
+///@param[in] gui: if TRUE, visualizes the computation evolution
+void runComputation(Simulation::Instance& s, int argc, char** argv, bool gui) {
+    //cerr<<"Inside runComputation"<<endl;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    memset(&lastTiming, 0, sizeof(lastTiming));
+    s.withgui=gui;
 
     //cerr<<"calc texture dimensions"<<endl;
-    cout<<textureParameters.name<<", x="<<texSize_x<<", y="<<texSize_y<<", numIter="<<numIterations<<endl;
+    cout<<s.textureParameters.name<<", x="<<s.cells_x<<", y="<<s.texSize_y<<", numIter="<<s.numIterations<<endl;
 
     //cerr<<"init glut and glew"<<endl;
-    glutInit (&argc, argv);
-    if (withgui) {
+    if (s.withgui) {
         //cerr<<"loading GUI"<<endl;
+        glutInit (&argc, argv);
         glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_CONTINUE_EXECUTION);
+        glutInitWindowSize(s.cells_x, s.texSize_y);
+        s.winSize_x = s.cells_x;
+        s.winSize_y = s.texSize_y;
+        s.windowTitle = argv[0];
+        glutWindowHandle = glutCreateWindow(argv[0]);
         glutDisplayFunc(display);
         glutReshapeFunc(reshape);
         glutIdleFunc(run);
+        glutKeyboardFunc(keyboard);
+        glutSpecialFunc(special);
         glClearColor(0.0, 0.0, 0.0, 1.0);
-        glutInitWindowSize(texSize_x, texSize_y);
+    } else if (simulations > 0)
+        currentSimulations();
+    else if (eglContext == EGL_NO_CONTEXT && !initEGL()) {
+        //cerr<<"no headless context, falling back to an hidden window"<<endl;
+        glutInit (&argc, argv);
+        glutWindowHandle = glutCreateWindow(argv[0]);
+        glutHideWindow();
     }
-    glutWindowHandle = glutCreateWindow(argv[0]);
 
     initGLEW();
+    {
+        TraceScope scope("setup");
+        createComputation(s, engine.backend, true);
+    }
+    strncpy(lastTiming.renderer, (const char*)glGetString(GL_RENDERER), sizeof(lastTiming.renderer)-1);
+    GLuint timestamps[2] = { 0, 0 };
+    if (GLEW_ARB_timer_query) {
+        glGenQueries(2, timestamps);
+        glQueryCounter(timestamps[0], GL_TIMESTAMP);
+    }
+    long first = s.countIterations;
+    lastTiming.setup = secondsSince(begin)-lastTiming.upload;
+
+    //START MAIN COMPUTATION
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (s.withgui){
+        //cerr<<"a GUI computation of 0 generations still shows one"<<endl;
+        if (s.numIterations == 0) s.numIterations = 1;
+        s.nextFrame = chrono::steady_clock::now();
+        displayed = &s;
+        glutMainLoop();
+        displayed = NULL;
+        delete s.scrubHistory;
+        s.scrubHistory = NULL;
+	} else
+        //no presentation at all: just compute
+        while (s.countIterations!=s.numIterations) advance(s, generationsLeft(s));
+    finishSnapshots(s);
+    if (timestamps[0]) glQueryCounter(timestamps[1], GL_TIMESTAMP);
+    glFinish();
+    lastTiming.compute = secondsSince(start);
+    if (timestamps[0]) {
+        GLuint64 t0, t1;
+        glGetQueryObjectui64v(timestamps[0], GL_QUERY_RESULT, &t0);
+        glGetQueryObjectui64v(timestamps[1], GL_QUERY_RESULT, &t1);
+        lastTiming.gpu = (t1-t0)*1e-9;
+        glDeleteQueries(2, timestamps);
+    }
+
+    //transfer the data back
+    chrono::steady_clock::time_point readback = chrono::steady_clock::now();
+    if (s.backend == HYBRID) syncHybrid(s);
+    transferFromTexture(s, s.data);
+    lastTiming.readback = secondsSince(readback);
+    traceCounters();
+    finishActivity(s);
+    lastTiming.generations = s.countIterations-first;
+    lastTiming.cells = (long long)s.cells_x*s.texSize_y;
+
+    //cerr<<"calc and print Iterations/sec"<<endl;
+    if (lastTiming.compute > 0) cout<<"GPU Iterations/sec: "<<(long)(lastTiming.generations/lastTiming.compute)<<endl;
+
+    freeComputation(s);
+    //cerr<<"the context stays while Simulations use it"<<endl;
+    if (simulations == 0) {
+        freePrograms();
+        closeEGL();
+    }
+    lastTiming.total = secondsSince(begin);
+}
+
+///\brief Sets the instance describing a computation
+///@param[in] image: buffer containing the input data\n
+///@param[in] x: width of the input
+///@param[in] y: height of the input
+///@param[in] shader: the program executed on the GPU
+///@param[in] iterations: length of the computation in generations
+///@param[in] format: how the state is stored, see StateFormat
+void setComputation(Simulation::Instance& s, void* image, int x, int y, char* shader, int iterations, StateFormat format) {
+    s.textureParameters.name				= stateFormats[format].name;
+    s.textureParameters.texTarget			= GL_TEXTURE_RECTANGLE_ARB;
+    s.textureParameters.texInternalFormat	= stateFormats[format].texInternalFormat;
+    s.textureParameters.texFormat			= stateFormats[format].texFormat;
+    s.textureParameters.texType			= stateFormats[format].texType;
+    s.textureParameters.imageFormat		= stateFormats[format].imageFormat;
+    s.textureParameters.shader_source		= shader;
+    s.textureParameters.texelBytes		= stateFormats[format].texelBytes;
+    s.stateFormat = format;
+    if (format == RGBA32F && engine.byte_image) {
+        //cerr<<"the GPU converts between bytes and floats"<<endl;
+        s.textureParameters.texType		= GL_UNSIGNED_BYTE;
+        s.textureParameters.texelBytes	= 4;
+    }
+
+	//cerr<<"assign parameters to the instance"<<endl;
+    s.data=image;
+    s.texSize_x=x;
+    s.texSize_y=y;
+    if (s.cellsPerTexel == 1) s.cells_x=x;
+    s.N=4L*s.texSize_x*s.texSize_y;
+    s.numIterations=iterations;
+    s.countIterations=0;
+    s.passes=0;
+    s.lastSteps=0;
+}
+
+///\brief Creates the textures, framebuffers and programs of the computation set by setComputation
+///
+///Needs a current context. At the end the state is in the textures and the program is in use.
+///@param[in] requested: the backend to use, if supported
+///@param[in] attached: if FALSE engine.snapshot, checkpoint_file, history_file and input are ignored
+void createComputation(Simulation::Instance& s, Backend requested, bool attached) {
+    //cerr<<"Inside createComputation"<<endl;
+    s.backend = requested;
+    if (s.backend == COMPUTE && !GLEW_ARB_compute_shader) {
+        cout<<"Compute shaders not supported, using the fragment backend"<<endl;
+        s.backend = FRAGMENT;
+    }
+    initBlocks(s);
+    if (s.ensembleBoards > 0 && !s.blocks.empty()) {
+        cout<<"The ensemble does not fit in a texture, lower engine.block_size"<<endl;
+        exit(1);
+    }
+    if (s.ensembleBoards > 0 && s.backend != FRAGMENT) {
+        cout<<"Ensembles run on the fragment backend"<<endl;
+        s.backend = FRAGMENT;
+    }
+    if (s.backend == COMPUTE && !s.blocks.empty()) {
+        cout<<"The matrix is split in blocks, using the fragment backend"<<endl;
+        s.backend = FRAGMENT;
+    }
+    if (s.backend == HYBRID && (s.builtinRule < 0 || !s.blocks.empty() || s.texSize_y < 2)) {
+        cout<<"The hybrid backend needs a built-in rule on a single texture, using the fragment backend"<<endl;
+        s.backend = FRAGMENT;
+    }
+    if (s.backend == COMPUTE) initComputeTiles(s);
+    s.activeTiles = s.backend == COMPUTE && engine.active_tiles;
 
     //cerr<<"init offscreen framebuffer"<<endl;
-    initFBO();
+    initFBO(s);
 
     //cerr<<"create textures for vectors"<<endl;
-    createTextures();
+    createTextures(s);
+    if (s.countIterations > s.numIterations) {
+        cout<<"The checkpoint is past the last generation"<<endl;
+        s.numIterations = s.countIterations;
+    }
 
     //cerr<<"init shader runtime"<<endl;
-    initGLSL();
+    initGLSL(s);
+    if (s.activeTiles) initActiveTiles(s);
+    if (s.withgui) initDisplayGLSL(s);
+    if (s.ensembleBoards > 0) initEnsembleQuads(s);
+    if (attached) initSnapshots(s);
+    else s.snapshotting = s.checkpointing = s.recording = false;
+    s.inputting = attached && engine.input != NULL && engine.input_generations > 0;
+    if (s.inputting) s.nextInput = (s.countIterations/engine.input_generations+1)*engine.input_generations;
 
     //cerr<<"init textures"<<endl;
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, attachmentpoints[writeTex], textureParameters.texTarget, TexID_A[writeTex], 0);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, attachmentpoints[readTex], textureParameters.texTarget, TexID_A[readTex], 0);
-    if (!checkFramebufferStatus()) {
-        cout<<"glFramebufferTexture2DEXT():\t [FAIL]"<<endl;
-        exit (1);
-    } else {
-        //cerr<<"glFramebufferTexture2DEXT():\t //[PASS]"<<endl;
+    if (s.blocks.empty()) {
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, attachmentpoints[s.writeTex], s.textureParameters.texTarget, s.TexID_A[s.writeTex], 0);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, attachmentpoints[s.readTex], s.textureParameters.texTarget, s.TexID_A[s.readTex], 0);
+        if (!checkFramebufferStatus()) {
+            cout<<"glFramebufferTexture2DEXT():\t [FAIL]"<<endl;
+            exit (1);
+        } else {
+            //cerr<<"glFramebufferTexture2DEXT():\t //[PASS]"<<endl;
+        }
     }
 
     // enable GLSL program
-    glUseProgramObjectARB(programObject);
-
-    //START MAIN COMPUTATION
-    start = time(NULL);
-    if (withgui){
-        glutMainLoop();
-	} else
-        while (countIterations++!=numIterations) run();
-    end = time (NULL);
-    time_t total = end-start;
-
-    //transfer the data back
-    transferFromTexture(data);
+    useProgram(s);
+    if (s.backend == HYBRID) initHybrid(s);
+    //cerr<<"the history starts with the initial state"<<endl;
+    if (s.recording) queueSnapshot(s, false, false, true);
+}
 
-    //cerr<<"calc and print Iterations/sec"<<endl;
-    if (total>0) cout<<"GPU Iterations/sec: "<<countIterations/total<<endl;
+///\brief Makes programObject current and sets the uniforms that depend on the computation
+///
+///Programs are shared through the cache, so they are set again whenever they are used.
+void useProgram(Simulation::Instance& s) {
+    glUseProgramObjectARB(s.programObject);
+    if (s.Param_stride >= 0) glUniform1iARB(s.Param_stride, s.ensembleBoards > 0 ? s.board_x+1 : s.texSize_x+1);
+    if (s.Param_offset >= 0 && s.blocks.empty()) glUniform2fARB(s.Param_offset, 0, 0);
+}
 
+///\brief Frees the objects of the computation, once its snapshots are finished
+///
+///The programs stay in the cache, the context stays as well.
+void freeComputation(Simulation::Instance& s) {
     //cerr<<"clean up"<<endl;
     glFinish();
+    writeTrace();
+    if (s.backend == HYBRID) freeHybrid(s);
+    if (s.ensembleBoards > 0) glDeleteBuffers(1, &s.ensembleQuads);
+    freeStaging(s);
 	//cerr<<"DeleteFramebuffer"<<endl;
-    glDeleteFramebuffersEXT(1, &fb);
+    glDeleteFramebuffersEXT(1, &s.fb);
 	//cerr<<"DeleteTextures"<<endl;
-    glDeleteTextures(2, TexID_A);
+    if (s.blocks.empty()) glDeleteTextures(2, s.TexID_A);
+    else freeBlocks(s);
+    if (s.paletteTex) glDeleteTextures(1, &s.paletteTex);
+    if (s.displayProgram) glDeleteObjectARB(s.displayProgram);
+    if (s.withgui) glDeleteObjectARB(s.programObject);
+    s.paletteTex = 0;
+    s.displayProgram = 0;
+    s.inputting = false;
 }
 
-///Sets up a floating point texture with NEAREST filtering.
-///(mipmaps etc. are unsupported for floating point textures)
-void setupTexture (const GLuint texID) {
+///\brief Initialize OpenGL and executes a built-in rule
+///
+///Two state rules such as CONWAY pack 32 cells in each R32UI texel and evolve them with
+///bitwise adders, the others run on R8UI states. With the CPU backend, or without GUI when no OpenGL
+///context can be created, the rule runs on the CPU instead; HASHLIFE runs it on HashLife.
+///@param[in] argc: number of parameters on the commend line\n
+///@param[in] argv: holds parameters passed on the commend line\n
+///@param[in,out] states: one byte per cell (for two state rules 0 dead, anything else alive), overwritten with the final state\n
+///@param[in] x: width of the input
+///@param[in] y: height of the input
+///@param[in] rule: the built-in rule
+///@param[in] gui: if TRUE, visualizes the computation evolution
+///@param[in] iterations: length of the computation in generations
+void init(int argc, char** argv, unsigned char* states, int x, int y, BuiltinRule rule, bool gui, int iterations) {
+    //cerr<<"Inside builtin init"<<endl;
+    runBuiltin(argc, argv, NULL, states, x, y, rule, gui, iterations);
+}
+
+///\brief Body of the built-in init and resume
+///@param[in] checkpoint: the checkpoint to resume, NULL for a new computation
+void runBuiltin(int argc, char** argv, const char* checkpoint, unsigned char* states, int x, int y, BuiltinRule rule, bool gui, int iterations) {
+    //cerr<<"Inside runBuiltin"<<endl;
+    if (engine.backend == HASHLIFE) {
+        if (gui) cout<<"The HashLife backend has no GUI"<<endl;
+        if (checkpoint && (iterations = resumeStates(checkpoint, states, x, y, iterations)) < 0) iterations = 0;
+        cout<<"HashLife, x="<<x<<", y="<<y<<", numIter="<<iterations<<endl;
+        lastActivity = struct_activity();
+        lastActivityMap.clear();
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        memset(&lastTiming, 0, sizeof(lastTiming));
+        strcpy(lastTiming.renderer, "HashLife");
+        HashLife universe(rule);
+        {
+            TraceScope scope("HashLife load");
+            universe.load(states, x, y);
+        }
+        lastTiming.setup = secondsSince(begin);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        {
+            TraceScope scope("HashLife run");
+            universe.run(iterations);
+        }
+        lastTiming.compute = secondsSince(start);
+        {
+            TraceScope scope("HashLife save");
+            universe.save(states, x, y);
+        }
+        lastTiming.readback = secondsSince(start)-lastTiming.compute;
+        lastTiming.total = secondsSince(begin);
+        lastTiming.generations = iterations;
+        lastTiming.cells = (long long)x*y;
+        if (lastTiming.compute > 0) cout<<"HashLife Iterations/sec: "<<(long)(iterations/lastTiming.compute)<<endl;
+        totals.generations += iterations;
+        traceCounters();
+        writeTrace();
+        return;
+    }
+    if (engine.backend == CPU || (!gui && !initEGL() && !getenv("DISPLAY"))) {
+        if (engine.backend != CPU) cout<<"No OpenGL context available, using the CPU backend"<<endl;
+        else if (gui) cout<<"The CPU backend has no GUI"<<endl;
+        if (checkpoint) iterations = resumeStates(checkpoint, states, x, y, iterations);
+        if (iterations >= 0) runCPU(states, x, y, rule, iterations);
+        return;
+    }
+    Simulation::Instance s{};
+    s.builtinRule = rule;
+    s.resumeFile = checkpoint;
+    string shader = ruleSource(rule, x);
+    if (!packedRule(ruleTable(rule))) {
+        setComputation(s, states, x, y, (char*)shader.c_str(), iterations, R8UI);
+        runComputation(s, argc, argv, gui);
+        return;
+    }
+
+    int words_x = (x+31)/32;
+    unsigned int* words = new unsigned int[(size_t)words_x*y];
+    packCells(states, words, x, y);
+
+    s.cellsPerTexel = 32;
+    s.cells_x = x;
+    setComputation(s, words, words_x, y, (char*)shader.c_str(), iterations, R32UI);
+    runComputation(s, argc, argv, gui);
+
+    unpackCells(words, states, x, y);
+    delete[] words;
+}
+
+///\brief Packs 32 cells per texel, as the built-in two state rules store them
+///@param[in] states: one byte per cell, 0 dead\n
+///@param[out] words: (x+31)/32 words per row
+void packCells(const unsigned char* states, unsigned int* words, int x, int y) {
+    int words_x = (x+31)/32;
+    for (int i=0; i<y; ++i)
+        for (int k=0; k<words_x; ++k) {
+            unsigned int w = 0;
+            for (int b=0; b<32 && 32*k+b<x; ++b)
+                if (states[(size_t)x*i+32*k+b]) w |= 1u<<b;
+            words[(size_t)words_x*i+k] = w;
+        }
+}
+
+///\brief Unpacks the cells packed by packCells, one byte per cell
+void unpackCells(const unsigned int* words, unsigned char* states, int x, int y) {
+    int words_x = (x+31)/32;
+    for (int i=0; i<y; ++i)
+        for (int j=0; j<x; ++j)
+            states[(size_t)x*i+j] = (words[(size_t)words_x*i+j/32]>>(j%32)) & 1;
+}
+
+void initEnsemble(int argc, char** argv, void* boards, int count, int x, int y, char* shader, int iterations, StateFormat format) {
+    //cerr<<"Inside initEnsemble"<<endl;
+    runEnsemble(argc, argv, (unsigned char*)boards, count, x, y, shader, iterations, format, 1, -1);
+}
+
+void initEnsemble(int argc, char** argv, unsigned char* boards, int count, int x, int y, BuiltinRule rule, int iterations) {
+    //cerr<<"Inside builtin initEnsemble"<<endl;
+    if (engine.backend == CPU || engine.backend == HASHLIFE || (!initEGL() && !getenv("DISPLAY"))) {
+        //cerr<<"the CPU backends have no setup to share, the boards run one after the other"<<endl;
+        for (int i=0; i<count; ++i) init(argc, argv, boards+(size_t)x*y*i, x, y, rule, false, iterations);
+        return;
+    }
+    string shader = ruleSource(rule, x);
+    if (!packedRule(ruleTable(rule))) {
+        runEnsemble(argc, argv, boards, count, x, y, (char*)shader.c_str(), iterations, R8UI, 1, rule);
+        return;
+    }
+    int words_x = (x+31)/32;
+    vector<unsigned int> words((size_t)words_x*y*count);
+    for (int i=0; i<count; ++i) packCells(boards+(size_t)x*y*i, &words[(size_t)words_x*y*i], x, y);
+    runEnsemble(argc, argv, (unsigned char*)&words[0], count, words_x, y, (char*)shader.c_str(), iterations, R32UI, 32, rule);
+    for (int i=0; i<count; ++i) unpackCells(&words[(size_t)words_x*y*i], boards+(size_t)x*y*i, x, y);
+}
+
+///\brief Packs the boards of an ensemble in as few matrices as possible and runs each as init does
+///@param[in] x: texels in each row of a board\n
+///@param[in] packed: cells in each texel\n
+///@param[in] rule: the BuiltinRule of the shader, -1 for the other shaders
+void runEnsemble(int argc, char** argv, unsigned char* boards, int count, int x, int y, char* shader, int iterations, StateFormat format, int packed, int rule) {
+    //cerr<<"Inside runEnsemble"<<endl;
+    int limit = engine.block_size > 0 ? engine.block_size : ensembleSize;
+    if (x > limit || y > limit) {
+        cout<<"The boards do not fit in a texture"<<endl;
+        exit(1);
+    }
+    size_t texelBytes = format == RGBA32F && engine.byte_image ? 4 : stateFormats[format].texelBytes;
+    size_t rowBytes = x*texelBytes, boardBytes = rowBytes*y;
+    int perRow = (limit+1)/(x+1), perColumn = (limit+1)/(y+1);
+    int batch = min(count, perRow*perColumn);
+    for (int first=0; first<count; first+=batch) {
+        Simulation::Instance s{};
+        s.builtinRule = rule;
+        s.ensembleBoards = min(batch, count-first);
+        //cerr<<"about as many columns as rows of boards"<<endl;
+        int columns = 1;
+        while (columns < perRow && (long)columns*columns*(x+1) < (long)s.ensembleBoards*(y+1)) ++columns;
+        while ((s.ensembleBoards+columns-1)/columns > perColumn) ++columns;
+        s.ensembleColumns = columns;
+        int rows = (s.ensembleBoards+columns-1)/columns;
+        int w = columns*(x+1)-1, h = rows*(y+1)-1;
+        cout<<"Ensemble of "<<s.ensembleBoards<<" boards in "<<columns<<"x"<<rows<<" columns and rows"<<endl;
+        s.board_x = x;
+        s.board_y = y;
+        vector<unsigned char> matrix((size_t)w*h*texelBytes, 0);
+        for (int b=0; b<s.ensembleBoards; ++b) {
+            size_t origin = ((size_t)(b/columns)*(y+1)*w+(size_t)(b%columns)*(x+1))*texelBytes;
+            for (int i=0; i<y; ++i)
+                memcpy(&matrix[origin+i*w*texelBytes], boards+(first+b)*boardBytes+i*rowBytes, rowBytes);
+        }
+        s.cellsPerTexel = packed;
+        s.cells_x = w*packed;
+        setComputation(s, &matrix[0], w, h, shader, iterations, format);
+        runComputation(s, argc, argv, false);
+        for (int b=0; b<s.ensembleBoards; ++b) {
+            size_t origin = ((size_t)(b/columns)*(y+1)*w+(size_t)(b%columns)*(x+1))*texelBytes;
+            for (int i=0; i<y; ++i)
+                memcpy(boards+(first+b)*boardBytes+i*rowBytes, &matrix[origin+i*w*texelBytes], rowBytes);
+        }
+    }
+}
+
+///\brief Creates the vertex buffer with the quads of the boards of an ensemble
+///
+///The texture coordinates are the vertices themselves, as for the single quad.
+void initEnsembleQuads(Simulation::Instance& s) {
+    //cerr<<"Inside initEnsembleQuads"<<endl;
+    vector<GLfloat> vertices;
+    vertices.reserve(8*s.ensembleBoards);
+    for (int b=0; b<s.ensembleBoards; ++b) {
+        GLfloat x0 = (b%s.ensembleColumns)*(s.board_x+1), y0 = (b/s.ensembleColumns)*(s.board_y+1);
+        GLfloat quad[8] = { x0, y0, x0+s.board_x, y0, x0+s.board_x, y0+s.board_y, x0, y0+s.board_y };
+        vertices.insert(vertices.end(), quad, quad+8);
+    }
+    glGenBuffers(1, &s.ensembleQuads);
+    glBindBuffer(GL_ARRAY_BUFFER, s.ensembleQuads);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    checkGLErrors("initEnsembleQuads()");
+}
+
+///\brief Makes the context of the simulations current again, the GUI of init replaces it
+void currentSimulations(void) {
+    if (eglContext != EGL_NO_CONTEXT) eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext);
+    else glutSetWindow(simulationWindow);
+}
+
+///\brief Gives a simulation back its framebuffer, viewport and program
+///
+///The simulations and init share the context, so each call of a simulation sets them again.
+void useSimulation(Simulation::Instance& s) {
+    currentSimulations();
+    bindFBO(s);
+    useProgram(s);
+}
+
+///\brief Creates the context if needed, then the textures and the program of a simulation
+///
+///Its cellsPerTexel, cells_x and builtinRule are set by the caller.
+///@param[in] image: the initial state, as for init
+void openSimulation(Simulation::Instance& s, const void* image, int x, int y, char* shader, StateFormat format) {
+    //cerr<<"Inside openSimulation"<<endl;
+    if (simulations++ == 0 && eglContext == EGL_NO_CONTEXT && !initEGL()) {
+        //cerr<<"no headless context, falling back to an hidden window"<<endl;
+        int argc = 1;
+        char* argv[] = { (char*)"GLCAlib", NULL };
+        glutInit(&argc, argv);
+        simulationWindow = glutCreateWindow(argv[0]);
+        glutHideWindow();
+    }
+    currentSimulations();
+    initGLEW();
+    setComputation(s, (void*)image, x, y, shader, 0, format);
+    createComputation(s, engine.backend == COMPUTE ? COMPUTE : FRAGMENT, false);
+    s.data = NULL;
+}
+
+Simulation::Simulation(const void* image, int x, int y, char* shader, StateFormat format) : instance(new Instance()) {
+    //cerr<<"Inside Simulation"<<endl;
+    instance->source = shader;
+    instance->x = x;
+    instance->y = y;
+    openSimulation(*instance, image, x, y, (char*)instance->source.c_str(), format);
+}
+
+Simulation::Simulation(const unsigned char* states, int x, int y, BuiltinRule rule) : instance(new Instance()) {
+    //cerr<<"Inside builtin Simulation"<<endl;
+    instance->x = x;
+    instance->y = y;
+    instance->builtinRule = rule;
+    instance->source = ruleSource(rule, x);
+    if (!packedRule(ruleTable(rule))) {
+        openSimulation(*instance, states, x, y, (char*)instance->source.c_str(), R8UI);
+        return;
+    }
+    int words_x = (x+31)/32;
+    instance->words.resize((size_t)words_x*y);
+    packCells(states, &instance->words[0], x, y);
+    instance->cellsPerTexel = 32;
+    instance->cells_x = x;
+    openSimulation(*instance, &instance->words[0], words_x, y, (char*)instance->source.c_str(), R32UI);
+}
+
+Simulation::~Simulation() {
+    //cerr<<"Inside ~Simulation"<<endl;
+    currentSimulations();
+    finishActivity(*instance);
+    freeComputation(*instance);
+    delete instance;
+    if (--simulations > 0) return;
+    //cerr<<"the last simulation releases the context"<<endl;
+    freePrograms();
+    if (simulationWindow) glutDestroyWindow(simulationWindow);
+    simulationWindow = 0;
+    closeEGL();
+}
+
+long Simulation::step(long generations) {
+    Instance& s = *instance;
+    useSimulation(s);
+    long last = s.countIterations+generations;
+    while (s.countIterations < last) advance(s, last-s.countIterations);
+    return s.countIterations;
+}
+
+void Simulation::read(void* image) {
+    Instance& s = *instance;
+    useSimulation(s);
+    if (s.cellsPerTexel == 32) {
+        transferFromTexture(s, &s.words[0]);
+        unpackCells(&s.words[0], (unsigned char*)image, s.cells_x, s.texSize_y);
+    } else
+        transferFromTexture(s, image);
+}
+
+void Simulation::write(const void* image) {
+    Instance& s = *instance;
+    useSimulation(s);
+    if (s.cellsPerTexel == 32) {
+        packCells((const unsigned char*)image, &s.words[0], s.cells_x, s.texSize_y);
+        transferToTexture(s, &s.words[0], s.readTex, 1);
+    } else
+        transferToTexture(s, (void*)image, s.readTex, 1);
+    //cerr<<"any tile may have changed"<<endl;
+    s.lastSteps = 0;
+}
+
+void Simulation::set_rule(char* shader) {
+    //cerr<<"Inside set_rule"<<endl;
+    Instance& s = *instance;
+    useSimulation(s);
+    s.source = shader;
+    s.textureParameters.shader_source = (char*)s.source.c_str();
+    s.builtinRule = -1;
+    initGLSL(s);
+    useProgram(s);
+    s.lastSteps = 0;
+}
+
+long Simulation::generation() const {
+    return instance->countIterations;
+}
+
+int Simulation::width() const {
+    return instance->x;
+}
+
+int Simulation::height() const {
+    return instance->y;
+}
+
+long resume(int argc, char** argv, const char* checkpoint, void* image, int x, int y, char* shader, bool gui, int iterations, StateFormat format) {
+    //cerr<<"Inside resume"<<endl;
+    struct_checkpointHeader header;
+    if (!loadCheckpointHeader(checkpoint, &header)) {
+        cout<<checkpoint<<" is not a checkpoint"<<endl;
+        exit(1);
+    }
+    Simulation::Instance s{};
+    s.resumeFile = checkpoint;
+    setComputation(s, image, x, y, shader, iterations, format);
+    runComputation(s, argc, argv, gui);
+    return header.generation;
+}
+
+long resume(int argc, char** argv, const char* checkpoint, unsigned char* states, int x, int y, BuiltinRule rule, bool gui, int iterations) {
+    //cerr<<"Inside builtin resume"<<endl;
+    struct_checkpointHeader header;
+    if (!loadCheckpointHeader(checkpoint, &header)) {
+        cout<<checkpoint<<" is not a checkpoint"<<endl;
+        exit(1);
+    }
+    if (header.rule != rule || header.x != x || header.y != y) {
+        cout<<checkpoint<<" was written by another rule or size"<<endl;
+        exit(1);
+    }
+    runBuiltin(argc, argv, checkpoint, states, x, y, rule, gui, iterations);
+    return header.generation;
+}
+
+///\brief Loads the state of a checkpoint for the CPU backends
+///
+///Checkpoints hold texels, the R32UI ones of two state rules are unpacked to a byte per cell.
+///resume() has already checked that the checkpoint was written by the same rule and size.
+///@return the generations left to compute, -1 if the checkpoint is past the last generation
+long resumeStates(const char* checkpoint, unsigned char* states, int x, int y, long iterations) {
+    //cerr<<"Inside resumeStates"<<endl;
+    struct_checkpointHeader header;
+    loadCheckpointHeader(checkpoint, &header);
+    vector<unsigned char> texels(header.texelBytes);
+    loadCheckpoint(checkpoint, header, &texels[0]);
+    if (header.format == R32UI) {
+        //cerr<<"two state texels of the GPU, 32 cells each"<<endl;
+        const unsigned int* words = (const unsigned int*)&texels[0];
+        for (int i=0; i<y; ++i)
+            for (int j=0; j<x; ++j)
+                states[(size_t)x*i+j] = (words[header.texels_x*i+j/32]>>(j%32)) & 1;
+    } else
+        memcpy(states, &texels[0], (size_t)x*y);
+    cout<<"Resumed from generation "<<header.generation<<endl;
+    return iterations > header.generation ? iterations - header.generation : -1;
+}
+
+///\brief Creates an OpenGL context that is not bound to any window
+///
+///Tries in order the Mesa surfaceless platform (works with llvmpipe), the first
+///EGL device (vendor drivers) and the default display. All the computation happens
+///in the FBO, so no surface is created when EGL_KHR_surfaceless_context is available,
+///otherwise a 1x1 pbuffer is used.
+///@return FALSE if no EGL display is available
+bool initEGL(void) {
+    //cerr<<"Inside initEGL"<<endl;
+    if (eglContext != EGL_NO_CONTEXT) return true;
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay && clientExtensions) {
+        if (strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+            eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (eglDisplay == EGL_NO_DISPLAY && strstr(clientExtensions, "EGL_EXT_platform_device")) {
+            PFNEGLQUERYDEVICESEXTPROC queryDevices =
+                (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+            EGLDeviceEXT device;
+            EGLint numDevices = 0;
+            if (queryDevices && queryDevices(1, &device, &numDevices) && numDevices > 0)
+                eglDisplay = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+        }
+    }
+    if (eglDisplay == EGL_NO_DISPLAY) eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, NULL, NULL)) {
+        eglDisplay = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    //cerr<<"choose a config for desktop OpenGL"<<endl;
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs < 1
+            || !eglBindAPI(EGL_OPENGL_API)) {
+        closeEGL();
+        return false;
+    }
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, NULL);
+    if (eglContext == EGL_NO_CONTEXT) {
+        closeEGL();
+        return false;
+    }
+
+    //cerr<<"make the context current, with a dummy surface if needed"<<endl;
+    if (!strstr(eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttribs);
+    }
+    if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)) {
+        closeEGL();
+        return false;
+    }
+    return true;
+}
+
+///Releases the headless context, if any
+void closeEGL(void) {
+    //cerr<<"Inside closeEGL"<<endl;
+    if (eglDisplay == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (eglSurface != EGL_NO_SURFACE) eglDestroySurface(eglDisplay, eglSurface);
+    if (eglContext != EGL_NO_CONTEXT) eglDestroyContext(eglDisplay, eglContext);
+    eglTerminate(eglDisplay);
+    eglSurface = EGL_NO_SURFACE;
+    eglContext = EGL_NO_CONTEXT;
+    eglDisplay = EGL_NO_DISPLAY;
+}
+
+///Sets up a state texture of the size of the matrix.
+void setupTexture (Simulation::Instance& s, const GLuint texID) {
+    setupTexture(s, texID, s.texSize_x, s.texSize_y);
+}
+
+///Sets up a state texture with NEAREST filtering.
+///(mipmaps etc. are unsupported for floating point and integer textures)
+void setupTexture (Simulation::Instance& s, const GLuint texID, int width, int height) {
     //cerr<<"Inside setupTexture"<<endl;
     //cerr<<"make active and bind"<<endl;
-    glBindTexture(textureParameters.texTarget,texID);
+    glBindTexture(s.textureParameters.texTarget,texID);
     //cerr<<"turn off filtering and wrap modes"<<endl;
-    glTexParameteri(textureParameters.texTarget, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(textureParameters.texTarget, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(textureParameters.texTarget, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(textureParameters.texTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    //cerr<<"define texture with floating point format"<<endl;
-    glTexImage2D(textureParameters.texTarget,0,textureParameters.texInternalFormat,texSize_x,texSize_y,0,textureParameters.texFormat,GL_FLOAT,0);
+    glTexParameteri(s.textureParameters.texTarget, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(s.textureParameters.texTarget, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(s.textureParameters.texTarget, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(s.textureParameters.texTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    //cerr<<"define texture with the state format"<<endl;
+    glTexImage2D(s.textureParameters.texTarget,0,s.textureParameters.texInternalFormat,width,height,0,s.textureParameters.texFormat,s.textureParameters.texType,0);
     //cerr<<"check if that worked"<<endl;
     if (glGetError() != GL_NO_ERROR) {
         cout<<"glTexImage2D():\t\t\t [FAIL]"<<endl;
@@ -191,46 +1290,344 @@ void setupTexture (const GLuint texID) {
     } else {
         //cerr<<"glTexImage2D():\t\t\t [PASS]"<<endl;
     }
-    //cerr<<"Created a "<<texSize_x<<"by "<<texSize_y<<" floating point texture."<<endl;
+    //cerr<<"Created a "<<texSize_x<<"by "<<texSize_y<<" "<<textureParameters.name<<" texture."<<endl;
 }
 
 
 ///creates textures, sets proper viewport etc.
-void createTextures (void) {
+void createTextures (Simulation::Instance& s) {
     //cerr<<"Inside createTexture"<<endl;
     //cerr<<"two textures, alternatingly read-only and write-only,"<<endl;
-    glGenTextures (2, TexID_A);
+    glGenTextures (2, s.TexID_A);
+    //cerr<<"byte formats have rows of any length"<<endl;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
     //cerr<<"setup textures"<<endl;
-    setupTexture (TexID_A[readTex]);
-    transferToTexture(data,TexID_A[readTex]);
-    setupTexture (TexID_A[writeTex]);
-    transferToTexture(data,TexID_A[writeTex]);
+    if (s.blocks.empty()) {
+        setupTexture (s, s.TexID_A[s.readTex]);
+        setupTexture (s, s.TexID_A[s.writeTex]);
+    } else
+        createBlocks(s);
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    if (s.resumeFile) resumeTextures(s);
+    else transferToTexture(s, s.data, 0, 2);
+    //cerr<<"two copies of the matrix are not kept for the few later uploads"<<endl;
+    freeStaging(s);
+    glFinish();
+    lastTiming.upload += secondsSince(begin);
     //cerr<<"set texenv mode from modulate (the default) to replace)"<<endl;
     glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
     //cerr<<"check if something went completely wrong"<<endl;
     checkGLErrors ("createFBOandTextures()");
 }
 
-///Transfers data to texture.
-///Check web page for detailed explanation on the difference between ATI and NVIDIA.
-void transferToTexture (float* data, GLuint texID) {
+///\brief Splits the matrix in blocks if it does not fit in a texture
+///
+///The blocks are as large as possible, halo included, and of about the same size.
+void initBlocks(Simulation::Instance& s) {
+    //cerr<<"Inside initBlocks"<<endl;
+    s.blocks.clear();
+    GLint maxSize, viewport[2];
+    glGetIntegerv(GL_MAX_RECTANGLE_TEXTURE_SIZE_ARB, &maxSize);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewport);
+    maxSize = min(maxSize, min(viewport[0], viewport[1]));
+    if (engine.block_size > 0 && engine.block_size < maxSize) maxSize = engine.block_size;
+    if (s.texSize_x <= maxSize && s.texSize_y <= maxSize) return;
+    if (maxSize < 3 || !GLEW_ARB_copy_image) {
+        cout<<"The matrix does not fit in a texture and can not be split in blocks"<<endl;
+        exit(1);
+    }
+    s.blocks_x = (s.texSize_x+maxSize-3)/(maxSize-2);
+    s.blocks_y = (s.texSize_y+maxSize-3)/(maxSize-2);
+    int w = (s.texSize_x+s.blocks_x-1)/s.blocks_x, h = (s.texSize_y+s.blocks_y-1)/s.blocks_y;
+    s.blocks.resize(s.blocks_x*s.blocks_y);
+    for (int i=0; i<s.blocks_y; ++i)
+        for (int j=0; j<s.blocks_x; ++j) {
+            struct_block& b = s.blocks[s.blocks_x*i+j];
+            b.x = j*w;
+            b.y = i*h;
+            b.w = min(w, s.texSize_x-b.x);
+            b.h = min(h, s.texSize_y-b.y);
+        }
+    cout<<"Split in "<<s.blocks_x<<"x"<<s.blocks_y<<" blocks of "<<w<<"x"<<h<<endl;
+}
+
+///\brief Creates the textures and the framebuffers of the blocks
+///
+///The halos outside the matrix are cleared once and never written again, as the border
+///of a single texture.
+void createBlocks(Simulation::Instance& s) {
+    //cerr<<"Inside createBlocks"<<endl;
+    vector<unsigned char> zero((size_t)(max(s.blocks[0].w, s.blocks[0].h)+2)*stateFormats[s.stateFormat].texelBytes, 0);
+    for (size_t i=0; i<s.blocks.size(); ++i) {
+        struct_block& b = s.blocks[i];
+        glGenTextures(2, b.tex);
+        glGenFramebuffersEXT(1, &b.fb);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, b.fb);
+        for (int t=0; t<2; ++t) {
+            setupTexture(s, b.tex[t], b.w+2, b.h+2);
+            GLenum format = s.textureParameters.texFormat, type = stateFormats[s.stateFormat].texType;
+            if (b.y == 0) glTexSubImage2D(s.textureParameters.texTarget,0,0,0,b.w+2,1,format,type,&zero[0]);
+            if (b.y+b.h == s.texSize_y) glTexSubImage2D(s.textureParameters.texTarget,0,0,b.h+1,b.w+2,1,format,type,&zero[0]);
+            if (b.x == 0) glTexSubImage2D(s.textureParameters.texTarget,0,0,0,1,b.h+2,format,type,&zero[0]);
+            if (b.x+b.w == s.texSize_x) glTexSubImage2D(s.textureParameters.texTarget,0,b.w+1,0,1,b.h+2,format,type,&zero[0]);
+            glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, attachmentpoints[t], s.textureParameters.texTarget, b.tex[t], 0);
+        }
+        if (!checkFramebufferStatus()) {
+            cout<<"glFramebufferTexture2DEXT():\t [FAIL]"<<endl;
+            exit (1);
+        }
+    }
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, s.fb);
+}
+
+///Frees the textures and the framebuffers of the blocks
+void freeBlocks(Simulation::Instance& s) {
+    for (size_t i=0; i<s.blocks.size(); ++i) {
+        glDeleteTextures(2, s.blocks[i].tex);
+        glDeleteFramebuffersEXT(1, &s.blocks[i].fb);
+    }
+    s.blocks.clear();
+}
+
+///\brief Copies the edges of the blocks just written into the halos of their neighbours
+///
+///The columns are copied first, then the rows with their halo columns, which carries the
+///corners to the diagonal neighbours.
+void exchangeHalos(Simulation::Instance& s) {
+    //cerr<<"Inside exchangeHalos"<<endl;
+    GLenum target = s.textureParameters.texTarget;
+    for (int i=0; i<s.blocks_y; ++i)
+        for (int j=0; j+1<s.blocks_x; ++j) {
+            struct_block& l = s.blocks[s.blocks_x*i+j];
+            struct_block& r = s.blocks[s.blocks_x*i+j+1];
+            glCopyImageSubData(l.tex[s.writeTex], target, 0, l.w, 1, 0, r.tex[s.writeTex], target, 0, 0, 1, 0, 1, l.h, 1);
+            glCopyImageSubData(r.tex[s.writeTex], target, 0, 1, 1, 0, l.tex[s.writeTex], target, 0, l.w+1, 1, 0, 1, r.h, 1);
+        }
+    for (int i=0; i+1<s.blocks_y; ++i)
+        for (int j=0; j<s.blocks_x; ++j) {
+            struct_block& d = s.blocks[s.blocks_x*i+j];
+            struct_block& u = s.blocks[s.blocks_x*(i+1)+j];
+            glCopyImageSubData(d.tex[s.writeTex], target, 0, 0, d.h, 0, u.tex[s.writeTex], target, 0, 0, 0, 0, d.w+2, 1, 1);
+            glCopyImageSubData(u.tex[s.writeTex], target, 0, 0, 1, 0, d.tex[s.writeTex], target, 0, 0, d.h+1, 0, u.w+2, 1, 1);
+        }
+}
+
+///@return the bytes of a texel read or written with type, which is either the type of the texture or the one of the buffer passed to init
+int typeBytes(Simulation::Instance& s, GLenum type) {
+    return type == s.textureParameters.texType ? s.textureParameters.texelBytes : stateFormats[s.stateFormat].texelBytes;
+}
+
+///\brief Creates the staging buffers of the uploads
+///
+///With OpenGL 4.4 or ARB_buffer_storage they stay mapped for the whole computation.
+///They hold the texels in the type of the texture, as checkpoints do.
+void initStaging(Simulation::Instance& s) {
+    //cerr<<"Inside initStaging"<<endl;
+    GLsizeiptr bytes = (GLsizeiptr)s.texSize_x*s.texSize_y*stateFormats[s.stateFormat].texelBytes;
+    s.stagingPersistent = GLEW_ARB_buffer_storage;
+    glGenBuffers(2, s.stagingBuffers);
+    for (int i=0; i<2; ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.stagingBuffers[i]);
+        if (s.stagingPersistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, flags);
+            s.stagingMapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags);
+        } else
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        s.stagingFences[i] = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    s.staging = 0;
+    checkGLErrors("initStaging()");
+}
+
+///\brief Gives the memory of the next staging buffer, once its last upload is complete
+///
+///Creates the staging buffers if they were freed.
+///@return where to write the texels of the next upload
+void* mapStaging(Simulation::Instance& s) {
+    if (!s.stagingBuffers[0]) initStaging(s);
+    if (s.stagingFences[s.staging]) {
+        glClientWaitSync(s.stagingFences[s.staging], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(s.stagingFences[s.staging]);
+        s.stagingFences[s.staging] = 0;
+    }
+    if (s.stagingPersistent) return s.stagingMapped[s.staging];
+    GLsizeiptr bytes = (GLsizeiptr)s.texSize_x*s.texSize_y*stateFormats[s.stateFormat].texelBytes;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.stagingBuffers[s.staging]);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return mapped;
+}
+
+///\brief Uploads the staging buffer given by mapStaging to some of the ping-pong textures
+///
+///Blocks receive their cells and the halo shared with their neighbours.
+///@param[in] first: the first texture to update, readTex or writeTex\n
+///@param[in] textures: number of textures, 2 updates both, 0 just releases the buffer\n
+///@param[in] type: type of the texels in the buffer
+void uploadStaging(Simulation::Instance& s, int first, int textures, GLenum type) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.stagingBuffers[s.staging]);
+    if (!s.stagingPersistent) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    for (int i=0; i<textures && s.blocks.empty(); ++i) {
+        glBindTexture(s.textureParameters.texTarget, s.TexID_A[(first+i)%2]);
+        glTexSubImage2D(s.textureParameters.texTarget,0,0,0,s.texSize_x,s.texSize_y,s.textureParameters.texFormat,type,0);
+    }
+    if (textures > 0 && !s.blocks.empty()) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, s.texSize_x);
+        for (size_t k=0; k<s.blocks.size(); ++k) {
+            const struct_block& b = s.blocks[k];
+            int x0 = max(b.x-1, 0), y0 = max(b.y-1, 0);
+            int x1 = min(b.x+b.w+1, s.texSize_x), y1 = min(b.y+b.h+1, s.texSize_y);
+            size_t offset = ((size_t)y0*s.texSize_x+x0)*typeBytes(s, type);
+            for (int i=0; i<textures; ++i) {
+                glBindTexture(s.textureParameters.texTarget, b.tex[(first+i)%2]);
+                glTexSubImage2D(s.textureParameters.texTarget,0,x0-b.x+1,y0-b.y+1,x1-x0,y1-y0,s.textureParameters.texFormat,type,(void*)offset);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (textures > 0) {
+        totals.uploaded_bytes += (long long)s.texSize_x*s.texSize_y*typeBytes(s, type)*textures;
+        s.stagingFences[s.staging] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        s.staging ^= 1;
+    }
+}
+
+///Waits for the uploads in flight and frees the staging buffers, if any
+void freeStaging(Simulation::Instance& s) {
+    //cerr<<"Inside freeStaging"<<endl;
+    if (!s.stagingBuffers[0]) return;
+    for (int i=0; i<2; ++i) {
+        if (s.stagingFences[i]) {
+            glClientWaitSync(s.stagingFences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(s.stagingFences[i]);
+            s.stagingFences[i] = 0;
+        }
+        if (s.stagingPersistent) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.stagingBuffers[i]);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(2, s.stagingBuffers);
+    s.stagingBuffers[0] = s.stagingBuffers[1] = 0;
+}
+
+///\brief Transfers data to textures.
+///
+///The data is copied into a staging buffer and uploaded with glTexSubImage2D, which
+///writes every format (unlike the old glDrawPixels path, that could not write integer
+///textures and was emulated on the CPU by many drivers) and lets the driver copy from
+///the buffer asynchronously.
+///@param[in] data: texels laid out as the buffer passed to init\n
+///@param[in] first: the first texture to update, readTex or writeTex\n
+///@param[in] textures: number of textures
+void transferToTexture (Simulation::Instance& s, void* data, int first, int textures) {
     //cerr<<"Inside transferToTexture"<<endl;
-    // version (a): HW-accelerated on NVIDIA
-//	glBindTexture(textureParameters.texTarget, texID);
-//	glTexSubImage2D(textureParameters.texTarget,0,0,0,texSize_x,texSize_y,textureParameters.texFormat,GL_FLOAT,data);
-    // version (b): HW-accelerated on ATI
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, textureParameters.texTarget, texID, 0);
-    glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
-    glRasterPos2i(0,0);
-    glDrawPixels(texSize_x,texSize_y,textureParameters.texFormat,GL_FLOAT,data);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, textureParameters.texTarget, 0, 0);
+    TraceScope scope("transferToTexture", true);
+    memcpy(mapStaging(s), data, (size_t)s.texSize_x*s.texSize_y*s.textureParameters.texelBytes);
+    uploadStaging(s, first, textures, s.textureParameters.texType);
+}
+
+///\brief Uploads the state of the checkpoint resumeFile to both textures and restores its generation
+void resumeTextures(Simulation::Instance& s) {
+    //cerr<<"Inside resumeTextures"<<endl;
+    TraceScope scope("resumeTextures", true);
+    struct_checkpointHeader header;
+    if (!loadCheckpointHeader(s.resumeFile, &header)) {
+        cout<<s.resumeFile<<" is not a checkpoint"<<endl;
+        exit(1);
+    }
+    //cerr<<"built-in rules are identified by the rule, shaders by their source"<<endl;
+    //the MPI mode writes two state rules a byte per cell
+    bool bytes = s.cellsPerTexel == 32 && header.format == R8UI;
+    if ((header.format != s.stateFormat && !bytes) || header.x != s.cells_x || header.y != s.texSize_y ||
+        (header.texels_x != s.texSize_x && !bytes) ||
+        header.rule != s.builtinRule || (s.builtinRule < 0 && header.shaderHash != hashSource(s.textureParameters.shader_source))) {
+        cout<<s.resumeFile<<" was written by another rule, format or size"<<endl;
+        exit(1);
+    }
+    if (bytes) {
+        vector<unsigned char> cells(header.texelBytes);
+        loadCheckpoint(s.resumeFile, header, &cells[0]);
+        unsigned int* words = (unsigned int*)mapStaging(s);
+        for (int i=0; i<s.texSize_y; ++i)
+            for (int k=0; k<s.texSize_x; ++k) {
+                unsigned int w = 0;
+                for (int b=0; b<32 && 32*k+b<s.cells_x; ++b)
+                    if (cells[(size_t)s.cells_x*i+32*k+b]) w |= 1u<<b;
+                words[(size_t)s.texSize_x*i+k] = w;
+            }
+    } else
+        loadCheckpoint(s.resumeFile, header, (unsigned char*)mapStaging(s));
+    uploadStaging(s, 0, 2, stateFormats[s.stateFormat].texType);
+    s.countIterations = header.generation;
+    cout<<"Resumed from generation "<<s.countIterations<<endl;
+}
+
+///\brief Calls engine.input and uploads the new state, if any, to the texture read by the next pass
+///
+///Bit-packed built-in states are written by engine.input one byte per cell and packed here.
+void feedInput(Simulation::Instance& s) {
+    //cerr<<"Inside feedInput"<<endl;
+    TraceScope scope("feedInput", true);
+    void* target = mapStaging(s);
+    void* cells = target;
+    if (s.cellsPerTexel == 32) {
+        s.inputCells.resize((size_t)s.cells_x*s.texSize_y);
+        cells = &s.inputCells[0];
+    }
+    s.nextInput += engine.input_generations;
+    if (!engine.input(cells, s.countIterations, engine.input_user)) {
+        uploadStaging(s, s.readTex, 0, s.textureParameters.texType);
+        return;
+    }
+    if (s.cellsPerTexel == 32) {
+        unsigned int* words = (unsigned int*)target;
+        for (int i=0; i<s.texSize_y; ++i)
+            for (int k=0; k<s.texSize_x; ++k) {
+                unsigned int w = 0;
+                for (int b=0; b<32 && 32*k+b<s.cells_x; ++b)
+                    if (s.inputCells[(size_t)s.cells_x*i+32*k+b]) w |= 1u<<b;
+                words[(size_t)s.texSize_x*i+k] = w;
+            }
+    }
+    uploadStaging(s, s.readTex, 1, s.textureParameters.texType);
+    if (s.backend == HYBRID) loadHybridRows(s, s.hybridSplit-1, s.texSize_y);
+    //cerr<<"any tile may have changed"<<endl;
+    s.lastSteps = 0;
 }
 
 ///Transfers data from current texture, and stores it in given array.
-void transferFromTexture(float* data) {
+void transferFromTexture(Simulation::Instance& s, void* data) {
     //cerr<<"Inside transferFromTexture"<<endl;
-    glReadBuffer(attachmentpoints[readTex]);
-    glReadPixels(0, 0, texSize_x, texSize_y, textureParameters.texFormat, GL_FLOAT, data);
+    TraceScope scope("transferFromTexture", true);
+    readState(s, s.textureParameters.texType, data);
+}
+
+///\brief Reads the current state, of all the blocks if split
+///@param[in] type: type of the texels to read\n
+///@param[out] pixels: where to write them, an offset in the bound pixel pack buffer if any
+void readState(Simulation::Instance& s, GLenum type, void* pixels) {
+    totals.readback_bytes += (long long)s.texSize_x*s.texSize_y*typeBytes(s, type);
+    if (s.blocks.empty()) {
+        glReadBuffer(attachmentpoints[s.readTex]);
+        glReadPixels(0, 0, s.texSize_x, s.texSize_y, s.textureParameters.texFormat, type, pixels);
+        return;
+    }
+    glPixelStorei(GL_PACK_ROW_LENGTH, s.texSize_x);
+    for (size_t k=0; k<s.blocks.size(); ++k) {
+        const struct_block& b = s.blocks[k];
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, b.fb);
+        glReadBuffer(attachmentpoints[s.readTex]);
+        size_t offset = ((size_t)b.y*s.texSize_x+b.x)*typeBytes(s, type);
+        glReadPixels(1, 1, b.w, b.h, s.textureParameters.texFormat, type, (char*)pixels+offset);
+    }
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, s.fb);
 }
 
 ///Sets up GLEW to initialise OpenGL extensions
@@ -238,6 +1635,10 @@ void initGLEW (void) {
     //cerr<<"Inside initGLEW"<<endl;
     int err = glewInit();
     //cerr<<"sanity check"<<endl;
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    //GLEW built for GLX complains about the missing X display of an EGL context
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY && eglContext != EGL_NO_CONTEXT) err = GLEW_OK;
+#endif
     if (GLEW_OK != err) {
         cout<<(char*)glewGetErrorString(err)<<endl;
         exit(1);
@@ -246,87 +1647,941 @@ void initGLEW (void) {
 
 ///Creates framebuffer object, binds it to reroute rendering operations
 ///from the traditional framebuffer to the offscreen buffer
-void initFBO() {
+void initFBO(Simulation::Instance& s) {
     //cerr<<"Inside initFBO"<<endl;
     //cerr<<"create FBO (off-screen framebuffer)"<<endl;
-    glGenFramebuffersEXT(1, &fb);
+    glGenFramebuffersEXT(1, &s.fb);
+    bindFBO(s);
+}
+
+///Binds the FBO and sets the viewport of the matrix
+void bindFBO(Simulation::Instance& s) {
     //cerr<<"bind offscreen framebuffer (that is, skip the window-specific render target)"<<endl;
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fb);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, s.fb);
     //cerr<<"viewport for 1:1 pixel=texture mapping"<<endl;
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    gluOrtho2D(0.0, texSize_x, 0.0, texSize_y);
+    gluOrtho2D(0.0, s.texSize_x, 0.0, s.texSize_y);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    glViewport(0, 0, texSize_x, texSize_y);
+    glViewport(0, 0, s.texSize_x, s.texSize_y);
 }
 
 ///Sets up the GLSL runtime and creates shader.
-void initGLSL(void) {
+void initGLSL(Simulation::Instance& s) {
     //cerr<<"Inside initGLSL"<<endl;
-    //cerr<<"create program object"<<endl;
-    programObject = glCreateProgramObjectARB();
-    //programObjectDisp = glCreateProgramObjectARB();
-    //cerr<<"create shader object (fragment shader) and attach to program"<<endl;
-    shaderObject = glCreateShaderObjectARB(GL_FRAGMENT_SHADER_ARB);
-    glAttachObjectARB (programObject, shaderObject);
+    string computeSource;
+    const GLcharARB* source = s.textureParameters.shader_source;
+    if (s.backend == COMPUTE) {
+        computeSource = computeShaderSource(s, source);
+        source = computeSource.c_str();
+    }
+    //cerr<<"the headless context links each program once, the GUI has a context of its own"<<endl;
+    string key = string(s.backend == COMPUTE ? "compute\n" : "fragment\n")+source;
+    map<string, GLhandleARB>::iterator cached = programCache.find(key);
+    if (!s.withgui && cached != programCache.end())
+        s.programObject = cached->second;
+    else {
+        s.programObject = linkProgram(source, s.backend == COMPUTE ? GL_COMPUTE_SHADER : GL_FRAGMENT_SHADER_ARB);
+        if (!s.withgui) programCache[key] = s.programObject;
+    }
+
+    // Get location of the texture samplers for future use
+    s.Param_A = glGetUniformLocationARB(s.programObject, "texture_A");
+    s.Param_size = glGetUniformLocationARB(s.programObject, "glca_size");
+    s.Param_steps = glGetUniformLocationARB(s.programObject, "glca_steps");
+    s.Param_tilesX = glGetUniformLocationARB(s.programObject, "glca_tiles_x");
+    s.Param_offset = glGetUniformLocationARB(s.programObject, "glca_offset");
+    s.Param_stride = glGetUniformLocationARB(s.programObject, "glca_stride");
+}
+
+///\brief Directory of the on-disk program cache, see struct_engine::program_cache
+///@return an empty string if there is no cache, or the driver can not give program binaries
+string programCacheDirectory(void) {
+    //cerr<<"Inside programCacheDirectory"<<endl;
+    string directory;
+    const char* cache = getenv("XDG_CACHE_HOME");
+    if (engine.program_cache) directory = engine.program_cache;
+    else if (cache && *cache) directory = string(cache)+"/GLCAlib";
+    else if (getenv("HOME")) directory = string(getenv("HOME"))+"/.cache/GLCAlib";
+    if (directory.empty() || !GLEW_ARB_get_program_binary) return "";
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats == 0 || !makeDirectories(directory)) return "";
+    return directory;
+}
+
+///\brief Links a program made of a single shader, taking its binary from the on-disk cache if it is there
+///
+///The binaries are keyed by the source and by the vendor, renderer and version of the
+///driver: a binary the driver refuses, or a miss, builds the program from its source
+///and stores its binary for the next time.
+///@param[in] type: GL_FRAGMENT_SHADER_ARB or GL_COMPUTE_SHADER
+GLhandleARB linkProgram(const GLcharARB* source, GLenum type) {
+    //cerr<<"Inside linkProgram"<<endl;
+    TraceScope scope("linkProgram");
+    GLhandleARB program = glCreateProgramObjectARB();
+    string directory = programCacheDirectory(), key, filename;
+    if (!directory.empty()) {
+        key = string(type == GL_COMPUTE_SHADER ? "compute\n" : "fragment\n") + (const char*)glGetString(GL_VENDOR) + "\n" +
+              (const char*)glGetString(GL_RENDERER) + "\n" + (const char*)glGetString(GL_VERSION) + "\n" + source;
+        char name[32];
+        sprintf(name, "/%016llx.bin", (unsigned long long)hashSource(key.c_str()));
+        filename = directory+name;
+        uint32_t format;
+        vector<unsigned char> binary;
+        if (loadProgramBinary(filename.c_str(), key, &format, &binary)) {
+            GLint success = 0;
+            glProgramBinary(program, format, &binary[0], binary.size());
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            if (success) return program;
+            //cerr<<"a binary of another build of the driver, build it again"<<endl;
+            while (glGetError() != GL_NO_ERROR);
+            glDeleteObjectARB(program);
+            program = glCreateProgramObjectARB();
+        }
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    //cerr<<"create shader object (fragment or compute shader) and attach to program"<<endl;
+    GLhandleARB shader = glCreateShaderObjectARB(type);
+    glAttachObjectARB(program, shader);
     //cerr<<"set source to shader object"<<endl;
-    const GLcharARB* source = textureParameters.shader_source;
-    glShaderSourceARB(shaderObject, 1, &source, NULL);
+    glShaderSourceARB(shader, 1, &source, NULL);
     //cerr<<"compile and print compilation errors (no need to do additional error"<<endl;
     //cerr<<"checking, glLinkProgramARB() fails if compilation was wrong)"<<endl;
-    glCompileShaderARB(shaderObject);
-    printInfoLog(shaderObject);
+    glCompileShaderARB(shader);
+    printInfoLog(shader);
     //cerr<<"link program object together and check for errors"<<endl;
     GLint success;
-    glLinkProgramARB(programObject);
-    glGetObjectParameterivARB(programObject, GL_OBJECT_LINK_STATUS_ARB, &success);
+    glLinkProgramARB(program);
+    glGetObjectParameterivARB(program, GL_OBJECT_LINK_STATUS_ARB, &success);
     if (!success) {
         //cerr<<"Shader could not be linked!"<<endl;
+        printInfoLog(program);
         exit (1);
     }
+    //cerr<<"the shader is freed with the program"<<endl;
+    glDeleteObjectARB(shader);
 
-    // Get location of the texture samplers for future use
-    Param_A = glGetUniformLocationARB(programObject, "texture_A");
+    if (!filename.empty()) {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length > 0) {
+            vector<unsigned char> binary(length);
+            GLenum format;
+            glGetProgramBinary(program, length, &length, &format, &binary[0]);
+            binary.resize(length);
+            saveProgramBinary(filename.c_str(), key, format, binary);
+        }
+    }
+    return program;
 }
 
-///Performs the actual calculation.
-void run(void) {
-    //cerr<<"Inside run"<<endl;
+///\brief Deletes the programs of the cache, before their context is released
+void freePrograms(void) {
+    //cerr<<"Inside freePrograms"<<endl;
+    for (map<string, GLhandleARB>::iterator i = programCache.begin(); i != programCache.end(); ++i)
+        glDeleteObjectARB(i->second);
+    programCache.clear();
+}
+
+///\brief Creates the change flags, the tile list and the compaction program
+void initActiveTiles(Simulation::Instance& s) {
+    //cerr<<"Inside initActiveTiles"<<endl;
+    s.tiles_x = (s.texSize_x+s.computeTile-1)/s.computeTile;
+    s.tiles_y = (s.texSize_y+s.computeTile-1)/s.computeTile;
+    glGenBuffers(3, s.activeBuffers);
+    for (int i=0; i<2; ++i) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, s.activeBuffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, s.tiles_x*s.tiles_y*sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    }
+    GLuint header[5] = { 0, 1, 1, 0, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s.activeBuffers[2]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (5+s.tiles_x*s.tiles_y)*sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), header);
+
+    s.compactProgram = linkProgram(compactShader, GL_COMPUTE_SHADER);
+    s.Param_compactTiles = glGetUniformLocationARB(s.compactProgram, "glca_tiles");
+    s.Param_compactAll = glGetUniformLocationARB(s.compactProgram, "glca_all");
+    s.Param_compactReach = glGetUniformLocationARB(s.compactProgram, "glca_reach");
+    checkGLErrors("initActiveTiles()");
+}
+
+///\brief Stores the activity of the computation and frees the active tiles resources
+void finishActivity(Simulation::Instance& s) {
+    //cerr<<"Inside finishActivity"<<endl;
+    if (s.backend == COMPUTE) {
+        lastActivity.tiles_x = (s.texSize_x+s.computeTile-1)/s.computeTile;
+        lastActivity.tiles_y = (s.texSize_y+s.computeTile-1)/s.computeTile;
+        lastActivity.tile_width = s.computeTile*s.cellsPerTexel;
+        lastActivity.tile_height = s.computeTile;
+    } else {
+        //cerr<<"the fragment backend has a single tile"<<endl;
+        lastActivity.tiles_x = lastActivity.tiles_y = 1;
+        lastActivity.tile_width = s.cells_x;
+        lastActivity.tile_height = s.texSize_y;
+    }
+    int tiles = lastActivity.tiles_x*lastActivity.tiles_y;
+    lastActivity.total = lastActivity.updates = s.passes*tiles;
+    lastActivityMap.assign(tiles, 1);
+    if (!s.activeTiles) return;
+
+    GLuint header[5];
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s.activeBuffers[2]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), header);
+    lastActivity.updates = header[3] + ((long long)header[4]<<32);
+    vector<GLuint> flags(tiles);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s.activeBuffers[0]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, tiles*sizeof(GLuint), &flags[0]);
+    for (int i=0; i<tiles; ++i) lastActivityMap[i] = flags[i] != 0;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glDeleteBuffers(3, s.activeBuffers);
+    glDeleteObjectARB(s.compactProgram);
+    s.compactProgram = 0;
+}
+
+struct_activity activity(unsigned char* map) {
+    if (map && !lastActivityMap.empty()) memcpy(map, &lastActivityMap[0], lastActivityMap.size());
+    return lastActivity;
+}
+
+struct_timing timing() {
+    return lastTiming;
+}
+
+///Seconds since a time point
+double secondsSince(chrono::steady_clock::time_point begin) {
+    return chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+}
+
+///\brief Creates the ring of pixel buffers and starts the snapshot worker
+///
+///Snapshots and checkpoints are taken at the multiples of their period, also when the
+///computation is resumed.
+void initSnapshots(Simulation::Instance& s) {
+    //cerr<<"Inside initSnapshots"<<endl;
+    s.snapshotting = engine.snapshot != NULL && engine.snapshot_generations > 0;
+    s.checkpointing = engine.checkpoint_file != NULL && engine.checkpoint_generations > 0;
+    s.nextSnapshot = s.snapshotting ? (s.countIterations/engine.snapshot_generations+1)*engine.snapshot_generations : -1;
+    s.nextCheckpoint = s.checkpointing ? (s.countIterations/engine.checkpoint_generations+1)*engine.checkpoint_generations : -1;
+    s.recording = engine.history_file != NULL && engine.history_generations > 0;
+    s.nextHistory = s.recording ? (s.countIterations/engine.history_generations+1)*engine.history_generations : -1;
+    if (!s.snapshotting && !s.checkpointing && !s.recording) return;
+    if (s.checkpointing || s.recording) {
+        s.checkpointHeader.format = s.stateFormat;
+        s.checkpointHeader.rule = s.builtinRule;
+        s.checkpointHeader.x = s.cells_x;
+        s.checkpointHeader.y = s.texSize_y;
+        s.checkpointHeader.texels_x = s.texSize_x;
+        s.checkpointHeader.shaderHash = hashSource(s.textureParameters.shader_source);
+        s.checkpointHeader.texelBytes = (uint64_t)s.texSize_x*s.texSize_y*stateFormats[s.stateFormat].texelBytes;
+    }
+    s.snapshotHead = s.snapshotPending = 0;
+    s.snapshotRing.resize(engine.snapshot_buffers > 0 ? engine.snapshot_buffers : 1);
+    for (size_t i=0; i<s.snapshotRing.size(); ++i) {
+        glGenBuffers(1, &s.snapshotRing[i].pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.snapshotRing[i].pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)s.texSize_x*s.texSize_y*stateFormats[s.stateFormat].texelBytes, NULL, GL_STREAM_READ);
+        s.snapshotRing[i].fence = 0;
+        s.snapshotFree.push_back(new struct_frame());
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (s.recording) s.historyWriter = new HistoryWriter(engine.history_file, s.checkpointHeader, engine.history_keyframes);
+    s.snapshotQuit = false;
+    s.snapshotThread = std::thread(snapshotWorker, std::ref(s));
+    checkGLErrors("initSnapshots()");
+}
+
+///\brief Queues the readback of the current state into the next pixel buffer of the ring
+///
+///Only when the whole ring is in flight it waits for the oldest readback.
+///@param[in] snapshot: if TRUE the state goes to engine.snapshot\n
+///@param[in] checkpoint: if TRUE the state is written to engine.checkpoint_file, with the
+///type of the texture even if engine.byte_image reads the snapshots as bytes\n
+///@param[in] history: if TRUE the state is recorded in engine.history_file, as checkpoints
+void queueSnapshot(Simulation::Instance& s, bool snapshot, bool checkpoint, bool history) {
+    //cerr<<"Inside queueSnapshot"<<endl;
+    TraceScope scope("queueSnapshot", true);
+    if (s.snapshotPending == (int)s.snapshotRing.size()) retireSnapshot(s, true);
+    struct_readback& r = s.snapshotRing[(s.snapshotHead+s.snapshotPending)%s.snapshotRing.size()];
+    bool native = checkpoint || history;
+    r.type = native ? stateFormats[s.stateFormat].texType : s.textureParameters.texType;
+    r.texelBytes = native ? stateFormats[s.stateFormat].texelBytes : s.textureParameters.texelBytes;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+    readState(s, r.type, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r.generation = s.countIterations;
+    r.snapshot = snapshot;
+    r.checkpoint = checkpoint;
+    r.history = history;
+    ++s.snapshotPending;
+    if (snapshot) s.nextSnapshot += engine.snapshot_generations;
+    if (checkpoint) s.nextCheckpoint += engine.checkpoint_generations;
+    if (history) s.nextHistory = (s.countIterations/engine.history_generations+1)*engine.history_generations;
+}
+
+///\brief Hands the oldest readback in flight to the worker, if the GPU has completed it
+///@param[in] wait: if TRUE waits for the GPU, and for a free frame, otherwise returns at once
+///@return FALSE if the readback is not complete yet
+bool retireSnapshot(Simulation::Instance& s, bool wait) {
+    struct_readback& r = s.snapshotRing[s.snapshotHead];
+    GLenum status = glClientWaitSync(r.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED) return false;
+    if (status == GL_WAIT_FAILED) {
+        cout<<"glClientWaitSync():\t [FAIL]"<<endl;
+        exit (1);
+    }
+    struct_frame* frame;
+    {
+        unique_lock<mutex> lock(s.snapshotMutex);
+        if (s.snapshotFree.empty() && !wait) return false;
+        //cerr<<"the callback is slower than the computation, wait for it"<<endl;
+        while (s.snapshotFree.empty()) s.snapshotDone.wait(lock);
+        frame = s.snapshotFree.back();
+        s.snapshotFree.pop_back();
+    }
+    size_t bytes = (size_t)s.texSize_x*s.texSize_y*r.texelBytes;
+    frame->data.resize(bytes);
+    frame->generation = r.generation;
+    frame->snapshot = r.snapshot;
+    frame->checkpoint = r.checkpoint;
+    frame->history = r.history;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+    void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    memcpy(&frame->data[0], mapped, bytes);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glDeleteSync(r.fence);
+    r.fence = 0;
+    s.snapshotHead = (s.snapshotHead+1)%s.snapshotRing.size();
+    --s.snapshotPending;
+    {
+        lock_guard<mutex> lock(s.snapshotMutex);
+        s.snapshotQueue.push_back(frame);
+    }
+    s.snapshotReady.notify_one();
+    return true;
+}
+
+///\brief Waits until the worker has processed all the readbacks in flight
+void drainSnapshots(Simulation::Instance& s) {
+    //cerr<<"Inside drainSnapshots"<<endl;
+    if (!s.snapshotting && !s.checkpointing && !s.recording) return;
+    while (s.snapshotPending > 0) retireSnapshot(s, true);
+    unique_lock<mutex> lock(s.snapshotMutex);
+    //cerr<<"every frame is free again once the worker is idle"<<endl;
+    while (s.snapshotFree.size() < s.snapshotRing.size()) s.snapshotDone.wait(lock);
+}
+
+///\brief Delivers the snapshots still in flight, stops the worker and frees the ring
+void finishSnapshots(Simulation::Instance& s) {
+    //cerr<<"Inside finishSnapshots"<<endl;
+    if (!s.snapshotting && !s.checkpointing && !s.recording) return;
+    while (s.snapshotPending > 0) retireSnapshot(s, true);
+    {
+        lock_guard<mutex> lock(s.snapshotMutex);
+        s.snapshotQuit = true;
+    }
+    s.snapshotReady.notify_one();
+    s.snapshotThread.join();
+    for (size_t i=0; i<s.snapshotRing.size(); ++i) glDeleteBuffers(1, &s.snapshotRing[i].pbo);
+    s.snapshotRing.clear();
+    for (size_t i=0; i<s.snapshotFree.size(); ++i) delete s.snapshotFree[i];
+    s.snapshotFree.clear();
+    delete s.historyWriter;
+    s.historyWriter = NULL;
+    s.snapshotting = s.checkpointing = s.recording = false;
+}
+
+///\brief Body of the snapshot worker: runs engine.snapshot on the queued frames, in order
+///
+///Checkpoints and records are written first. Bit-packed built-in states are unpacked to one byte per
+///cell before the callback.
+void snapshotWorker(Simulation::Instance& s) {
+    for (;;) {
+        struct_frame* frame;
+        {
+            unique_lock<mutex> lock(s.snapshotMutex);
+            while (s.snapshotQueue.empty() && !s.snapshotQuit) s.snapshotReady.wait(lock);
+            if (s.snapshotQueue.empty()) return;
+            frame = s.snapshotQueue.front();
+            s.snapshotQueue.pop_front();
+        }
+        if (frame->checkpoint) {
+            TraceScope scope("saveCheckpoint");
+            struct_checkpointHeader header = s.checkpointHeader;
+            header.generation = frame->generation;
+            saveCheckpoint(engine.checkpoint_file, header, &frame->data[0]);
+        }
+        if (frame->history) {
+            TraceScope scope("record history");
+            s.historyWriter->record(frame->generation, &frame->data[0]);
+        }
+        if (!frame->snapshot) {
+            lock_guard<mutex> lock(s.snapshotMutex);
+            s.snapshotFree.push_back(frame);
+            s.snapshotDone.notify_one();
+            continue;
+        }
+        const void* data = &frame->data[0];
+        if (s.cellsPerTexel == 32) {
+            const unsigned int* words = (const unsigned int*)data;
+            frame->cells.resize((size_t)s.cells_x*s.texSize_y);
+            for (int i=0; i<s.texSize_y; ++i)
+                for (int j=0; j<s.cells_x; ++j)
+                    frame->cells[(size_t)s.cells_x*i+j] = (words[(size_t)s.texSize_x*i+j/32]>>(j%32)) & 1;
+            data = &frame->cells[0];
+        }
+        {
+            TraceScope scope("snapshot");
+            engine.snapshot(data, frame->generation, engine.snapshot_user);
+        }
+        {
+            lock_guard<mutex> lock(s.snapshotMutex);
+            s.snapshotFree.push_back(frame);
+        }
+        s.snapshotDone.notify_one();
+    }
+}
+
+///\brief Chooses tile and halo of the compute backend.
+///
+///The halo is as wide as engine.steps_per_pass, the tile is doubled when the two
+///copies of the tile in shared memory still fit, to cut the cells recomputed in the halo.
+void initComputeTiles(Simulation::Instance& s) {
+    //cerr<<"Inside initComputeTiles"<<endl;
+    GLint sharedSize;
+    glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &sharedSize);
+    //single channel integer states are kept as uint, anything else as vec4
+    int cellSize = s.textureParameters.texFormat == GL_RED_INTEGER ? 4 : 16;
+    //cerr<<"active tiles also share their change flag"<<endl;
+    if (engine.active_tiles) sharedSize -= sizeof(GLuint);
+
+    s.computeHalo = engine.steps_per_pass > 1 ? engine.steps_per_pass : 1;
+    s.computeTile = 2*computeThreads;
+    while (2*(s.computeTile+2*s.computeHalo)*(s.computeTile+2*s.computeHalo)*cellSize > sharedSize) {
+        if (s.computeTile > computeThreads) s.computeTile = computeThreads;
+        else --s.computeHalo;
+    }
+    if (s.computeHalo < 1) {
+        cout<<"Not enough shared memory for compute tiles, using the fragment backend"<<endl;
+        s.backend = FRAGMENT;
+    } else if (s.computeHalo < engine.steps_per_pass)
+        cout<<"Shared memory allows only "<<s.computeHalo<<" steps per pass"<<endl;
+}
+
+///\brief Wraps a rule shader into a compute shader working on shared memory tiles.
+///
+///Each workgroup first copies its tile and the surrounding halo from texture_A to shared
+///memory, with the same zero border of the textures. Then it evolves the tile on chip for
+///up to computeHalo generations, ping-ponging between two shared copies: at each step the
+///valid region shrinks by one cell per side, so after the last one the tile itself is exact
+///and is the only part written back.
+///The rule is left untouched: macros redirect its texture2DRect/texture calls to the tile,
+///gl_TexCoord and gl_FragColor to plain variables and its main to a function.
+///Integer rules write "out uvec4 state", which becomes a plain variable too.
+///Rules can only read texture_A, at most one cell away.
+///With active tiles the workgroups take their tile from the list of the compaction pass
+///and flag it when any of its cells changed.
+string computeShaderSource(Simulation::Instance& s, const char* rule) {
+    //cerr<<"Inside computeShaderSource"<<endl;
+    bool integer = s.textureParameters.texFormat == GL_RED_INTEGER;
+    //single channel integer cells are stored as uint to save shared memory
+    string tileType = integer ? "uvec4" : "vec4";
+    string cellType = integer ? "uint" : "vec4";
+    string imageType = integer ? "uimage2DRect" : "image2DRect";
+
+    //cerr<<"the compute shader has its own version"<<endl;
+    string body = rule;
+    if (body.compare(0, 8, "#version") == 0) body.erase(0, body.find('\n'));
+    if (integer) {
+        size_t out = body.find("out uvec4 state");
+        if (out != string::npos) body.erase(out, 4);
+    }
+
+    char sizes[128];
+    sprintf(sizes, "#define THREADS %d\n#define TILE %d\n#define HALO %d\n#define SIDE %d\n",
+            computeThreads, s.computeTile, s.computeHalo, s.computeTile+2*s.computeHalo);
+    return string("#version 430\n") + sizes + (s.activeTiles ? "#define ACTIVE\n" : "") +
+        (integer ? "#define LOAD(c) uvec4(c, 0u, 0u, 1u)\n#define STORE(v) (v).r\n#define CHANGED(a, b) ((a) != (b))\n"
+                 : "#define LOAD(c) (c)\n#define STORE(v) (v)\n#define CHANGED(a, b) any(notEqual(a, b))\n") +
+        "layout(local_size_x = THREADS, local_size_y = THREADS) in;\n"
+        "layout(" + s.textureParameters.imageFormat + ") uniform writeonly " + imageType + " glca_dest;\n"
+        "uniform ivec2 glca_size;\n"
+        "uniform int glca_steps;\n"
+        "shared " + cellType + " glca_tile[2][SIDE][SIDE];\n"
+        "#ifdef ACTIVE\n"
+        "layout(std430, binding = 1) writeonly buffer glca_next { uint glca_changed[]; };\n"
+        "layout(std430, binding = 2) readonly buffer glca_active { uint glca_header[5]; uint glca_list[]; };\n"
+        "uniform int glca_tiles_x;\n"
+        "shared uint glca_dirty;\n"
+        "#endif\n"
+        "int glca_src = 0;\n"
+        "ivec2 glca_origin = ivec2(0);\n"
+        "vec4 glca_TexCoord[1] = vec4[1](vec4(0.0));\n"
+        "vec4 glca_FragColor = vec4(0.0);\n"
+        + tileType + " glca_fetch(vec2 p) {\n"
+        "    ivec2 t = ivec2(floor(p)) - glca_origin;\n"
+        "    return LOAD(glca_tile[glca_src][t.y][t.x]);\n"
+        "}\n"
+        "#define texture2DRect(s, p) glca_fetch(p)\n"
+        "#define texture(s, p) glca_fetch(p)\n"
+        "#define gl_TexCoord glca_TexCoord\n"
+        "#define gl_FragColor glca_FragColor\n"
+        "#define main glca_rule\n"
+        + body + "\n"
+        "#undef main\n"
+        "bool glca_inside(ivec2 p) { return all(greaterThanEqual(p, ivec2(0))) && all(lessThan(p, glca_size)); }\n"
+        "void main() {\n"
+        "#ifdef ACTIVE\n"
+        "    uint glca_index = glca_list[gl_WorkGroupID.x];\n"
+        "    glca_origin = ivec2(glca_index % uint(glca_tiles_x), glca_index / uint(glca_tiles_x)) * TILE - HALO;\n"
+        "    if (gl_LocalInvocationIndex == 0u) glca_dirty = 0u;\n"
+        "#else\n"
+        "    glca_origin = ivec2(gl_WorkGroupID.xy) * TILE - HALO;\n"
+        "#endif\n"
+        "    for (int i = int(gl_LocalInvocationIndex); i < SIDE*SIDE; i += THREADS*THREADS) {\n"
+        "        ivec2 t = ivec2(i % SIDE, i / SIDE);\n"
+        "        ivec2 p = glca_origin + t;\n"
+        "        glca_tile[0][t.y][t.x] = glca_inside(p) ? STORE(texelFetch(texture_A, p)) : " + cellType + "(0);\n"
+        "    }\n"
+        "    barrier();\n"
+        "    for (int s = 1; s <= glca_steps; ++s) {\n"
+        "        glca_src = (s-1) & 1;\n"
+        "        int side = SIDE - 2*s;\n"
+        "        for (int i = int(gl_LocalInvocationIndex); i < side*side; i += THREADS*THREADS) {\n"
+        "            ivec2 t = ivec2(s + i % side, s + i / side);\n"
+        "            ivec2 p = glca_origin + t;\n"
+        "            " + cellType + " c = " + cellType + "(0);\n"
+        "            if (glca_inside(p)) {\n"
+        "                glca_TexCoord[0] = vec4(vec2(p) + 0.5, 0.0, 1.0);\n"
+        "                glca_rule();\n"
+        "                c = STORE(" + (integer ? "state" : "glca_FragColor") + ");\n"
+        "            }\n"
+        "            glca_tile[s & 1][t.y][t.x] = c;\n"
+        "        }\n"
+        "        barrier();\n"
+        "    }\n"
+        "    for (int i = int(gl_LocalInvocationIndex); i < TILE*TILE; i += THREADS*THREADS) {\n"
+        "        ivec2 t = ivec2(HALO + i % TILE, HALO + i / TILE);\n"
+        "        ivec2 p = glca_origin + t;\n"
+        "        if (glca_inside(p)) {\n"
+        "            " + cellType + " c = glca_tile[glca_steps & 1][t.y][t.x];\n"
+        "            imageStore(glca_dest, p, LOAD(c));\n"
+        "#ifdef ACTIVE\n"
+        "            if (CHANGED(c, STORE(texelFetch(texture_A, p)))) atomicOr(glca_dirty, 1u);\n"
+        "#endif\n"
+        "        }\n"
+        "    }\n"
+        "#ifdef ACTIVE\n"
+        "    barrier();\n"
+        "    if (gl_LocalInvocationIndex == 0u) glca_changed[glca_index] = glca_dirty;\n"
+        "#endif\n"
+        "}\n";
+}
+
+///\brief Sets up the program that maps integer states to colors in the GUI.
+///
+///The palette is taken from engine.palette, states without a color are shown as gray levels.
+void initDisplayGLSL(Simulation::Instance& s) {
+    //cerr<<"Inside initDisplayGLSL"<<endl;
+    if (s.textureParameters.texFormat != GL_RED_INTEGER) return;
+
+    //cerr<<"fill the palette texture"<<endl;
+    float palette[256][4];
+    for (int i=0; i<256; ++i) {
+        if (i < engine.palette_colors)
+            for (int c=0; c<4; ++c) palette[i][c] = engine.palette[i][c];
+        else {
+            palette[i][0] = palette[i][1] = palette[i][2] = i/255.0;
+            palette[i][3] = 1.0;
+        }
+    }
+    glGenTextures(1, &s.paletteTex);
+    glBindTexture(s.textureParameters.texTarget, s.paletteTex);
+    glTexParameteri(s.textureParameters.texTarget, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(s.textureParameters.texTarget, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(s.textureParameters.texTarget, 0, GL_RGBA32F_ARB, 256, 1, 0, GL_RGBA, GL_FLOAT, palette);
+
+    //cerr<<"compile the palette lookup"<<endl;
+    const GLcharARB* source = s.cellsPerTexel == 32 ?
+        "#version 150 compatibility\n"
+        "uniform usampler2DRect state;"
+        "uniform sampler2DRect palette;"
+        "void main(void) {"
+        "    uint bit = uint(gl_TexCoord[0].s * 32.0) & 31u;"
+        "    gl_FragColor = texelFetch(palette, ivec2((texture(state, gl_TexCoord[0].st).r >> bit) & 1u, 0));"
+        "}" :
+        "#version 150 compatibility\n"
+        "uniform usampler2DRect state;"
+        "uniform sampler2DRect palette;"
+        "void main(void) {"
+        "    gl_FragColor = texelFetch(palette, ivec2(min(texture(state, gl_TexCoord[0].st).r, 255u), 0));"
+        "}";
+    s.displayProgram = glCreateProgramObjectARB();
+    GLhandleARB displayShader = glCreateShaderObjectARB(GL_FRAGMENT_SHADER_ARB);
+    glAttachObjectARB(s.displayProgram, displayShader);
+    glShaderSourceARB(displayShader, 1, &source, NULL);
+    glCompileShaderARB(displayShader);
+    printInfoLog(displayShader);
+    glLinkProgramARB(s.displayProgram);
+    glUseProgramObjectARB(s.displayProgram);
+    glUniform1iARB(glGetUniformLocationARB(s.displayProgram, "state"), 0);
+    glUniform1iARB(glGetUniformLocationARB(s.displayProgram, "palette"), 1);
+    checkGLErrors("initDisplayGLSL()");
+}
+
+///@return the number of generations still to compute before the end or the next snapshot
+long generationsLeft(Simulation::Instance& s) {
+    long left = s.numIterations - s.countIterations;
+    if (s.snapshotting && left > s.nextSnapshot - s.countIterations) left = s.nextSnapshot - s.countIterations;
+    if (s.checkpointing && left > s.nextCheckpoint - s.countIterations) left = s.nextCheckpoint - s.countIterations;
+    if (s.recording && left > s.nextHistory - s.countIterations) left = s.nextHistory - s.countIterations;
+    if (s.inputting && left > s.nextInput - s.countIterations) left = s.nextInput - s.countIterations;
+    return left;
+}
+
+///\brief Computes the next generations and takes the snapshots that are due
+///@param[in] generations: generations still to compute
+///@return the number of generations computed
+int advance(Simulation::Instance& s, long generations) {
+    int done = step(s, generations);
+    s.countIterations += done;
+    totals.generations += done;
+    if (s.snapshotting || s.checkpointing || s.recording) {
+        //cerr<<"hand the completed readbacks to the worker"<<endl;
+        while (s.snapshotPending > 0 && retireSnapshot(s, false));
+        bool snapshot = s.countIterations == s.nextSnapshot, checkpoint = s.countIterations == s.nextCheckpoint;
+        bool history = s.countIterations == s.nextHistory;
+        if (s.backend == HYBRID && (snapshot || checkpoint || history)) syncHybrid(s);
+        if (snapshot && (checkpoint || history) && s.textureParameters.texType != stateFormats[s.stateFormat].texType) {
+            //cerr<<"bytes for the snapshot, the texture type for the checkpoint and the history"<<endl;
+            queueSnapshot(s, true, false, false);
+            queueSnapshot(s, false, checkpoint, history);
+        } else if (snapshot || checkpoint || history)
+            queueSnapshot(s, snapshot, checkpoint, history);
+    }
+    if (s.inputting && s.countIterations == s.nextInput) feedInput(s);
+    traceCounters();
+    return done;
+}
+
+///\brief Computes the next generations.
+///@param[in] generations: generations still to compute
+///@return the number of generations actually computed (one, unless the backend is COMPUTE)
+int step(Simulation::Instance& s, long generations) {
+    //cerr<<"Inside step"<<endl;
+    //cerr<<"the hybrid backend times its GPU rows itself"<<endl;
+    TraceScope scope("pass", s.backend != HYBRID);
+    ++s.passes;
+    ++totals.passes;
+    if (s.backend == COMPUTE) return stepCompute(s, generations);
+    if (s.backend == HYBRID) return stepHybrid(s);
+    if (!s.blocks.empty()) return stepBlocks(s);
     // set render destination
-    glDrawBuffer (attachmentpoints[writeTex]);
+    glDrawBuffer (attachmentpoints[s.writeTex]);
     // enable texture (read-only)
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(textureParameters.texTarget,TexID_A[readTex]);
-    glUniform1iARB(Param_A,0); // texunit 0
+    glBindTexture(s.textureParameters.texTarget,s.TexID_A[s.readTex]);
+    glUniform1iARB(s.Param_A,0); // texunit 0
 
+    if (s.ensembleBoards > 0) {
+        // one quad per board, the gutters are left as they are
+        glBindBuffer(GL_ARRAY_BUFFER, s.ensembleQuads);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(2, GL_FLOAT, 0, 0);
+        glTexCoordPointer(2, GL_FLOAT, 0, 0);
+        glDrawArrays(GL_QUADS, 0, 4*s.ensembleBoards);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        swap(s);
+        return 1;
+    }
     // render the quad with unnormalized texcoords
     glBegin(GL_QUADS);
     glTexCoord2f(0.0, 0.0);
     glVertex2f(0.0, 0.0);
-    glTexCoord2f(texSize_x, 0.0);
-    glVertex2f(texSize_x, 0.0);
-    glTexCoord2f(texSize_x, texSize_y);
-    glVertex2f(texSize_x, texSize_y);
-    glTexCoord2f(0.0, texSize_y);
-    glVertex2f(0.0, texSize_y);
+    glTexCoord2f(s.texSize_x, 0.0);
+    glVertex2f(s.texSize_x, 0.0);
+    glTexCoord2f(s.texSize_x, s.texSize_y);
+    glVertex2f(s.texSize_x, s.texSize_y);
+    glTexCoord2f(0.0, s.texSize_y);
+    glVertex2f(0.0, s.texSize_y);
     glEnd();
 
     // swap role of the two textures (read-only source becomes
     // write-only target and the other way round):
-    swap();
+    swap(s);
+    return 1;
+}
+
+///\brief Computes the next generation of each block, then exchanges their halos
+///@return the number of generations computed, one
+int stepBlocks(Simulation::Instance& s) {
+    //cerr<<"Inside stepBlocks"<<endl;
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1iARB(s.Param_A,0); // texunit 0
+    glMatrixMode(GL_PROJECTION);
+    for (size_t k=0; k<s.blocks.size(); ++k) {
+        const struct_block& b = s.blocks[k];
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, b.fb);
+        glDrawBuffer(attachmentpoints[s.writeTex]);
+        glBindTexture(s.textureParameters.texTarget, b.tex[s.readTex]);
+        if (s.Param_offset >= 0) glUniform2fARB(s.Param_offset, b.x-1, b.y-1);
+        glViewport(0, 0, b.w+2, b.h+2);
+        glLoadIdentity();
+        gluOrtho2D(0.0, b.w+2, 0.0, b.h+2);
+        // only the cells of the block, the halo comes from the neighbours
+        glBegin(GL_QUADS);
+        glTexCoord2f(1.0, 1.0);
+        glVertex2f(1.0, 1.0);
+        glTexCoord2f(b.w+1, 1.0);
+        glVertex2f(b.w+1, 1.0);
+        glTexCoord2f(b.w+1, b.h+1);
+        glVertex2f(b.w+1, b.h+1);
+        glTexCoord2f(1.0, b.h+1);
+        glVertex2f(1.0, b.h+1);
+        glEnd();
+    }
+    glMatrixMode(GL_MODELVIEW);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, s.fb);
+    exchangeHalos(s);
+    swap(s);
+    return 1;
+}
+
+///\brief Starts the CPU part of the hybrid backend
+///
+///The CPU takes its rows from the textures, so that resumed states come for free.
+void initHybrid(Simulation::Instance& s) {
+    //cerr<<"Inside initHybrid"<<endl;
+    s.hybridPool = new ThreadPool(engine.cpu_threads);
+    const char* isa;
+    s.hybridKernel = cpuKernel((BuiltinRule)s.builtinRule, &isa);
+    for (int i=0; i<2; ++i) s.hybridCells[i].assign((size_t)(s.cells_x+2)*(s.texSize_y+2), 0);
+    s.hybridCurrent = 0;
+    float share = engine.hybrid_gpu_share > 0 && engine.hybrid_gpu_share < 1 ? engine.hybrid_gpu_share : 0.5f;
+    s.hybridSplit = max(1, min((int)(s.texSize_y*share+0.5f), s.texSize_y-1));
+    loadHybridRows(s, s.hybridSplit-1, s.texSize_y);
+    s.hybridQuery = 0;
+    if (GLEW_ARB_timer_query) glGenQueries(1, &s.hybridQuery);
+    s.hybridGPUTime = s.hybridCPUTime = 0;
+    s.hybridGenerations = 0;
+    cout<<"HYBRID - "<<isa<<" - "<<s.hybridPool->size()<<" threads, GPU rows 0-"<<s.hybridSplit-1<<endl;
+}
+
+///Frees the CPU part of the hybrid backend
+void freeHybrid(Simulation::Instance& s) {
+    cout<<"HYBRID - GPU rows 0-"<<s.hybridSplit-1<<" at the end"<<endl;
+    if (s.hybridQuery) glDeleteQueries(1, &s.hybridQuery);
+    delete s.hybridPool;
+    s.hybridPool = NULL;
+    for (int i=0; i<2; ++i) vector<unsigned char>().swap(s.hybridCells[i]);
+}
+
+///\brief Reads rows of the current state from readTex into the current CPU states
+///@param[in] first: first row, may be -1\n
+///@param[in] last: row after the last one
+void loadHybridRows(Simulation::Instance& s, int first, int last) {
+    first = max(first, 0);
+    if (first >= last) return;
+    int rows = last-first;
+    vector<unsigned char> texels((size_t)s.texSize_x*rows*s.textureParameters.texelBytes);
+    glReadBuffer(attachmentpoints[s.readTex]);
+    glReadPixels(0, first, s.texSize_x, rows, s.textureParameters.texFormat, s.textureParameters.texType, &texels[0]);
+    totals.readback_bytes += texels.size();
+    size_t w = s.cells_x+2;
+    for (int i=0; i<rows; ++i) {
+        unsigned char* cells = &s.hybridCells[s.hybridCurrent][w*(first+i+1)+1];
+        if (s.cellsPerTexel == 32) {
+            const unsigned int* words = (const unsigned int*)&texels[0]+(size_t)s.texSize_x*i;
+            for (int j=0; j<s.cells_x; ++j) cells[j] = (words[j/32]>>(j%32)) & 1;
+        } else
+            memcpy(cells, &texels[(size_t)s.cells_x*i], s.cells_x);
+    }
+}
+
+///\brief Writes rows of the current CPU states into a texture
+///@param[in] first: first row\n
+///@param[in] last: row after the last one, may be y+1\n
+///@param[in] tex: the texture, readTex or writeTex
+void storeHybridRows(Simulation::Instance& s, int first, int last, int tex) {
+    last = min(last, s.texSize_y);
+    if (first >= last) return;
+    int rows = last-first;
+    vector<unsigned char> texels((size_t)s.texSize_x*rows*s.textureParameters.texelBytes, 0);
+    size_t w = s.cells_x+2;
+    for (int i=0; i<rows; ++i) {
+        const unsigned char* cells = &s.hybridCells[s.hybridCurrent][w*(first+i+1)+1];
+        if (s.cellsPerTexel == 32) {
+            unsigned int* words = (unsigned int*)&texels[0]+(size_t)s.texSize_x*i;
+            for (int j=0; j<s.cells_x; ++j)
+                if (cells[j]) words[j/32] |= 1u<<(j%32);
+        } else
+            memcpy(&texels[(size_t)s.cells_x*i], cells, s.cells_x);
+    }
+    glBindTexture(s.textureParameters.texTarget, s.TexID_A[tex]);
+    glTexSubImage2D(s.textureParameters.texTarget,0,0,first,s.texSize_x,rows,s.textureParameters.texFormat,s.textureParameters.texType,&texels[0]);
+    totals.uploaded_bytes += texels.size();
+}
 
-    if ((countIterations%refrashrate)==0) display();
-    //cerr<<refrashrate<<endl;
+///Copies the CPU rows to readTex, which then holds the whole current state
+void syncHybrid(Simulation::Instance& s) {
+    storeHybridRows(s, s.hybridSplit, s.texSize_y, s.readTex);
+}
 
-    //if (clock()-lastc>CLOCKS_PER_SEC) {
-        //float speed=(countIterations-lasti)*CLOCKS_PER_SEC/(clock()-lastc);
-        //cerr<<"\nsimulation speed: "<<speed<<"hz\nrefrash:"<<speed/refrashrate<<"fps (1/"<<refrashrate<<")\n";
-        //lasti=countIterations;
-        //lastc=clock();
-    //}
-    if (withgui)
-        if (countIterations++==numIterations) glutLeaveMainLoop();
+///\brief Computes the next generation of the GPU rows and, meanwhile, of the CPU rows
+///@return the number of generations computed, one
+int stepHybrid(Simulation::Instance& s) {
+    //cerr<<"Inside stepHybrid"<<endl;
+    //cerr<<"the first CPU row is the halo of the GPU rows"<<endl;
+    storeHybridRows(s, s.hybridSplit, s.hybridSplit+1, s.readTex);
+    glDrawBuffer(attachmentpoints[s.writeTex]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(s.textureParameters.texTarget,s.TexID_A[s.readTex]);
+    glUniform1iARB(s.Param_A,0); // texunit 0
+    chrono::steady_clock::time_point issued = chrono::steady_clock::now();
+    if (s.hybridQuery) glBeginQuery(GL_TIME_ELAPSED, s.hybridQuery);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0, 0.0);
+    glVertex2f(0.0, 0.0);
+    glTexCoord2f(s.texSize_x, 0.0);
+    glVertex2f(s.texSize_x, 0.0);
+    glTexCoord2f(s.texSize_x, s.hybridSplit);
+    glVertex2f(s.texSize_x, s.hybridSplit);
+    glTexCoord2f(0.0, s.hybridSplit);
+    glVertex2f(0.0, s.hybridSplit);
+    glEnd();
+    if (s.hybridQuery) glEndQuery(GL_TIME_ELAPSED);
+    // let the GPU start while the CPU computes its rows
+    glFlush();
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    size_t w = s.cells_x+2;
+    const unsigned char* A = &s.hybridCells[s.hybridCurrent][0];
+    unsigned char* B = &s.hybridCells[s.hybridCurrent^1][0];
+    int rows = s.texSize_y-s.hybridSplit;
+    const struct_rule& rule = ruleTable((BuiltinRule)s.builtinRule);
+    s.hybridPool->parallelFor((rows+hybridBandRows-1)/hybridBandRows, [&](int band) {
+        for (int i = s.hybridSplit+band*hybridBandRows+1; i <= s.texSize_y && i <= s.hybridSplit+(band+1)*hybridBandRows; ++i) {
+            size_t row = w*i+1;
+            s.hybridKernel(A+row-w, A+row, A+row+w, B+row, s.cells_x, rule);
+        }
+    });
+    double cpuTime = chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    s.hybridCPUTime += cpuTime;
+    traceEvent("CPU rows", begin, cpuTime, false);
+
+    swap(s);
+    s.hybridCurrent ^= 1;
+    //cerr<<"the last GPU row is the halo of the CPU rows"<<endl;
+    loadHybridRows(s, s.hybridSplit-1, s.hybridSplit);
+    if (s.hybridQuery) {
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(s.hybridQuery, GL_QUERY_RESULT, &elapsed);
+        s.hybridGPUTime += elapsed*1e-9;
+        traceEvent("GPU rows", issued, elapsed*1e-9, true);
+    }
+    if (++s.hybridGenerations == hybridBalance) balanceHybrid(s);
+    return 1;
+}
+
+///\brief Moves the split line so that the GPU and the CPU take the same time per generation
+///
+///The line moves only when the difference is larger than a few rows, so that the noise of
+///the timings does not move rows back and forth.
+void balanceHybrid(Simulation::Instance& s) {
+    //cerr<<"Inside balanceHybrid"<<endl;
+    double gpuRate = s.hybridGPUTime > 0 ? s.hybridSplit/s.hybridGPUTime : 0;
+    double cpuRate = s.hybridCPUTime > 0 ? (s.texSize_y-s.hybridSplit)/s.hybridCPUTime : 0;
+    s.hybridGPUTime = s.hybridCPUTime = 0;
+    s.hybridGenerations = 0;
+    if (gpuRate <= 0 || cpuRate <= 0) return;
+    int split = (int)(s.texSize_y*gpuRate/(gpuRate+cpuRate)+0.5);
+    split = max(1, min(split, s.texSize_y-1));
+    if (abs(split-s.hybridSplit) <= max(1, s.texSize_y/64)) return;
+    //cerr<<"the rows changing side move with the current state"<<endl;
+    if (split > s.hybridSplit) storeHybridRows(s, s.hybridSplit, split, s.readTex);
+    else loadHybridRows(s, split-1, s.hybridSplit);
+    s.hybridSplit = split;
+}
+
+///\brief Computes up to computeHalo generations in a single pass of the compute backend
+///@param[in] generations: generations still to compute
+///@return the number of generations computed
+int stepCompute(Simulation::Instance& s, long generations) {
+    //cerr<<"Inside stepCompute"<<endl;
+    int steps = generations < s.computeHalo ? generations : s.computeHalo;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(s.textureParameters.texTarget,s.TexID_A[s.readTex]);
+    glUniform1iARB(s.Param_A,0); // texunit 0
+    glUniform2iARB(s.Param_size, s.texSize_x, s.texSize_y);
+    glUniform1iARB(s.Param_steps, steps);
+    glBindImageTexture(0, s.TexID_A[s.writeTex], 0, GL_FALSE, 0, GL_WRITE_ONLY, s.textureParameters.texInternalFormat);
+
+    if (s.activeTiles) {
+        //cerr<<"list the active tiles"<<endl;
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, s.activeBuffers[2]);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        for (int i=0; i<3; ++i) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, s.activeBuffers[i]);
+        glUseProgramObjectARB(s.compactProgram);
+        glUniform2iARB(s.Param_compactTiles, s.tiles_x, s.tiles_y);
+        glUniform1iARB(s.Param_compactAll, steps != s.lastSteps);
+        glUniform1iARB(s.Param_compactReach, (steps+s.computeTile-1)/s.computeTile);
+        glDispatchCompute((s.tiles_x*s.tiles_y+63)/64, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        glUseProgramObjectARB(s.programObject);
+
+        glUniform1iARB(s.Param_tilesX, s.tiles_x);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, s.activeBuffers[2]);
+        glDispatchComputeIndirect(0);
+        // the flags of this pass are the last ones of the next
+        GLuint tmp = s.activeBuffers[0];
+        s.activeBuffers[0] = s.activeBuffers[1];
+        s.activeBuffers[1] = tmp;
+    } else
+        glDispatchCompute((s.texSize_x+s.computeTile-1)/s.computeTile, (s.texSize_y+s.computeTile-1)/s.computeTile, 1);
+    // the next generation, the GUI and the readback see the result as a texture or attachment
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    s.lastSteps = steps;
+    swap(s);
+    return steps;
+}
+
+///\brief Performs the actual calculation in GUI mode (GLUT idle callback).
+///
+///With engine.refresh_fps>0 runs as many generations as fit before the next frame
+///is due, otherwise refreshes every engine.refresh_generations generations.
+void run(void) {
+    //cerr<<"Inside run"<<endl;
+    Simulation::Instance& s = *displayed;
+    if (engine.refresh_fps > 0) {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        int flushed = 0;
+        do {
+            if (s.countIterations == s.numIterations) break;
+            advance(s, generationsLeft(s));
+            // make sure the GPU is not queued with more work than fits in a frame
+            if ((++flushed & 63) == 0) glFinish();
+            now = chrono::steady_clock::now();
+        } while (now < s.nextFrame);
+        s.nextFrame = now + chrono::microseconds((long)(1e6/engine.refresh_fps));
+    } else {
+        for (int i=0; i<engine.refresh_generations && s.countIterations!=s.numIterations; ) {
+            long left = generationsLeft(s);
+            if (left > engine.refresh_generations-i) left = engine.refresh_generations-i;
+            i += advance(s, left);
+        }
+    }
+    display();
+
+    if (s.countIterations == s.numIterations) glutLeaveMainLoop();
 }
 
 ///Checks for OpenGL errors.
@@ -391,71 +2646,183 @@ void printInfoLog(GLhandleARB obj) {
     }
 }
 
-///\brief Saves an RGBA image to the file imname
-///@param[in] buffer: the image content\n
-///@param[in] imname: the name of the file where the image will be saved\n
-///@param[in] length: size of the image (4*x*y being RGBA)e
-void saveImage(float *p, char* imname, int length) {
-    //cerr<<"Inside saveImage "<<imname<<endl;
-    //remove(imname);
-    ofstream file;
-    file.open(imname,ios::out|ios::binary);//open a file
-    for (int i=0; i<length; ++i) {
-		if (p[i]>1) p[i]=1;//clipping values
-		else if (p[i]<0) p[i]=0;//clipping values
-        file<<(unsigned char)(255*p[i]);//write to it 
+///\brief Converts an RGBA image to cell states.
+///
+///Colors are compared after quantization to bytes, as they are stored in RGBA files,
+///so that a pixel 0.498 matches a palette entry 0.5.
+///@param[in] image: RGBA image normalized between 0 and 1
+///@param[out] states: one byte per cell, the index of the matching palette color (0 if none matches)
+///@param[in] cells: number of cells (x*y)
+///@param[in] palette: RGBA colors of the states
+///@param[in] colors: number of states in the palette
+void encodeStates(const float* image, unsigned char* states, int cells, const float palette[][4], int colors) {
+    //cerr<<"Inside encodeStates"<<endl;
+    for (int i=0; i<cells; ++i) {
+        states[i] = 0;
+        for (int s=0; s<colors; ++s) {
+            int c=0;
+            while (c<4 && (unsigned char)(255*image[4*i+c]) == (unsigned char)(255*palette[s][c])) ++c;
+            if (c==4) {
+                states[i] = s;
+                break;
+            }
+        }
     }
-    file.close();//close it
 }
 
-///\brief Loads an RGBA image from the file imname to the given buffer
-///@param[in] buffer: a buffer for storing the image\n
-///@param[in] imname: the name of the image to load\n
-///@param[in] length: size of the image (4*x*y being RGBA)
-void loadImage(float *p, char* imname, int length) {
-    //cerr<<"Inside loadImage "<<imname<<endl;
-    ifstream file;
-    file.open(imname,ios::in|ios::binary);
-    for (int i=0; i<length; ++i) {
-        unsigned char pixel;
-        file>>pixel;
-        p[i]=(float)pixel/255.0;
-    }
-    file.close();//close it
+///\brief Converts cell states back to an RGBA image
+///@param[in] states: one byte per cell, index of a palette color
+///@param[out] image: RGBA image normalized between 0 and 1
+///@param[in] cells: number of cells (x*y)
+///@param[in] palette: RGBA colors of the states
+///@param[in] colors: number of states in the palette
+void decodeStates(const unsigned char* states, float* image, int cells, const float palette[][4], int colors) {
+    //cerr<<"Inside decodeStates"<<endl;
+    for (int i=0; i<cells; ++i)
+        for (int c=0; c<4; ++c)
+            image[4*i+c] = states[i]<colors ? palette[states[i]][c] : 0.0;
 }
 
 ///swaps the role of the two textures (read-only and write-only)
-void swap(void) {
+void swap(Simulation::Instance& s) {
     //cerr<<"Inside swap"<<endl;
-    if (writeTex == 0) {
-        writeTex = 1;
-        readTex = 0;
+    if (s.writeTex == 0) {
+        s.writeTex = 1;
+        s.readTex = 0;
     } else {
-        writeTex = 0;
-        readTex = 1;
+        s.writeTex = 0;
+        s.readTex = 1;
+    }
+}
+
+///\brief Toggles the scrubbing of the history with the space bar (GLUT keyboard callback)
+///
+///The computation is paused and the records written so far are read back from
+///engine.history_file, starting from the last one.
+void keyboard(unsigned char key, int x, int y) {
+    //cerr<<"Inside keyboard"<<endl;
+    Simulation::Instance& s = *displayed;
+    if (key != ' ' || !s.recording) return;
+    if (s.scrubHistory) {
+        //cerr<<"back to the computation"<<endl;
+        delete s.scrubHistory;
+        s.scrubHistory = NULL;
+        //cerr<<"the next pass rewrites every tile of the texture shown"<<endl;
+        s.lastSteps = 0;
+        glutSetWindowTitle(s.windowTitle.c_str());
+        s.nextFrame = chrono::steady_clock::now();
+        glutIdleFunc(run);
+        glutPostRedisplay();
+        return;
+    }
+    glutIdleFunc(NULL);
+    drainSnapshots(s);
+    s.scrubHistory = new History(engine.history_file);
+    showRecord(s, s.scrubHistory->records()-1);
+}
+
+///\brief Moves through the history while scrubbing (GLUT special keys callback)
+///
+///Left and right move by one record, down and up by engine.history_keyframes records,
+///home and end go to the first and the last record.
+void special(int key, int x, int y) {
+    Simulation::Instance& s = *displayed;
+    if (!s.scrubHistory) return;
+    long record = s.scrubRecord;
+    switch (key) {
+        case GLUT_KEY_LEFT: --record; break;
+        case GLUT_KEY_RIGHT: ++record; break;
+        case GLUT_KEY_DOWN: record -= engine.history_keyframes; break;
+        case GLUT_KEY_UP: record += engine.history_keyframes; break;
+        case GLUT_KEY_HOME: record = 0; break;
+        case GLUT_KEY_END: record = s.scrubHistory->records()-1; break;
+        default: return;
     }
+    showRecord(s, max(0L, min(record, s.scrubHistory->records()-1)));
+}
+
+///\brief Uploads a record of the history to the texture written by the next pass and shows it
+void showRecord(Simulation::Instance& s, long record) {
+    //cerr<<"Inside showRecord "<<record<<endl;
+    s.scrubRecord = record;
+    long generation = s.scrubHistory->seekTexels(s.scrubHistory->generation(record), mapStaging(s));
+    uploadStaging(s, s.writeTex, 1, stateFormats[s.stateFormat].texType);
+    ostringstream title;
+    title<<"generation "<<generation<<" ("<<record+1<<"/"<<s.scrubHistory->records()<<")";
+    glutSetWindowTitle(title.str().c_str());
+    glutPostRedisplay();
 }
 
 ///Renders the state of the data matrix
 void display() {
+    Simulation::Instance& s = *displayed;
+    TraceScope scope("display", true);
 	//binds drawing target to display
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glViewport(0, 0, s.winSize_x, s.winSize_y);
     // render a full-screen quad textured with the results of our
     // computation.  Note that this is not part of the computation: this
     // is only the visualization of the results.
-    glBegin(GL_QUADS);
-    glTexCoord2f(0.0, 0.0);
-    glVertex2f(0.0, texSize_y);
-    glTexCoord2f(texSize_x, 0.0);
-    glVertex2f(texSize_x, texSize_y);
-    glTexCoord2f(texSize_x, texSize_y);
-    glVertex2f(texSize_x, 0.0);
-    glTexCoord2f(0.0, texSize_y);
-    glVertex2f(0.0, 0.0);
-    glEnd();
+    int shown = s.scrubHistory ? s.writeTex : s.readTex;
+    if (s.backend == HYBRID && !s.scrubHistory) syncHybrid(s);
+    glBindTexture(s.textureParameters.texTarget, s.TexID_A[shown]);
+    if (s.displayProgram) {
+        glUseProgramObjectARB(s.displayProgram);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(s.textureParameters.texTarget, s.paletteTex);
+        glActiveTexture(GL_TEXTURE0);
+    } else {
+        glUseProgramObjectARB(0);
+        glEnable(s.textureParameters.texTarget);
+    }
+    // packed cells: show only the valid part of the last texel
+    float texels_x = (float)s.cells_x/s.cellsPerTexel;
+    if (s.blocks.empty()) {
+        glBegin(GL_QUADS);
+        glTexCoord2f(0.0, 0.0);
+        glVertex2f(0.0, s.texSize_y);
+        glTexCoord2f(texels_x, 0.0);
+        glVertex2f(s.texSize_x, s.texSize_y);
+        glTexCoord2f(texels_x, s.texSize_y);
+        glVertex2f(s.texSize_x, 0.0);
+        glTexCoord2f(0.0, s.texSize_y);
+        glVertex2f(0.0, 0.0);
+        glEnd();
+    } else {
+        //cerr<<"each block draws its part of the matrix, without the halo"<<endl;
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        gluOrtho2D(0.0, s.texSize_x, 0.0, s.texSize_y);
+        glMatrixMode(GL_MODELVIEW);
+        float scale = s.texSize_x/texels_x;
+        for (size_t k=0; k<s.blocks.size(); ++k) {
+            const struct_block& b = s.blocks[k];
+            float w = min((float)b.w, texels_x-b.x);
+            glBindTexture(s.textureParameters.texTarget, b.tex[shown]);
+            glBegin(GL_QUADS);
+            glTexCoord2f(1.0, 1.0);
+            glVertex2f(b.x*scale, s.texSize_y-b.y);
+            glTexCoord2f(w+1, 1.0);
+            glVertex2f((b.x+w)*scale, s.texSize_y-b.y);
+            glTexCoord2f(w+1, b.h+1);
+            glVertex2f((b.x+w)*scale, s.texSize_y-b.y-b.h);
+            glTexCoord2f(1.0, b.h+1);
+            glVertex2f(b.x*scale, s.texSize_y-b.y-b.h);
+            glEnd();
+        }
+    }
+    glDisable(s.textureParameters.texTarget);
+    glFlush();
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fb);
+    glUseProgramObjectARB(s.programObject);
+    glViewport(0, 0, s.texSize_x, s.texSize_y);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, s.fb);
 }
 
-void reshape(int width, int height) {}
+///Keeps track of the window size
+void reshape(int width, int height) {
+    Simulation::Instance& s = *displayed;
+    s.winSize_x = width;
+    s.winSize_y = height;
+}
 }//END NAMESPACE
@@ -8,28 +8,611 @@
 
 // prototypes
 namespace GLCAlib{
+///\brief How the state of each cell is stored on the GPU and in the buffer passed to init
+enum StateFormat {
+    ///4 floats per cell (float buffer), for continuous computations like image processing
+    RGBA32F,
+    ///4 normalized bytes per cell (unsigned char buffer)
+    RGBA8,
+    ///2 normalized bytes per cell (unsigned char buffer)
+    RG8,
+    ///\brief 1 unsigned byte per cell (unsigned char buffer), for discrete automata with up to 256 states
+    ///
+    ///Shaders read texture_A as a usampler2DRect with texture() and write the new state
+    ///to an "out uvec4 state" variable; they need "#version 150 compatibility" to use gl_TexCoord.
+    R8UI,
+    ///1 unsigned int per cell (unsigned int buffer), used by shaders working on bit-packed cells
+    R32UI
+};
+
+///\brief Rules implemented by GLCAlib itself with dedicated kernels
+///
+///compileRule adds further rules after these ones.
+enum BuiltinRule : int {
+    ///Conway's Game of Life, 32 cells are packed in each texel and evolved with bitwise logic
+    CONWAY,
+    ///Wireworld, states are 0 blank, 1 copper, 2 electron head and 3 electron tail
+    WIREWORLD
+};
+
+///\brief How generations are computed on the GPU
+enum Backend {
+    ///a fragment shader runs on a quad covering the whole matrix
+    FRAGMENT,
+    ///\brief the rule runs in an OpenGL 4.3 compute shader over shared memory tiles
+    ///
+    ///Each workgroup reads its tile and a 1 cell halo from the texture only once.
+    ///Rule shaders are the same of the fragment backend, as long as they only read
+    ///texture_A through texture2DRect or texture, at most one cell away.
+    COMPUTE,
+    ///\brief built-in rules only: vectorized kernels run by a pool of CPU threads
+    ///
+    ///Needs no OpenGL at all and never shows a GUI. Runs without GUI also fall back
+    ///to it when no OpenGL context can be created.
+    CPU,
+    ///\brief built-in rules only: the HashLife engine on the CPU, see HashLife
+    ///
+    ///Jumps ahead 2^k generations at a time, so it is the fastest choice for long runs
+    ///of repetitive patterns. Needs a number of iterations and never shows a GUI.
+    HASHLIFE,
+    ///\brief built-in rules only: the GPU and the threads of the CPU backend share the matrix
+    ///
+    ///The GPU computes the first rows with the fragment backend while the CPU computes
+    ///the others, and the two exchange the rows on the split line every generation.
+    ///The split line follows the measured speed of both, see hybrid_gpu_share.
+    HYBRID
+};
+
+///\brief Receives the periodic snapshots of a computation, see engine.snapshot
+///
+///Runs on a worker thread of the library, never on the thread that called init.
+///@param[in] data: the state at that generation, laid out as the buffer passed to init
+///(for built-in rules one byte per cell); only valid until the callback returns\n
+///@param[in] generation: generation of the snapshot\n
+///@param[in] user: engine.snapshot_user
+typedef void (*SnapshotCallback)(const void* data, long generation, void* user);
+
+///\brief Supplies new inputs to a running computation, see engine.input
+///
+///Runs on the thread that called init, between two passes of the GPU.
+///@param[out] data: buffer to fill with the new state, laid out as the buffer passed to init
+///(for built-in rules one byte per cell); it is the staging memory of the upload itself\n
+///@param[in] generation: current generation\n
+///@param[in] user: engine.input_user
+///@return TRUE if data has been filled and replaces the state, FALSE to keep the state as it is
+typedef bool (*InputCallback)(void* data, long generation, void* user);
+
+///\brief Tunables of the computation engine, to be set before calling init
+struct struct_engine {
+    ///\brief GUI refresh policy: target frames per second
+    ///
+    ///As many generations as fit are computed between two frames.
+    ///If 0, the GUI is refreshed every refresh_generations generations.
+    float refresh_fps;
+    ///generations between two refreshes when refresh_fps is 0
+    int refresh_generations;
+    ///RGBA colors used to show R8UI states in the GUI, states without a color are shown as gray levels
+    const float (*palette)[4];
+    ///number of colors in palette
+    int palette_colors;
+    ///\brief how generations are computed
+    ///
+    ///COMPUTE falls back to FRAGMENT when OpenGL 4.3 is not available.
+    Backend backend;
+    ///\brief generations computed by each pass of the COMPUTE backend (temporal blocking)
+    ///
+    ///Each tile is loaded with an halo as wide as steps_per_pass and evolved on chip
+    ///for all of them, so the texture is read and written once every steps_per_pass
+    ///generations. It is limited by the available shared memory, FRAGMENT ignores it.
+    int steps_per_pass;
+    ///threads used by the CPU and HYBRID backends, calling thread included (0 = one per core)
+    int cpu_threads;
+    ///\brief if TRUE the CPU backend stores each bit of the states in a plane of 64 cells per word
+    ///
+    ///The neighbours of 64 cells (256 or 512 with AVX2 or AVX-512) are then counted at once
+    ///with carry-save adders. If FALSE each cell takes one byte.
+    bool cpu_bit_sliced;
+    ///\brief if TRUE the COMPUTE and CPU backends only compute the active tiles
+    ///
+    ///A tile is active when it or one of its 8 neighbours changed in the last pass, the
+    ///others are left as they are. Rules must only depend on the neighbourhood of the cell.
+    bool active_tiles;
+    ///\brief generations between two snapshots of the GPU backends (0 = no snapshots)
+    ///
+    ///The computation stops exactly at each multiple, so it should also be a multiple of
+    ///steps_per_pass. The CPU and HASHLIFE backends take no snapshots.
+    long snapshot_generations;
+    ///called with each snapshot, on a worker thread
+    SnapshotCallback snapshot;
+    ///passed as is to snapshot
+    void* snapshot_user;
+    ///\brief snapshots that can be in flight between the GPU and the callback
+    ///
+    ///The readbacks are queued in a ring of as many pixel buffer objects; the computation
+    ///only waits when all of them are still being read back or processed by the callback.
+    int snapshot_buffers;
+    ///\brief generations between two calls of input (0 = never)
+    ///
+    ///Like snapshot_generations, the computation stops exactly at each multiple. When both
+    ///happen at the same generation the snapshot sees the state before the new input.
+    long input_generations;
+    ///called to stream a new state into the computation, on the thread of init
+    InputCallback input;
+    ///passed as is to input
+    void* input_user;
+    ///\brief RGBA32F only: the buffer passed to init holds 4 normalized bytes per cell instead of 4 floats
+    ///
+    ///The bytes are converted to floats by the upload and back by the readbacks, so 8 bit
+    ///images need no conversion on the CPU and move a quarter of the data. Snapshots and
+    ///inputs use bytes too.
+    bool byte_image;
+    ///\brief generations between two checkpoints of the GPU backends (0 = no checkpoints)
+    ///
+    ///Like snapshot_generations, the computation stops exactly at each multiple.
+    long checkpoint_generations;
+    ///\brief file replaced by each checkpoint, see resume()
+    ///
+    ///Checkpoints are read back like snapshots and packed, compressed and written by the
+    ///snapshot worker, so the computation goes on meanwhile. initMPI writes them too, from
+    ///all the ranks at once and not compressed.
+    const char* checkpoint_file;
+    ///\brief file recording the history of the GPU backends, see History (NULL for none)
+    ///
+    ///The initial state and then one state every history_generations generations are
+    ///read back like snapshots, and the worker stores only the tiles that changed since the
+    ///previous record. With a GUI the space bar pauses the computation to scrub the history.
+    const char* history_file;
+    ///generations between two records of the history, the computation stops exactly at each multiple
+    long history_generations;
+    ///records between two full states (keyframes) of the history, bounding the cost of a seek
+    int history_keyframes;
+    ///\brief largest side of the textures of the GPU backends (0 = the largest the driver supports)
+    ///
+    ///Larger matrices are split into blocks, each with its own pair of textures holding its
+    ///cells and a halo one texel wide, copied from the neighbouring blocks after every
+    ///generation. gl_TexCoord then addresses the textures of the block: shaders that need the
+    ///position of the cell in the matrix add the uniform vec2 glca_offset, if they declare it.
+    ///Split matrices run on the FRAGMENT backend, and their rules must only read the 8 neighbours.
+    int block_size;
+    ///\brief share of the rows the HYBRID backend starts computing on the GPU
+    ///
+    ///Then the split line is moved every few generations so that the GPU, timed with
+    ///GL_TIME_ELAPSED queries, and the CPU threads take the same time per generation.
+    float hybrid_gpu_share;
+    ///\brief if TRUE the two state built-in rules run on their neighbourhood lookup table
+    ///
+    ///The GPU reads the next state of each cell from a table of 512 bits, indexed by its
+    ///3x3 neighbourhood, on one byte per cell. The CPU computes 2x2 cells at once with a
+    ///table of 65536 entries, indexed by their 4x4 neighbourhood. This replaces the
+    ///bit-packed and bit-sliced kernels, rules compiled from a neighbourhood table always run so.
+    bool lookup_table;
+    ///\brief directory of the on-disk cache of the linked programs ("" = no cache)
+    ///
+    ///Each program is stored as given by glGetProgramBinary, keyed by its source and the
+    ///driver, so later runs of the same rule skip the compilation. If NULL the cache is
+    ///$XDG_CACHE_HOME/GLCAlib, or ~/.cache/GLCAlib.
+    const char* program_cache;
+    ///\brief file of the Chrome trace of the computations (NULL for none)
+    ///
+    ///The phases of the computations (setup, uploads, passes, display, readbacks, snapshots)
+    ///are recorded on a timeline, the GPU ones with GL_TIME_ELAPSED queries read without
+    ///waiting, together with samples of counters(). The trace of everything since the start
+    ///of the program is written at the end of each computation; open it in chrome://tracing
+    ///or ui.perfetto.dev. Up to 2^20 events are kept.
+    const char* trace_file;
+};
+///\brief The engine tunables
+///
+///Without GUI nothing is ever displayed and these are ignored.
+extern struct_engine engine;
+
+///\brief Activity of the last computation, see activity()
+struct struct_activity {
+    ///tiles of the matrix in each direction
+    int tiles_x, tiles_y;
+    ///cells of a tile in each direction
+    int tile_width, tile_height;
+    ///tile updates actually computed
+    long long updates;
+    ///tile updates needed to compute every tile at every pass
+    long long total;
+};
+
+///\brief Times of the last computation, in seconds, see timing()
+///
+///Measured with steady_clock: the GPU is waited for at the end of the upload and of the
+///generations, so that each phase holds its own work.
+struct struct_timing {
+    ///generations computed
+    long generations;
+    ///cells of the automaton
+    long long cells;
+    ///context, textures and programs, upload excluded (the CPU backends convert the states here)
+    double setup;
+    ///state uploaded to the textures
+    double upload;
+    ///the generations, snapshots and inputs included
+    double compute;
+    ///GPU time of the generations, between two GL_TIMESTAMP queries (0 without ARB_timer_query or on the CPU)
+    double gpu;
+    ///final state read back
+    double readback;
+    ///the whole computation
+    double total;
+    ///GL_RENDERER of the GPU backends, the instruction set of the CPU ones
+    char renderer[128];
+};
+
+///\brief Work done since the start of the program, see counters()
+struct struct_counters {
+    ///generations computed by all the backends
+    long long generations;
+    ///passes of the GPU backends, each computes one generation or, with COMPUTE, up to steps_per_pass
+    long long passes;
+    ///bytes uploaded to the textures
+    long long uploaded_bytes;
+    ///bytes read back from the textures, snapshots and checkpoints included
+    long long readback_bytes;
+};
+
 ///\brief Initialize OpenGL and executes the given shader
 ///@param[in] arc: number of parameters on the commend line\n
 ///@param[in] argv: holds parameters passed on the commend line\n
-///@param[in] image: buffer containing the input data\n
+///@param[in,out] image: buffer containing the input data, overwritten with the final state; its layout depends on format\n
+///@param[in] x: width of the input
+///@param[in] y: height of the input
+///@param[in] shader: the program executed on the GPU
+///@param[in] gui: if TRUE, visualizes the computation evolution, otherwise runs headless (no window nor X display needed)
+///@param[in] iterations: length of the computation in generations (with the GUI at least 1)
+///@param[in] format: how the state is stored, see StateFormat
+void init(int argc, char** argv, void* image, int x, int y, char* shader, bool gui=true, int iterations=0, StateFormat format=RGBA32F);
+
+///\brief Initialize OpenGL and executes a built-in rule
+///@param[in] argc: number of parameters on the commend line\n
+///@param[in] argv: holds parameters passed on the commend line\n
+///@param[in,out] states: one byte per cell (see BuiltinRule), overwritten with the final state\n
 ///@param[in] x: width of the input
 ///@param[in] y: height of the input
+///@param[in] rule: the built-in rule
+///@param[in] gui: if TRUE, visualizes the computation evolution, otherwise runs headless
+///@param[in] iterations: length of the computation in generations (with the GUI at least 1)
+void init(int argc, char** argv, unsigned char* states, int x, int y, BuiltinRule rule, bool gui=true, int iterations=0);
+
+///\brief Compiles an outer totalistic rule into a built-in rule
+///
+///The kernels of the GPU and of the CPU are generated from the transition table of the
+///rule, as the ones of CONWAY and WIREWORLD: two state rules are bit-packed like CONWAY,
+///the others look their table up on one byte per cell. The rules are numbered in the
+///order they are compiled, which checkpoints and histories of compiled rules rely on.
+///@param[in] rule: a rulestring, "B3/S23" or "23/3" for the Life-like rules and "B2/S/C3"
+///for the Generations rules with C states, in which the cells that do not survive go
+///through the dying states 2 ... C-1 before dying; the program exits if it is not valid
+///@return the new BuiltinRule, valid for the whole program
+BuiltinRule compileRule(const char* rule);
+
+///\brief Compiles the transition table of a rule with up to 256 states
+///@param[in] states: number of states\n
+///@param[in] counted: the state of the neighbours that are counted\n
+///@param[in] next: next[s][n] is the next state of a cell in state s with n counted neighbours
+///@return the new BuiltinRule, valid for the whole program
+BuiltinRule compileRule(int states, int counted, const unsigned char next[][9]);
+
+///\brief Compiles a two state rule given by the next state of each 3x3 neighbourhood
+///
+///The rule need not be totalistic: the neighbours are told apart by their position, so
+///any binary rule of the Moore neighbourhood runs at the same cost (see engine.lookup_table).
+///@param[in] next: next[i] is the next state, 0 or 1, of a cell whose neighbourhood has bit
+///3*(dy+1)+dx+1 of i set when the cell at (dx,dy) from it is alive; bit 4 is the cell itself
+///@return the new BuiltinRule, valid for the whole program
+BuiltinRule compileRule(const unsigned char next[512]);
+
+///\brief Evolves many boards of the same size at once
+///
+///The boards are packed in a matrix, each followed by an empty gutter one texel wide that
+///is never written, so no board sees the others and each behaves as if run alone by init.
+///All the boards are then computed by a single draw per generation, with a single OpenGL
+///context and shader: the cost of the setup is paid once for the whole ensemble.
+///The matrix is at most engine.block_size texels wide and high (8192 if 0), more boards run
+///in further batches. Ensembles run headless on the FRAGMENT backend; snapshots and
+///checkpoints, if any, hold the whole matrix.
+///@param[in] argc: number of parameters on the commend line\n
+///@param[in] argv: holds parameters passed on the commend line\n
+///@param[in,out] boards: count boards one after the other, each laid out as the image of init, overwritten with their final states\n
+///@param[in] count: number of boards
+///@param[in] x: width of each board
+///@param[in] y: height of each board
 ///@param[in] shader: the program executed on the GPU
-///@param[in] gui: if TRUE, visualizes the computation evolution
 ///@param[in] iterations: length of the computation in generations
-void init(int argc, char** argv, float* image, int x, int y, char* shader, bool gui=true, int iterations=0);
+///@param[in] format: how the states are stored, see StateFormat
+void initEnsemble(int argc, char** argv, void* boards, int count, int x, int y, char* shader, int iterations, StateFormat format=RGBA32F);
+
+///\brief Evolves many boards of the same size at once with a built-in rule
+///
+///As the other initEnsemble, CONWAY boards are packed 32 cells per texel each. With the CPU
+///and HASHLIFE backends, which have no setup to share, the boards run one after the other.
+///@param[in,out] boards: count boards of one byte per cell one after the other (see BuiltinRule), overwritten with their final states
+void initEnsemble(int argc, char** argv, unsigned char* boards, int count, int x, int y, BuiltinRule rule, int iterations);
+
+///\brief Activity of the last computation run by init
+///
+///With engine.active_tiles updates/total is the fraction of the matrix that had to be
+///computed; without it, or with the FRAGMENT backend, every tile is always updated.
+///@param[out] map: if not NULL, filled with tiles_x*tiles_y bytes (row by row), 1 for the
+///tiles that changed in the last pass
+///@return the activity of the last computation
+struct_activity activity(unsigned char* map=NULL);
+
+///\brief Times of the last computation run by init (or by each board of initEnsemble, on the CPU)
+///@return the times of the last computation, by phase
+struct_timing timing();
+
+///\brief Work done since the start of the program, by all the computations
+///@return the generations, passes and bytes moved so far
+struct_counters counters();
+
+///\brief Identity of a checkpoint file, see engine.checkpoint_file
+struct struct_checkpoint {
+    ///cells in each direction
+    int x, y;
+    ///generation of the state
+    long generation;
+    ///how the state is stored
+    StateFormat format;
+    ///the BuiltinRule, -1 for shaders
+    int rule;
+};
+
+///\brief Reads the identity of a checkpoint
+///@return FALSE if filename is missing or is not a checkpoint
+bool checkpointInfo(const char* filename, struct_checkpoint* info);
+
+///\brief Resumes the computation of the given shader from a checkpoint
+///
+///The state is decompressed straight into the staging buffer of the textures. The
+///checkpoint must have been written by the same shader, size and format.
+///@param[in] argc, argv, x, y, shader, gui, format: as for init\n
+///@param[in] checkpoint: the checkpoint file\n
+///@param[out] image: buffer receiving the final state, laid out as for init\n
+///@param[in] iterations: generation at which the computation ends, as given to the interrupted init
+///@return the generation of the checkpoint
+long resume(int argc, char** argv, const char* checkpoint, void* image, int x, int y, char* shader, bool gui=true, int iterations=0, StateFormat format=RGBA32F);
+
+///\brief Resumes the computation of a built-in rule from a checkpoint
+///
+///The CPU and HASHLIFE backends can resume checkpoints written on the GPU too.
+///@param[in] argc, argv, x, y, rule, gui: as for init\n
+///@param[in] checkpoint: the checkpoint file\n
+///@param[out] states: one byte per cell, receiving the final state\n
+///@param[in] iterations: generation at which the computation ends, as given to the interrupted init
+///@return the generation of the checkpoint
+long resume(int argc, char** argv, const char* checkpoint, unsigned char* states, int x, int y, BuiltinRule rule, bool gui=true, int iterations=0);
+
+///\brief Rows of the matrix owned by this rank in the MPI mode, see initMPI
+///@param[in] y: height of the matrix\n
+///@param[out] first: first row of the slab\n
+///@param[out] rows: rows in the slab
+void slabRows(int y, int* first, int* rows);
+
+///\brief Runs a built-in rule on a matrix split in slabs of rows among the ranks of MPI_COMM_WORLD
+///
+///Only in libGLCAmpi.a, built by make mpi; MPI must be initialized. Each rank evolves its
+///slab with the kernels of the CPU backend, on engine.cpu_threads threads, and exchanges
+///its first and last rows with the neighbouring ranks every generation, computing the
+///interior rows while the messages travel. With engine.checkpoint_file and
+///engine.checkpoint_generations set all the ranks write their rows to the same checkpoint
+///with MPI-IO.
+///@param[in,out] slab: the rows given by slabRows, one byte per cell, overwritten with the final state\n
+///@param[in] x: width of the matrix\n
+///@param[in] y: height of the matrix, at least one row per rank\n
+///@param[in] rule: the built-in rule\n
+///@param[in] iterations: length of the computation in generations
+void initMPI(unsigned char* slab, int x, int y, BuiltinRule rule, long iterations);
+
+///\brief Resumes initMPI from a checkpoint, written by the MPI mode or by init
+///@param[in] checkpoint: the checkpoint file\n
+///@param[out] slab: the rows given by slabRows, receiving the final state\n
+///@param[in] x, y, rule: as for initMPI\n
+///@param[in] iterations: generation at which the computation ends, as given to the interrupted initMPI
+///@return the generation of the checkpoint
+long resumeMPI(const char* checkpoint, unsigned char* slab, int x, int y, BuiltinRule rule, long iterations);
+
+///\brief Converts an RGBA image to cell states, for the R8UI format
+///@param[in] image: RGBA image normalized between 0 and 1\n
+///@param[out] states: one byte per cell, index of the matching palette color (0 if none matches)\n
+///@param[in] cells: number of cells (x*y)\n
+///@param[in] palette: RGBA colors of the states\n
+///@param[in] colors: number of states in the palette
+void encodeStates(const float* image, unsigned char* states, int cells, const float palette[][4], int colors);
+
+///\brief Converts cell states back to an RGBA image
+///@param[in] states: one byte per cell, index of a palette color\n
+///@param[out] image: RGBA image normalized between 0 and 1\n
+///@param[in] cells: number of cells (x*y)\n
+///@param[in] palette: RGBA colors of the states\n
+///@param[in] colors: number of states in the palette
+void decodeStates(const unsigned char* states, float* image, int cells, const float palette[][4], int colors);
 
 ///\brief Loads an RGBA image from the file imname to the given buffer
+///
+///The file is memory mapped and converted to floats with vector instructions; pixels
+///beyond the end of the file are zeros.
 ///@param[in] buffer: a buffer for storing the image\n
 ///@param[in] imname: the name of the image to load\n
 ///@param[in] length: size of the image (4*x*y being RGBA)
-void loadImage(float* buffer, char* imname, int length);
+void loadImage(float* buffer, char* imname, long length);
+
+///\brief Loads an RGBA image as it is, one byte per channel (for RGBA8 or engine.byte_image)
+void loadImage(unsigned char* buffer, char* imname, long length);
 
 ///\brief Saves an RGBA image to the file imname
+///
+///Values are clipped between 0 and 1 while converting, the buffer is left untouched.
 ///@param[in] buffer: the image content\n
 ///@param[in] imname: the name of the file where the image will be saved\n
 ///@param[in] length: size of the image (4*x*y being RGBA)
-void saveImage(float* buffer, char* imname, int length);
+void saveImage(const float* buffer, char* imname, long length);
+
+///\brief Saves an RGBA image of one byte per channel
+void saveImage(const unsigned char* buffer, char* imname, long length);
+
+///\brief Converts bytes to floats between 0 and 1, as loadImage does
+void bytesToFloats(const unsigned char* in, float* out, long length);
+
+///\brief Converts floats to bytes, clipping them between 0 and 1, as saveImage does
+void floatsToBytes(const float* in, unsigned char* out, long length);
+
+///\brief Maps an RGBA file in memory, to pass its bytes to init without copies
+///
+///The states are then uploaded straight from the page cache (use RGBA8, or RGBA32F with
+///engine.byte_image) and the final state is written back into the mapping.
+///@param[in] imname: the file to map\n
+///@param[in] length: bytes of the image (4*x*y being RGBA)\n
+///@param[in] write: if TRUE the file is created or extended as needed and the changes to
+///the buffer end up in it, otherwise they stay in memory (copy on write)
+///@return the mapped bytes, to be released with unmapImage
+unsigned char* mapImage(char* imname, long length, bool write=false);
+
+///\brief Releases a buffer given by mapImage, the changes of a written map reach its file
+void unmapImage(unsigned char* buffer, long length);
+
+///\brief HashLife universe of a built-in rule
+///
+///The automaton is stored as a quadtree of canonical nodes: equal squares of cells are
+///the same node (hash-consing) and the future of each node is memoized, so repeated
+///structures are computed once and the universe can jump 2^k generations at a time.\n
+///The universe is unbounded: cells outside the loaded window are blank and may change.
+///This is exact for WIREWORLD, whose blank cells never change; CONWAY matches the
+///bounded matrix of the GPU as long as the pattern does not reach its border.
+///Compiled rules whose blank cells are born with no neighbours (B0) are not supported.
+class HashLife {
+public:
+    ///@param[in] rule: the built-in rule\n
+    ///@param[in] maxNodes: nodes kept in memory before memoized results are dropped
+    HashLife(BuiltinRule rule, long maxNodes=1<<23);
+    ~HashLife();
+
+    ///\brief Replaces the universe with a window of states, whose top-left cell is at (0,0)
+    ///@param[in] states: one byte per cell (see BuiltinRule)\n
+    ///@param[in] x: width of the window\n
+    ///@param[in] y: height of the window
+    void load(const unsigned char* states, int x, int y);
+    ///\brief Replaces the universe with an RGBA image, see encodeStates
+    void load(const float* image, int x, int y, const float palette[][4], int colors);
+    ///\brief Copies the window of x*y cells whose top-left cell is at (0,0)
+    void save(unsigned char* states, int x, int y) const;
+    ///\brief Copies the window of x*y cells as an RGBA image, see decodeStates
+    void save(float* image, int x, int y, const float palette[][4], int colors) const;
+
+    ///\brief Advances the universe by 2^k generations
+    void step(int k);
+    ///\brief Advances the universe by any number of generations, one step for each bit set
+    void run(long long generations);
+    ///@return the generations computed since the last load
+    long long generation() const;
+    ///@return the nodes currently in memory
+    long nodes() const;
+    ///\brief Frees the nodes no longer reachable from the universe
+    void collect();
+
+private:
+    struct Universe;
+    Universe* universe;
+    HashLife(const HashLife&);
+    HashLife& operator=(const HashLife&);
+};
+
+///\brief Reader of the history recorded through engine.history_file
+///
+///The file holds keyframes, the full state every engine.history_keyframes records, and
+///in between deltas with the tiles that changed since the previous record, followed by an
+///index of the records (rebuilt by scanning the file if the recording was interrupted).
+class History {
+public:
+    ///@param[in] filename: the history file, the program exits if it is not one
+    History(const char* filename);
+    ~History();
+
+    ///@return the width of the automaton in cells
+    int width() const;
+    ///@return the height of the automaton in cells
+    int height() const;
+    ///@return the number of records
+    long records() const;
+    ///@return the generation of a record
+    long generation(long record) const;
+    ///@return the bytes written by seek
+    long stateBytes() const;
+
+    ///\brief Rebuilds the state of the last record not after a generation
+    ///
+    ///Moving forward applies the deltas from the current record, moving back starts again
+    ///from the closest keyframe.
+    ///@param[in] generation: the generation to look for\n
+    ///@param[out] data: stateBytes() bytes, laid out as the buffer passed to init (one byte
+    ///per cell for built-in rules, floats for RGBA32F even with engine.byte_image)
+    ///@return the generation of the state, -1 if the recording starts later
+    long seek(long generation, void* data);
+    ///\brief As seek, but gives the texels of the texture (built-in CONWAY packs 32 cells in each)
+    long seekTexels(long generation, void* texels);
+
+private:
+    struct Recording;
+    Recording* recording;
+    History(const History&);
+    History& operator=(const History&);
+};
+
+///\brief An automaton that lives on the GPU between calls
+///
+///Unlike init, which runs a whole computation, a Simulation keeps its textures and program
+///and is advanced, read and written at will. All the simulations share one headless
+///context, created by the first and released by the last, and a cache of linked programs,
+///so equal rules are compiled once. The simulations and init may be interleaved freely
+///but only from one thread, the one that owns the context.\n
+///engine.backend selects FRAGMENT or COMPUTE (any other backend runs on FRAGMENT) and
+///engine.steps_per_pass, active_tiles, byte_image and block_size apply as for init;
+///snapshots, checkpoints, history and input are not taken, read() and write() replace them.
+class Simulation {
+public:
+    ///@param[in] image: the initial state, laid out as the buffer passed to init\n
+    ///@param[in] x: width of the matrix\n
+    ///@param[in] y: height of the matrix\n
+    ///@param[in] shader: the rule, copied\n
+    ///@param[in] format: how the state is stored, see StateFormat
+    Simulation(const void* image, int x, int y, char* shader, StateFormat format=RGBA32F);
+    ///\brief A simulation of a built-in rule, CONWAY packs 32 cells in each texel as init does
+    ///@param[in] states: one byte per cell (see BuiltinRule)
+    Simulation(const unsigned char* states, int x, int y, BuiltinRule rule);
+    ~Simulation();
+
+    ///\brief Computes the next generations
+    ///@return the generation reached
+    long step(long generations=1);
+    ///\brief Copies the current state, laid out as the buffer given to the constructor
+    void read(void* image);
+    ///\brief Replaces the current state, the generation is left as it is
+    void write(const void* image);
+    ///\brief Replaces the rule, keeping state, textures and context
+    ///
+    ///The new shader sees the texels of the simulation, for built-in CONWAY 32 cells each.
+    void set_rule(char* shader);
+    ///@return the generations computed since the simulation was created
+    long generation() const;
+    ///@return the width of the automaton in cells
+    int width() const;
+    ///@return the height of the automaton in cells
+    int height() const;
+
+    ///\brief The state of a computation, defined in GLCAlib.cpp
+    ///
+    ///init runs on an instance of its own, so it never touches the simulations.
+    struct Instance;
+
+private:
+    Instance* instance;
+    Simulation(const Simulation&);
+    Simulation& operator=(const Simulation&);
+};
 }
 
 #endif
@@ -54,24 +637,52 @@ My code is heavily based on two well known tutorials [3,4] available on the inte
 \subsection dev Platforms and Dependencies.
 The library was developed on Linux using standard C but there should not be any problem compiling the code under different operating systems such as MS windows.\n
 To simplify OpenGL management I used freeGLUT [5] and an extension loader named GLEW [6]. I preferred freeGLUT over the most famous GLUT because it gives better control over the application lifecycle introducing the function glutLeaveMainLoop().\n
-Both this library are free and multiplatform.
+Both this library are free and multiplatform.\n
+Runs without GUI create their OpenGL context through EGL [14], so they can be launched on servers without a display and with software renderers like Mesa llvmpipe.
 
-related files: GLCAlib.h GLCAlib.cpp
+related files: GLCAlib.h GLCAlib.cpp GLCAcpu.h GLCAcpu.cpp GLCAhash.cpp GLCAio.h GLCAio.cpp GLCAhist.cpp GLCAmpi.cpp
 
 \subsection using Using the library.
 Using the library to develop custom accelerated CA is very simple, the function init takes care of everything\n\n
-void init(int argc, char** argv, float* image, int x, int y, char* shader, bool gui=true, int iterations=0);\n\n
+void init(int argc, char** argv, void* image, int x, int y, char* shader, bool gui=true, int iterations=0, StateFormat format=RGBA32F);\n\n
 it takes as input a number of parameters to control automaton creation:\n
 -argc: number of parameters on the commend line\n
 -argv: holds parameters passed on the commend line\n
--image: buffer containing the input data in RGBA format normalized between 0 and 1\n
+-image: buffer containing the input data, in RGBA format normalized between 0 and 1 for the default format\n
 -x: width of the input\n
 -y: height of the input\n
 -shader: the fragment shader program to be executed on the GPU, takes care of CA evolution step\n
--gui: if TRUE, visualizes the computation evolution\n
+-gui: if TRUE, visualizes the computation evolution, otherwise the computation runs headless on an EGL context and needs no X display\n
 -iterations: length of the computation (in generations)\n
-
-Image can be loaded and saved to RGBA files using two trivial functions: loadImage and saveImage.\n
+-format: how cells are stored on the GPU: RGBA32F (default), RGBA8, RG8 or R8UI\n
+
+Discrete automata should use the R8UI format: each cell takes a single byte holding the index of its state, which cuts texture memory and bandwidth by 16 times.
+The functions encodeStates and decodeStates convert between RGBA images and states through a palette of colors, that the GUI can show through engine.palette.\n
+
+The rule can also run as a compute shader setting engine.backend to COMPUTE (OpenGL 4.3 is needed): each workgroup loads a tile of cells with its halo in shared memory once, instead of fetching the neighbourhood of each cell from the texture.\n
+With engine.steps_per_pass set to k the tiles get a halo k cells wide and are evolved k generations before being written back, which cuts the texture traffic about k times.\n
+
+Some common automata are also available as built-in rules, run by a second version of init that takes a BuiltinRule instead of the shader:\n\n
+void init(int argc, char** argv, unsigned char* states, int x, int y, BuiltinRule rule, bool gui=true, int iterations=0);\n\n
+The built-in CONWAY rule packs 32 cells in each texel and computes them at once with bitwise adders, WIREWORLD runs the GLwworld rule on single byte states.\n
+With engine.backend set to CPU the built-in rules run on a pool of engine.cpu_threads threads, with AVX2 or AVX-512 kernels on bit-sliced states when the processor has them. Runs without GUI use this backend when no OpenGL context is available.\n
+With engine.active_tiles (the default) the COMPUTE and CPU backends compute only the tiles that changed in the last pass, or that have a neighbour that did, see activity.\n
+With engine.snapshot_generations set the GPU backends copy the state into a ring of pixel buffers every so many generations, and a worker thread hands each copy to engine.snapshot while the computation goes on.\n
+States are uploaded with glTexSubImage2D from a mapped pixel buffer: engine.byte_image uploads 8 bit images as they are, and engine.input streams new states into a running computation.\n
+With engine.checkpoint_file set the state is saved, compressed with zlib [16], every engine.checkpoint_generations generations, and resume restarts the computation from it.\n
+initMPI, in libGLCAmpi.a built by make mpi, splits a built-in rule among MPI ranks in slabs of rows, that exchange their boundary rows every generation and write their checkpoints together with MPI-IO. The sample GLwworldMPI runs the Wireworld computer this way.\n
+engine.history_file records the tiles that changed every engine.history_generations generations: the class History reads back any recorded generation, and in the GUI the space bar pauses the computation and the arrow keys scrub through the records.\n
+Matrices larger than the biggest texture, or than engine.block_size, are split in blocks whose halos are exchanged after every generation, so the rule still sees a single matrix.\n
+With engine.backend set to HYBRID the GPU computes the first rows of a built-in rule and the CPU threads the others, and a load balancer moves the split so that both finish together.\n
+initEnsemble evolves many small boards packed in a single matrix, each followed by an empty gutter, with a single draw call per generation.\n
+compileRule turns other rules into built-in rules: rulestrings like "B36/S23" or "B2/S/C3", transition tables of up to 256 states, or the next state of each of the 512 neighbourhoods of a two state rule, that runs on a lookup table like the totalistic ones with engine.lookup_table.\n
+The class Simulation keeps its automaton on the GPU between the calls to step, read and write, so a program can drive one or more automata step by step.\n
+Linked programs are cached on disk in engine.program_cache, by source and driver, so later runs skip the compilation.\n
+timing() returns the times of each phase of the last computation, and the sample GLbench, run by make bench, writes them for each backend and size to a JSON file.\n
+counters() returns the work done so far, and with engine.trace_file set every phase is written to a Chrome trace, the GPU ones timed by timer queries.\n
+Very long runs of the built-in rules can use the HashLife algorithm [15], through the class HashLife or setting engine.backend to HASHLIFE. Its universe is unbounded, so CONWAY gives the results of the bounded matrix only as long as the pattern does not reach its border.\n
+
+Image can be loaded and saved to RGBA files using two functions: loadImage and saveImage. Files are memory mapped and converted with vector instructions, or mapped as they are by mapImage and passed to init without any copy.\n
 You may want to use other image formats, this can easily be done using some external library like MagickCore [7] or CImg [8].
 
 related files: GLCAlib.h
@@ -79,12 +690,13 @@ related files: GLCAlib.h
 \subsection graphic Graphical display of data.
 Because of the presence of the data into the graphic adapter memory, displaying it on screen requires little effort and can be done efficiently, this reason candidates GPGPU for physical realtime simulations both in videogames and in scientific computation.\n
 Manage visualization could require the execution of a second fragment shader program, In my implementation I limited this feature to raw visualization of data (usefull also for debugging).
+By default the GUI is refreshed 60 times per second and computes as many generations as fit between two frames, see engine.refresh_fps and engine.refresh_generations.
 
 \section sample_sec Sample program: Wireworld Computer
 Wireworld [9] is a cellular automaton invented by Brian Silverman in about 1984.\n
 It can simulate electronic circuits and is actually Turing-complete [10].\n
 
-related files: GLwworld.cpp
+related files: GLwworld.cpp GLwworldMPI.cpp
 
 \subsection wwrules Wireworld Description
 The cells of the automaton can be in one of four different states, forming a pattern on the grid. The four states are:\n
@@ -113,10 +725,20 @@ Param 3: problem size x\n
 Param 4: problem size y\n
 Param 5: 0 = no comparison of results, 1 = compare GPU vs CPU\n
 Param 6: number of iterations\n
-Param 7: 0 = no GUI, 1 = GUI
+Param 7: 0 = no GUI, 1 = GUI\n
+Param 8 (optional): 0 = fragment shader backend, 1 = compute shader backend, 2 = CPU backend (built-in rule), 3 = HashLife (built-in rule), 4 = GPU and CPU together (built-in rule)\n
+Param 9 (optional): generations per pass of the compute shader backend\n
+Param 10 (optional): checkpoint file of the GPU backends, the run resumes from it if it exists\n
+Param 11 (optional): generations between two checkpoints (default 100000)
 
 The included shell script GLwworld.sh runs the program with some default parameters and compares GPU and CPU performances, running the program without a GUI gives better speed results.
 
+make mpi builds GLwworldMPI, which runs the same automaton split among MPI ranks, e.g. mpirun -np 4 ./GLwworldMPI img/in/wworld.rgba img/out/wworld.rgba 800 600 300:\n
+Param 1 to 4: as for GLwworld\n
+Param 5: number of iterations\n
+Param 6 (optional): checkpoint file, resumed if it exists\n
+Param 7 (optional): generations between two checkpoints (default 100000)
+
 related files: GLwworld.sh
  
 \section conway Sample program: Conway's Game of Life
@@ -144,7 +766,9 @@ Param 3: problem size x\n
 Param 4: problem size y\n
 Param 5: 0 = no comparison of results, 1 = compare GPU vs CPU\n
 Param 6: number of iterations\n
-Param 7: 0 = no GUI, 1 = GUI
+Param 7: 0 = no GUI, 1 = GUI\n
+Param 8 (optional): 0 = GLSL shader, 1 = bit-packed built-in rule, 2 = built-in rule on the CPU backend, 3 = built-in rule on HashLife, 4 = built-in rule shared by the GPU and the CPU, 5 = built-in rule on its lookup table\n
+Param 9 (optional): rulestring of a Life-like rule run by the built-in rule in place of Conway's one, as B36/S23 for HighLife
 
 The included shell script GLconway.sh runs the program with some default parameters and compares GPU and CPU performances, running the program without a GUI gives better speed results.
 
@@ -164,6 +788,7 @@ Param 1: Filename of the input RGBA image\n
 Param 2: Filename of the input RGBA image\n
 Param 3: problem size x\n
 Param 4: problem size y\n
+Param 5 (optional): 0 = fragment shader backend, 1 = compute shader backend\n
 
 The included shell script GLblur.sh runs the program with some default parameters.\n
 A filter like this can be probably used in real-time over a video sequence.
@@ -227,4 +852,13 @@ http://trolltech.com/
 
 [13] Doxygen multilanguage documentation system.\n
 http://www.stack.nl/~dimitri/doxygen/
+
+[14] EGL native platform interface.\n
+https://www.khronos.org/egl
+
+[15] R. W. Gosper, Exploiting regularities in large cellular spaces, Physica D 10 (1984).\n
+http://en.wikipedia.org/wiki/Hashlife
+
+[16] zlib compression library.\n
+https://zlib.net/
 */
@@ -0,0 +1,218 @@
+///\file GLCAmpi.cpp
+///\brief Distributed mode of GLCAlib: built-in rules on a matrix split among MPI ranks.
+///
+///Each rank owns a slab of consecutive rows and evolves it with the kernels of the CPU
+///backend. The boundary rows travel to the neighbouring ranks with non-blocking messages
+///while the interior rows are computed, and checkpoints are written by all the ranks at
+///once with MPI-IO. Built by make mpi, with mpicxx, into libGLCAmpi.a.
+
+// includes
+#include <mpi.h>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "GLCAlib.h"
+#include "GLCAcpu.h"
+#include "GLCAio.h"
+
+using namespace std;
+namespace GLCAlib {
+///rows computed by each task of the thread pool
+const int slabBandRows = 16;
+
+///\brief Stops all the ranks, rank 0 tells why
+void abortMPI(const string& message) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0) cout<<message<<endl;
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+void slabRows(int y, int* first, int* rows) {
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    *first = (int)((long)y*rank/ranks);
+    *rows = (int)((long)y*(rank+1)/ranks) - *first;
+}
+
+///\brief Writes the slabs of all the ranks to a checkpoint (collective)
+///
+///Rank 0 writes the header and each rank its rows at their place in the file. As for
+///saveCheckpoint, the file replaces the previous checkpoint only once complete.
+///@param[in] cells: first cell of the slab, in rows of x+2 cells
+void saveSlabs(const char* filename, const struct_checkpointHeader& header, const unsigned char* cells, int first, int rows) {
+    //cerr<<"Inside saveSlabs "<<filename<<endl;
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    string temporary = string(filename)+".tmp";
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, (char*)temporary.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+        abortMPI("Can not create "+temporary);
+    MPI_File_set_size(file, 0);
+    if (rank == 0) MPI_File_write_at(file, 0, (void*)&header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    //cerr<<"the rows of the slab without their border"<<endl;
+    MPI_Datatype slab;
+    MPI_Type_vector(rows, header.x, header.x+2, MPI_BYTE, &slab);
+    MPI_Type_commit(&slab);
+    int status = MPI_File_write_at_all(file, sizeof(header)+(MPI_Offset)first*header.x, (void*)cells, 1, slab, MPI_STATUS_IGNORE);
+    MPI_Type_free(&slab);
+    MPI_File_sync(file);
+    MPI_File_close(&file);
+    if (status != MPI_SUCCESS) abortMPI("Can not write "+temporary);
+    if (rank == 0 && rename(temporary.c_str(), filename) != 0) abortMPI("Can not replace "+string(filename));
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+///\brief Reads the rows of this rank from a checkpoint (collective)
+///
+///Checkpoints of the MPI mode are read by all the ranks at once, the compressed ones
+///written by init are inflated by rank 0, which sends each rank the texels of its rows.
+///@param[out] cells: first cell of the slab, in rows of x+2 cells
+///@return the generation of the checkpoint
+long loadSlabs(const char* filename, unsigned char* cells, int x, int y, BuiltinRule rule, int first, int rows) {
+    //cerr<<"Inside loadSlabs "<<filename<<endl;
+    struct_checkpointHeader header;
+    if (!loadCheckpointHeader(filename, &header)) abortMPI(string(filename)+" is not a checkpoint");
+    if (header.rule != rule || header.x != x || header.y != y) abortMPI(string(filename)+" was written by another rule or size");
+    if (header.compressedBytes != 0) {
+        int rank, ranks;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+        //cerr<<"sent in texel rows, a count of bytes could overflow an int"<<endl;
+        int rowBytes = (int)(header.texelBytes/y);
+        MPI_Datatype row;
+        MPI_Type_contiguous(rowBytes, MPI_BYTE, &row);
+        MPI_Type_commit(&row);
+        vector<unsigned char> texels;
+        vector<int> counts, offsets;
+        if (rank == 0) {
+            texels.resize(header.texelBytes);
+            loadCheckpoint(filename, header, &texels[0]);
+            counts.resize(ranks);
+            offsets.resize(ranks);
+            //cerr<<"the rows of each rank, as given by slabRows"<<endl;
+            for (int r=0; r<ranks; ++r) {
+                offsets[r] = (int)((long)y*r/ranks);
+                counts[r] = (int)((long)y*(r+1)/ranks) - offsets[r];
+            }
+        }
+        vector<unsigned char> slab((size_t)rowBytes*rows);
+        MPI_Scatterv(rank == 0 ? &texels[0] : NULL, rank == 0 ? &counts[0] : NULL, rank == 0 ? &offsets[0] : NULL, row,
+                     &slab[0], rows, row, 0, MPI_COMM_WORLD);
+        MPI_Type_free(&row);
+        const unsigned int* words = (const unsigned int*)&slab[0];
+        for (int i=0; i<rows; ++i)
+            for (int j=0; j<x; ++j)
+                cells[(size_t)(x+2)*i+j] = header.format == R32UI ? (words[header.texels_x*i+j/32]>>(j%32)) & 1
+                                                                   : slab[(size_t)x*i+j];
+        return header.generation;
+    }
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, (char*)filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+        abortMPI("Can not open "+string(filename));
+    MPI_Datatype slab;
+    MPI_Type_vector(rows, x, x+2, MPI_BYTE, &slab);
+    MPI_Type_commit(&slab);
+    int status = MPI_File_read_at_all(file, sizeof(header)+(MPI_Offset)first*x, cells, 1, slab, MPI_STATUS_IGNORE);
+    MPI_Type_free(&slab);
+    MPI_File_close(&file);
+    if (status != MPI_SUCCESS) abortMPI(string(filename)+" is corrupted");
+    return header.generation;
+}
+
+///\brief Body of initMPI and resumeMPI
+///@param[in] checkpoint: the checkpoint to resume, NULL for a new computation
+///@return the generation the computation starts from
+long runSlabs(const char* checkpoint, unsigned char* slab, int x, int y, BuiltinRule rule, long iterations) {
+    //cerr<<"Inside runSlabs"<<endl;
+    int rank, ranks, first, rows;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    if (y < ranks) abortMPI("The matrix has fewer rows than ranks");
+    slabRows(y, &first, &rows);
+    ThreadPool pool(engine.cpu_threads);
+    const char* isa;
+    RowKernel kernel = cpuKernel(rule, &isa);
+    const struct_rule& table = ruleTable(rule);
+
+    //cerr<<"the slab with a zero border, its first and last rows are the halos"<<endl;
+    size_t w = (size_t)x+2;
+    vector<unsigned char> bufferA(w*(rows+2), 0), bufferB(w*(rows+2), 0);
+    unsigned char* A = &bufferA[0];
+    unsigned char* B = &bufferB[0];
+    long generation = 0;
+    if (checkpoint)
+        generation = loadSlabs(checkpoint, A+w+1, x, y, rule, first, rows);
+    else
+        for (int i=0; i<rows; ++i)
+            for (int j=0; j<x; ++j) {
+                unsigned char c = slab[(size_t)x*i+j];
+                A[w*(i+1)+j+1] = table.states == 2 ? c!=0 : c;
+            }
+    long start = generation;
+    if (rank == 0) {
+        cout<<"MPI - "<<isa<<" - "<<ranks<<" ranks of "<<pool.size()<<" threads, x="<<x<<", y="<<y<<", numIter="<<iterations<<endl;
+        if (checkpoint) cout<<"Resumed from generation "<<generation<<endl;
+    }
+
+    struct_checkpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.version = 1;
+    header.format = R8UI;
+    header.rule = rule;
+    header.bits = 8;
+    header.x = header.texels_x = x;
+    header.y = y;
+    header.texelBytes = header.packedBytes = (uint64_t)x*y;
+    bool checkpointing = engine.checkpoint_file != NULL && engine.checkpoint_generations > 0;
+
+    //cerr<<"the first and the last rank have a zero halo outside the matrix"<<endl;
+    int up = rank > 0 ? rank-1 : MPI_PROC_NULL;
+    int down = rank < ranks-1 ? rank+1 : MPI_PROC_NULL;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    while (generation < iterations) {
+        MPI_Request requests[4];
+        MPI_Irecv(A, (int)w, MPI_BYTE, up, 0, MPI_COMM_WORLD, &requests[0]);
+        MPI_Irecv(A+w*(rows+1), (int)w, MPI_BYTE, down, 1, MPI_COMM_WORLD, &requests[1]);
+        MPI_Isend(A+w, (int)w, MPI_BYTE, up, 1, MPI_COMM_WORLD, &requests[2]);
+        MPI_Isend(A+w*rows, (int)w, MPI_BYTE, down, 0, MPI_COMM_WORLD, &requests[3]);
+
+        //cerr<<"the interior rows do not need the halos"<<endl;
+        int interior = rows-2;
+        pool.parallelFor((interior+slabBandRows-1)/slabBandRows, [&](int band) {
+            for (int i = 2+band*slabBandRows; i < rows && i < 2+(band+1)*slabBandRows; ++i) {
+                size_t row = w*i+1;
+                kernel(A+row-w, A+row, A+row+w, B+row, x, table);
+            }
+        });
+        MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+        kernel(A+1, A+w+1, A+2*w+1, B+w+1, x, table);
+        if (rows > 1) kernel(A+w*(rows-1)+1, A+w*rows+1, A+w*(rows+1)+1, B+w*rows+1, x, table);
+
+        swap(A, B);
+        ++generation;
+        if (checkpointing && generation % engine.checkpoint_generations == 0) {
+            header.generation = generation;
+            saveSlabs(engine.checkpoint_file, header, A+w+1, first, rows);
+        }
+    }
+    double total = chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    if (rank == 0 && total > 0) cout<<"MPI Iterations/sec: "<<(long)((generation-start)/total)<<endl;
+
+    for (int i=0; i<rows; ++i) memcpy(slab+(size_t)x*i, A+w*(i+1)+1, x);
+    return start;
+}
+
+void initMPI(unsigned char* slab, int x, int y, BuiltinRule rule, long iterations) {
+    runSlabs(NULL, slab, x, y, rule, iterations);
+}
+
+long resumeMPI(const char* checkpoint, unsigned char* slab, int x, int y, BuiltinRule rule, long iterations) {
+    return runSlabs(checkpoint, slab, x, y, rule, iterations);
+}
+}
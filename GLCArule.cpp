@@ -0,0 +1,161 @@
+///\file GLCArule.cpp
+///\brief Rule compiler of GLCAlib.
+///
+///Turns rulestrings and transition tables of outer totalistic rules into built-in rules:
+///the GPU and CPU kernels of every built-in rule are generated from the same table, so
+///the engines can not disagree on what the rule does.
+
+//includes
+#include <iostream>
+#include <cstdlib>
+#include <cctype>
+#include <string>
+#include <deque>
+#include "GLCAlib.h"
+#include "GLCArule.h"
+
+using namespace std;
+namespace GLCAlib {
+///\brief Fills the derived fields of a table and adds it to the built-in rules
+///@return its BuiltinRule
+BuiltinRule addRule(deque<struct_rule>& rules, struct_rule rule) {
+    if (!rule.totalistic) {
+        rules.push_back(rule);
+        return (BuiltinRule)(rules.size()-1);
+    }
+    rule.rows.assign(16*rule.states, 0);
+    for (int s=0; s<rule.states; ++s)
+        for (int n=0; n<9; ++n) rule.rows[16*s+n] = rule.next[9*s+n];
+    rule.life = 0;
+    if (rule.states == 2) {
+        for (int n=0; n<9; ++n) {
+            //cerr<<"n live neighbours are n or 8-n counted ones"<<endl;
+            int k = rule.counted == 1 ? n : 8-n;
+            if (rule.next[k]) rule.life |= 1u<<n;
+            if (rule.next[9+k]) rule.life |= 1u<<(9+n);
+        }
+        rule.neighbourhood.resize(512);
+        for (int i=0; i<512; ++i) {
+            int live = __builtin_popcount(i & ~16), c = (i>>4) & 1;
+            rule.neighbourhood[i] = (rule.life >> (live + 9*c)) & 1;
+        }
+    }
+    rules.push_back(rule);
+    return (BuiltinRule)(rules.size()-1);
+}
+
+///\brief Table of a Generations rule: the cells that do not survive count down the dying states
+///@param[in] life: births and survivals, see struct_rule::life\n
+///@param[in] states: 2 for the Life-like rules
+struct_rule generationsRule(uint32_t life, int states) {
+    struct_rule rule;
+    rule.states = states;
+    rule.counted = 1;
+    rule.totalistic = true;
+    rule.next.assign(9*states, 0);
+    for (int n=0; n<9; ++n) {
+        rule.next[n] = (life>>n) & 1;
+        rule.next[9+n] = (life>>(9+n)) & 1 ? 1 : states > 2 ? 2 : 0;
+        for (int s=2; s<states; ++s) rule.next[9*s+n] = s+1 < states ? s+1 : 0;
+    }
+    return rule;
+}
+
+///\brief The built-in rules, CONWAY and WIREWORLD first
+deque<struct_rule>& rules() {
+    static deque<struct_rule> table;
+    if (table.empty()) {
+        addRule(table, generationsRule(lifeTable("B3/S23"), 2));
+        //cerr<<"Wireworld counts the electron heads"<<endl;
+        struct_rule wireworld;
+        wireworld.states = 4;
+        wireworld.counted = 2;
+        wireworld.totalistic = true;
+        wireworld.next.assign(36, 0);
+        for (int n=0; n<9; ++n) {
+            wireworld.next[9+n] = n==1 || n==2 ? 2 : 1;
+            wireworld.next[18+n] = 3;
+            wireworld.next[27+n] = 1;
+        }
+        addRule(table, wireworld);
+    }
+    return table;
+}
+
+const struct_rule& ruleTable(BuiltinRule rule) {
+    return rules()[rule];
+}
+
+BuiltinRule compileRule(const char* rule) {
+    //cerr<<"Inside compileRule "<<rule<<endl;
+    string s;
+    for (const char* p = rule; *p; ++p)
+        if (!isspace((unsigned char)*p)) s += toupper((unsigned char)*p);
+    if (s.find('B') == string::npos && s.find('S') == string::npos) {
+        //cerr<<"S/B notation: survivals before the slash, births after"<<endl;
+        size_t slash = s.find('/');
+        if (slash == string::npos) {
+            cout<<rule<<" is not a rulestring"<<endl;
+            exit(1);
+        }
+        s = "S"+s.substr(0, slash)+"/B"+s.substr(slash+1);
+    }
+    int states = 2;
+    char letter = 0;
+    for (size_t i=0; i<s.size(); ++i) {
+        char c = s[i];
+        if (c == 'B' || c == 'S' || c == 'C') letter = c;
+        else if (c == '/') letter = 0;
+        else if (!isdigit((unsigned char)c) || letter == 0 || (letter != 'C' && c == '9')) {
+            cout<<rule<<" is not a rulestring"<<endl;
+            exit(1);
+        }
+        if (c == 'C') states = atoi(s.c_str()+i+1);
+    }
+    if (states < 2 || states > 256) {
+        cout<<rule<<" needs from 2 to 256 states"<<endl;
+        exit(1);
+    }
+    return addRule(rules(), generationsRule(lifeTable(s.c_str()), states));
+}
+
+BuiltinRule compileRule(int states, int counted, const unsigned char next[][9]) {
+    //cerr<<"Inside compileRule of a table"<<endl;
+    if (states < 2 || states > 256 || counted < 0 || counted >= states) {
+        cout<<"A rule table needs from 2 to 256 states and a counted state among them"<<endl;
+        exit(1);
+    }
+    struct_rule rule;
+    rule.states = states;
+    rule.counted = counted;
+    rule.totalistic = true;
+    rule.next.resize(9*states);
+    for (int s=0; s<states; ++s)
+        for (int n=0; n<9; ++n) {
+            if (next[s][n] >= states) {
+                cout<<"The rule table leads to the unknown state "<<(int)next[s][n]<<endl;
+                exit(1);
+            }
+            rule.next[9*s+n] = next[s][n];
+        }
+    return addRule(rules(), rule);
+}
+
+BuiltinRule compileRule(const unsigned char next[512]) {
+    //cerr<<"Inside compileRule of a neighbourhood table"<<endl;
+    struct_rule rule;
+    rule.states = 2;
+    rule.counted = 1;
+    rule.life = 0;
+    rule.totalistic = false;
+    rule.neighbourhood.resize(512);
+    for (int i=0; i<512; ++i) {
+        if (next[i] > 1) {
+            cout<<"A neighbourhood table leads to the unknown state "<<(int)next[i]<<endl;
+            exit(1);
+        }
+        rule.neighbourhood[i] = next[i];
+    }
+    return addRule(rules(), rule);
+}
+}
@@ -0,0 +1,63 @@
+///\file GLCArule.h
+///\brief Transition tables of the built-in rules of GLCAlib.
+///
+///Internal interface between the rule compiler and the engines, not part of the public API.
+
+#ifndef GLCArule_H
+#define GLCArule_H
+
+#include <stdint.h>
+#include <vector>
+#include "GLCAlib.h"
+
+namespace GLCAlib {
+///\brief Transition table of an outer totalistic rule
+///
+///The next state of a cell depends on its state and on how many of its 8 neighbours are
+///in the counted state. Cells in a state the rule does not know die.
+///Two state rules also have the table of their 3x3 neighbourhoods, which is the whole
+///rule when it is not totalistic.
+struct struct_rule {
+    ///states of the cells, two for the Life-like rules
+    int states;
+    ///state of the neighbours that are counted
+    int counted;
+    ///next state by state and count, 9 counts per state
+    std::vector<unsigned char> next;
+    ///the rows of next padded to 16 bytes, for the byte shuffles of the vector kernels
+    std::vector<unsigned char> rows;
+    ///two state rules: bit n set when a dead cell with n live neighbours is born, bit 9+n when a live one survives
+    uint32_t life;
+    ///FALSE for two state rules defined by neighbourhood only, whose next, rows and life are empty
+    bool totalistic;
+    ///two state rules: next state by 3x3 neighbourhood, bit 3*(dy+1)+dx+1 is the cell at (dx,dy)
+    std::vector<unsigned char> neighbourhood;
+};
+
+///\brief The table of a built-in rule, CONWAY and WIREWORLD included
+const struct_rule& ruleTable(BuiltinRule rule);
+
+///\brief TRUE if a built-in rule runs on its neighbourhood table, see struct_engine::lookup_table
+inline bool lookupRule(const struct_rule& rule) {
+    return rule.states == 2 && (!rule.totalistic || engine.lookup_table);
+}
+
+///\brief TRUE if a built-in rule packs 32 cells in each R32UI texel on the GPU
+inline bool packedRule(const struct_rule& rule) {
+    return rule.states == 2 && !lookupRule(rule);
+}
+
+///\brief Bits of the counts listed after a letter of a rulestring, from shift on
+constexpr uint32_t lifeDigits(const char* s, int shift) {
+    return *s >= '0' && *s <= '8' ? (1u<<(*s-'0'+shift)) | lifeDigits(s+1, shift) : 0;
+}
+
+///\brief Births and survivals of a "Bxxx/Syyy" rulestring, see struct_rule::life
+///
+///Also evaluated at compile time, to specialize the CPU kernels of the common rules.
+constexpr uint32_t lifeTable(const char* s) {
+    return !*s ? 0 : (*s == 'B' ? lifeDigits(s+1, 0) : *s == 'S' ? lifeDigits(s+1, 9) : 0) | lifeTable(s+1);
+}
+}
+
+#endif
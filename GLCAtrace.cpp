@@ -0,0 +1,189 @@
+///\file GLCAtrace.cpp
+///\brief Instrumentation of GLCAlib.
+///
+///Counts the work of the engines and records the phases of the computations, written as
+///a Chrome trace that chrome://tracing and Perfetto display on a timeline.
+
+//includes
+#include <iostream>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <GL/glew.h>
+#include "GLCAlib.h"
+#include "GLCAtrace.h"
+
+using namespace std;
+namespace GLCAlib {
+///\brief A phase, or a sample of the counters, of the trace
+struct struct_traceEvent {
+    ///name of the phase, NULL for the counters
+    const char* name;
+    ///track of the thread that recorded it, 0 for the GPU
+    int track;
+    ///start and duration in microseconds since traceOrigin
+    double begin, duration;
+    ///the counters, for the samples
+    struct_counters values;
+};
+
+///events kept at most, the later ones are counted in traceDropped
+const size_t maxTraceEvents = 1<<20;
+
+struct_counters totals;
+///start of the timeline of the trace
+chrono::steady_clock::time_point traceOrigin = chrono::steady_clock::now();
+///the events in the order they are recorded, those of the GPU waiting for their query included
+vector<struct_traceEvent> traceEvents;
+///events not recorded since traceEvents was full
+long long traceDropped = 0;
+///guards traceEvents, recorded by the snapshot worker too
+mutex traceMutex;
+///tracks given to the threads, the GPU has track 0
+atomic<int> traceTracks(1);
+///track of the calling thread, 0 until it records its first event
+thread_local int traceTrack = 0;
+
+///GPU events waiting for their query (0 when the duration is known), in the order they were issued
+deque<pair<size_t, GLuint> > traceQueries;
+///queries already read, ready for the next GPU phases
+vector<GLuint> freeQueries;
+///TRUE while a GL_TIME_ELAPSED query is active
+bool queryActive = false;
+///end of the last GPU event on the timeline, in microseconds
+double gpuCursor = 0;
+
+///\brief Adds an event to the trace
+///@return its index, or -1 if the trace is full
+long recordEvent(const char* name, int track, chrono::steady_clock::time_point start, double seconds) {
+    struct_traceEvent e;
+    e.name = name;
+    e.track = track;
+    e.begin = chrono::duration<double, micro>(start-traceOrigin).count();
+    e.duration = seconds*1e6;
+    if (!name) e.values = totals;
+    lock_guard<mutex> lock(traceMutex);
+    if (traceEvents.size() == maxTraceEvents) {
+        ++traceDropped;
+        return -1;
+    }
+    traceEvents.push_back(e);
+    return traceEvents.size()-1;
+}
+
+///@return the track of the calling thread
+int threadTrack(void) {
+    if (traceTrack == 0) traceTrack = traceTracks++;
+    return traceTrack;
+}
+
+///\brief Places the GPU events whose queries are complete on the timeline of the GPU
+///
+///The GPU runs its work in order, so each event starts when it was issued or when the
+///previous one ended, whichever comes later.
+///@param[in] wait: if TRUE waits for all the queries, otherwise stops at the first one not complete
+void collectQueries(bool wait) {
+    while (!traceQueries.empty()) {
+        size_t i = traceQueries.front().first;
+        GLuint query = traceQueries.front().second;
+        if (query) {
+            GLuint available = wait;
+            if (!wait) glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) return;
+            GLuint64 elapsed;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            freeQueries.push_back(query);
+            //cerr<<"some drivers time the first query from 0, it can not last longer than until now"<<endl;
+            double now = chrono::duration<double, micro>(chrono::steady_clock::now()-traceOrigin).count();
+            lock_guard<mutex> lock(traceMutex);
+            traceEvents[i].duration = min(elapsed*1e-3, now-traceEvents[i].begin);
+        }
+        lock_guard<mutex> lock(traceMutex);
+        struct_traceEvent& e = traceEvents[i];
+        if (e.begin < gpuCursor) e.begin = gpuCursor;
+        gpuCursor = e.begin+e.duration;
+        traceQueries.pop_front();
+    }
+}
+
+void TraceScope::begin(bool gpu) {
+    start = chrono::steady_clock::now();
+    if (!gpu || queryActive || !GLEW_ARB_timer_query) return;
+    collectQueries(false);
+    //cerr<<"a GPU far behind the CPU makes the oldest query wait"<<endl;
+    if (traceQueries.size() > 256) collectQueries(true);
+    if (freeQueries.empty()) {
+        freeQueries.push_back(0);
+        glGenQueries(1, &freeQueries.back());
+    }
+    query = freeQueries.back();
+    freeQueries.pop_back();
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    queryActive = true;
+}
+
+void TraceScope::end() {
+    double seconds = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    recordEvent(name, threadTrack(), start, seconds);
+    if (!query) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    queryActive = false;
+    long i = recordEvent(name, 0, start, 0);
+    if (i < 0) freeQueries.push_back(query);
+    else traceQueries.push_back(make_pair((size_t)i, query));
+}
+
+void traceEvent(const char* name, chrono::steady_clock::time_point start, double seconds, bool gpu) {
+    if (!engine.trace_file) return;
+    long i = recordEvent(name, gpu ? 0 : threadTrack(), start, seconds);
+    if (gpu && i >= 0) traceQueries.push_back(make_pair((size_t)i, 0u));
+}
+
+void traceCounters(void) {
+    if (engine.trace_file) recordEvent(NULL, 0, chrono::steady_clock::now(), 0);
+}
+
+///Writes a counter sample of the trace
+void writeCounter(FILE* file, const char* name, double ts, const char* series, long long value) {
+    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"%s\":%lld}}", name, ts, series, value);
+}
+
+void writeTrace(void) {
+    //cerr<<"Inside writeTrace"<<endl;
+    collectQueries(true);
+    if (!freeQueries.empty()) glDeleteQueries(freeQueries.size(), &freeQueries[0]);
+    freeQueries.clear();
+    if (!engine.trace_file) return;
+    FILE* file = fopen(engine.trace_file, "w");
+    if (!file) {
+        cout<<"Can not write the trace "<<engine.trace_file<<endl;
+        return;
+    }
+    lock_guard<mutex> lock(traceMutex);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%lld},\"traceEvents\":[\n", traceDropped);
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GLCAlib\"}}");
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}");
+    for (int t=1; t<traceTracks; ++t)
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"CPU thread %d\"}}", t, t);
+    for (size_t i=0; i<traceEvents.size(); ++i) {
+        const struct_traceEvent& e = traceEvents[i];
+        if (e.name) {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", e.name, e.track, e.begin, e.duration);
+            continue;
+        }
+        writeCounter(file, "generations", e.begin, "generations", e.values.generations);
+        writeCounter(file, "passes", e.begin, "passes", e.values.passes);
+        writeCounter(file, "uploaded bytes", e.begin, "bytes", e.values.uploaded_bytes);
+        writeCounter(file, "read back bytes", e.begin, "bytes", e.values.readback_bytes);
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) cout<<"Can not write the trace "<<engine.trace_file<<endl;
+}
+
+struct_counters counters() {
+    return totals;
+}
+}
@@ -0,0 +1,59 @@
+///\file GLCAtrace.h
+///\brief Instrumentation of GLCAlib.
+///
+///Internal interface between the engines and the tracer, not part of the public API.
+
+#ifndef GLCAtrace_H
+#define GLCAtrace_H
+
+#include <chrono>
+#include "GLCAlib.h"
+
+namespace GLCAlib {
+///work done since the start of the program, see counters()
+extern struct_counters totals;
+
+///\brief Times a phase, from its construction to the end of its scope, when engine.trace_file is set
+///
+///The phase is timed with steady_clock on the track of the calling thread and, if gpu is
+///TRUE, with a GL_TIME_ELAPSED query on the track of the GPU. Queries are read once the GPU
+///has completed them, so the computation never waits for them. Queries do not nest: a GPU
+///phase inside another one is only timed on the CPU.
+class TraceScope {
+public:
+    ///@param[in] name: name of the phase, a string that lives as long as the program\n
+    ///@param[in] gpu: if TRUE the GPU work issued in the scope is timed too, the context must be current
+    TraceScope(const char* name, bool gpu=false) : name(engine.trace_file ? name : NULL), query(0) {
+        if (this->name) begin(gpu);
+    }
+    ~TraceScope() {
+        if (name) end();
+    }
+
+private:
+    void begin(bool gpu);
+    void end();
+
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+    unsigned int query;
+};
+
+///\brief Records a phase timed elsewhere, when engine.trace_file is set
+///@param[in] name: name of the phase, a string that lives as long as the program\n
+///@param[in] start: when it started, or was issued to the GPU\n
+///@param[in] seconds: its duration\n
+///@param[in] gpu: if TRUE on the track of the GPU
+void traceEvent(const char* name, std::chrono::steady_clock::time_point start, double seconds, bool gpu);
+
+///\brief Records the current totals, shown as graphs by the trace viewers, when engine.trace_file is set
+void traceCounters(void);
+
+///\brief Reads the queries still in flight and writes the trace to engine.trace_file, if set
+///
+///The context of the GPU phases, if any, must be current. The file holds every phase
+///recorded since the start of the program.
+void writeTrace(void);
+}
+
+#endif
@@ -0,0 +1,185 @@
+///\file GLbench.cpp
+///\brief Benchmarks of the GLCAlib backends.
+///
+///Runs Conway's Game of Life, Wireworld and the blur filter on each backend, for several
+///grid sizes and numbers of generations, and writes the times of the phases of every run
+///(see GLCAlib::timing) and their statistics as JSON, to catch regressions and size hardware.
+
+// includes
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <thread>
+#include "GLCAlib.h"
+
+///\brief The 3x3 blur of GLblur, on RGBA32F cells
+char blurShader[]="uniform sampler2DRect texture_A;" \
+                 "void main(void) {" \
+                 "    gl_FragColor = texture2DRect(texture_A, gl_TexCoord[0].st)*0.2+" \
+                 "    texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, -1.0))*0.1+" \
+                 "    texture2DRect(texture_A, gl_TexCoord[0].st + vec2(0.0, -1.0))*0.1+" \
+                 "    texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, -1.0))*0.1+" \
+                 "    texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, 0.0))*0.1+" \
+                 "    texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, 0.0))*0.1+" \
+                 "    texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, 1.0))*0.1+" \
+                 "    texture2DRect(texture_A, gl_TexCoord[0].st + vec2(0.0, 1.0))*0.1+" \
+                 "    texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, 1.0))*0.1;" \
+                 "}";
+
+///Names of the backends, as GLCAlib::Backend
+const char* backendNames[] = { "FRAGMENT", "COMPUTE", "CPU", "HASHLIFE", "HYBRID" };
+///The benchmarked rules
+const char* ruleNames[] = { "conway", "wireworld", "blur" };
+
+///\brief Statistics of a measure over the repetitions of a run
+struct struct_stats {
+    double mean, stddev, min, max;
+};
+
+///Mean, sample standard deviation and range of values
+struct_stats statistics(const std::vector<double>& values) {
+    struct_stats s = { 0, 0, values[0], values[0] };
+    for (size_t i=0; i<values.size(); ++i) {
+        s.mean += values[i]/values.size();
+        s.min = std::min(s.min, values[i]);
+        s.max = std::max(s.max, values[i]);
+    }
+    for (size_t i=0; i<values.size() && values.size() > 1; ++i)
+        s.stddev += (values[i]-s.mean)*(values[i]-s.mean)/(values.size()-1);
+    s.stddev = std::sqrt(s.stddev);
+    return s;
+}
+
+///Writes "name": {statistics} to the JSON file, indented by indent spaces
+void writeStats(FILE* json, const char* name, const std::vector<double>& values, bool last=false, int indent=8) {
+    struct_stats s = statistics(values);
+    fprintf(json, "%*s\"%s\": {\"mean\": %.9g, \"stddev\": %.9g, \"min\": %.9g, \"max\": %.9g}%s\n",
+            indent, "", name, s.mean, s.stddev, s.min, s.max, last ? "" : ",");
+}
+
+///Writes a string to the JSON file, escaping what needs to be
+void writeString(FILE* json, const char* s) {
+    fputc('"', json);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') fputc('\\', json);
+        if ((unsigned char)*s >= 32) fputc(*s, json);
+    }
+    fputc('"', json);
+}
+
+///Splits a comma separated list of numbers
+std::vector<long> numbers(const char* list) {
+    std::vector<long> values;
+    for (const char* p = list; *p; ) {
+        values.push_back(atol(p));
+        p = strchr(p, ',');
+        if (!p) break;
+        ++p;
+    }
+    return values;
+}
+
+///\brief Runs a rule once on a size x size matrix
+///
+///The initial state is the same at every repetition: a random soup for Conway, random
+///copper with a few electron heads for Wireworld, random colors for the blur.
+void runOnce(int rule, int size, int generations) {
+    srand(1);
+    size_t cells = (size_t)size*size;
+    if (rule == 2) {
+        std::vector<float> image(4*cells);
+        for (size_t i=0; i<image.size(); ++i) image[i] = (float)rand()/RAND_MAX;
+        GLCAlib::init(0, NULL, &image[0], size, size, blurShader, false, generations, GLCAlib::RGBA32F);
+        return;
+    }
+    std::vector<unsigned char> states(cells);
+    for (size_t i=0; i<cells; ++i)
+        states[i] = rule == 0 ? rand()%3 == 0 : (rand()%2 ? (rand()%20 == 0 ? 2 : 1) : 0);
+    GLCAlib::init(0, NULL, &states[0], size, size, rule == 0 ? GLCAlib::CONWAY : GLCAlib::WIREWORLD, false, generations);
+}
+
+///\brief Runs the benchmarks and writes their results
+///@param[in] argc: nuber of parameters on the command line:\n
+///@param[in] argv: holds parameters passed on the command line:\n
+///Param 1: Filename of the JSON output\n
+///Param 2 (optional): repetitions of each run (default 3), after one that is not measured\n
+///Param 3 (optional): comma separated numbers of generations (default 10,100)\n
+///Param 4 (optional): comma separated sides of the square grids (default 256,1024)\n
+///Param 5 (optional): comma separated backends among FRAGMENT, COMPUTE, CPU, HASHLIFE and HYBRID (default all)\n
+int main(int argc, char** argv) {
+    //cerr<<"main"<<endl;
+    if (argc < 2) {
+        std::cout<<"Command line parameters:\n";
+        std::cout<<"Param 1: Filename of the JSON output\n";
+        std::cout<<"Param 2 (optional): repetitions of each run (default 3)\n";
+        std::cout<<"Param 3 (optional): comma separated numbers of generations (default 10,100)\n";
+        std::cout<<"Param 4 (optional): comma separated sides of the square grids (default 256,1024)\n";
+        std::cout<<"Param 5 (optional): comma separated backends: FRAGMENT, COMPUTE, CPU, HASHLIFE, HYBRID (default all)"<<std::endl;
+        exit(0);
+    }
+    int repeats = argc > 2 ? atoi(argv[2]) : 3;
+    std::vector<long> generations = numbers(argc > 3 ? argv[3] : "10,100");
+    std::vector<long> sizes = numbers(argc > 4 ? argv[4] : "256,1024");
+    std::string backends = argc > 5 ? std::string(",")+argv[5]+"," : ",FRAGMENT,COMPUTE,CPU,HASHLIFE,HYBRID,";
+    if (repeats < 1) repeats = 1;
+
+    FILE* json = fopen(argv[1], "w");
+    if (!json) {
+        std::cout<<"Can not create "<<argv[1]<<std::endl;
+        exit(1);
+    }
+    fprintf(json, "{\n  \"timestamp\": %ld,\n  \"hardware_threads\": %u,\n  \"repeats\": %d,\n  \"runs\": [",
+            (long)time(NULL), std::thread::hardware_concurrency(), repeats);
+    bool first = true;
+    for (int rule=0; rule<3; ++rule)
+        for (int backend=GLCAlib::FRAGMENT; backend<=GLCAlib::HYBRID; ++backend) {
+            //cerr<<"the blur is a shader, it only runs on the GPU backends"<<endl;
+            if (rule == 2 && backend != GLCAlib::FRAGMENT && backend != GLCAlib::COMPUTE) continue;
+            if (backends.find(std::string(",")+backendNames[backend]+",") == std::string::npos) continue;
+            GLCAlib::engine.backend = (GLCAlib::Backend)backend;
+            for (size_t s=0; s<sizes.size(); ++s)
+                for (size_t g=0; g<generations.size(); ++g) {
+                    std::cout<<"GLbench: "<<ruleNames[rule]<<" "<<backendNames[backend]<<" "<<sizes[s]<<"x"<<sizes[s]
+                             <<", "<<generations[g]<<" generations"<<std::endl;
+                    //cerr<<"a first run warms up the caches and the program cache"<<endl;
+                    runOnce(rule, sizes[s], generations[g]);
+                    std::vector<double> rate, setup, upload, compute, gpu, readback, total;
+                    GLCAlib::struct_timing t;
+                    for (int r=0; r<repeats; ++r) {
+                        runOnce(rule, sizes[s], generations[g]);
+                        t = GLCAlib::timing();
+                        rate.push_back(t.compute > 0 ? t.cells*(double)t.generations/t.compute : 0);
+                        setup.push_back(t.setup);
+                        upload.push_back(t.upload);
+                        compute.push_back(t.compute);
+                        gpu.push_back(t.gpu);
+                        readback.push_back(t.readback);
+                        total.push_back(t.total);
+                    }
+                    fprintf(json, "%s\n    {\n      \"rule\": \"%s\",\n      \"backend\": \"%s\",\n      \"renderer\": ",
+                            first ? "" : ",", ruleNames[rule], backendNames[backend]);
+                    writeString(json, t.renderer);
+                    fprintf(json, ",\n      \"x\": %ld,\n      \"y\": %ld,\n      \"generations\": %ld,\n",
+                            sizes[s], sizes[s], t.generations);
+                    writeStats(json, "cells_per_second", rate, false, 6);
+                    fprintf(json, "      \"seconds\": {\n");
+                    writeStats(json, "setup", setup);
+                    writeStats(json, "upload", upload);
+                    writeStats(json, "compute", compute);
+                    writeStats(json, "gpu", gpu);
+                    writeStats(json, "readback", readback);
+                    writeStats(json, "total", total, true);
+                    fprintf(json, "      }\n    }");
+                    fflush(json);
+                    first = false;
+                }
+        }
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+    return 0;
+}
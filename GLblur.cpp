@@ -49,6 +49,7 @@ int N;
 ///Param 2: Filename of the output RGBA image\n
 ///Param 3: problem size x\n
 ///Param 4: problem size y\n
+///Param 5 (optional): 0=fragment shader 1=compute shader backend\n
 int main(int argc, char** argv) {
     //cerr<<"main"<<endl;
 
@@ -59,6 +60,8 @@ int main(int argc, char** argv) {
         std::cout<<"Param 2: Filename of the input RGBA image\n";
         std::cout<<"Param 3: problem size x\n";
         std::cout<<"Param 4: problem size y\n";
+        std::cout<<"Param 5 (optional): 0 = fragment shader backend\n";
+        std::cout<<"                    1 = compute shader backend"<<std::endl;
         exit(0);
     } else {
         infilename = argv[1];
@@ -66,6 +69,8 @@ int main(int argc, char** argv) {
 
         x =	atoi(argv[3]);
         y =	atoi(argv[4]);
+
+        if (argc > 5 && atoi(argv[5]) == 1) GLCAlib::engine.backend = GLCAlib::COMPUTE;
     }
 
     //cerr<<"calc texture dimensions"<<endl;
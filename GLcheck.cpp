@@ -0,0 +1,138 @@
+///\file GLcheck.cpp
+///\brief Checks that every backend computes the same generations.
+///
+///Runs the built-in and some compiled rules on seeded boards with each engine (the CPU
+///kernels, HashLife, the compute shaders with and without active tiles, the hybrid
+///split) and compares the final states with the ones of the fragment shaders, the
+///reference backend. Exits with 1 if any board differs.
+
+// includes
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "GLCAlib.h"
+
+///Boards that differ from the reference
+int failures = 0;
+
+///\brief The engine settings of a run
+struct struct_setting {
+    const char* name;
+    GLCAlib::Backend backend;
+    bool bit_sliced, lookup_table, active_tiles;
+    int steps_per_pass;
+};
+
+///Runs rule on a copy of board with the given settings
+std::vector<unsigned char> evolve(const std::vector<unsigned char>& board, int x, int y, GLCAlib::BuiltinRule rule,
+                                  int generations, const struct_setting& s) {
+    GLCAlib::engine.backend = s.backend;
+    GLCAlib::engine.cpu_bit_sliced = s.bit_sliced;
+    GLCAlib::engine.lookup_table = s.lookup_table;
+    GLCAlib::engine.active_tiles = s.active_tiles;
+    GLCAlib::engine.steps_per_pass = s.steps_per_pass;
+    std::vector<unsigned char> states(board);
+    GLCAlib::init(0, NULL, &states[0], x, y, rule, false, generations);
+    return states;
+}
+
+///\brief A seeded random board
+///@param[in] margin: cells left empty along the sides, so that a pattern of the
+///bounded matrix and the one of the unbounded HashLife universe stay the same
+std::vector<unsigned char> randomBoard(int x, int y, int states, int margin, unsigned int seed) {
+    std::vector<unsigned char> board((size_t)x*y, 0);
+    srand(seed);
+    for (int i=margin; i<y-margin; ++i)
+        for (int j=margin; j<x-margin; ++j)
+            board[(size_t)x*i+j] = rand()%3 == 0 ? 1+rand()%(states-1) : 0;
+    return board;
+}
+
+///Compares each setting with the fragment backend on a board
+void check(const char* rule, GLCAlib::BuiltinRule id, const std::vector<unsigned char>& board, int x, int y,
+           int generations, const struct_setting* settings, int count) {
+    static const struct_setting reference = { "FRAGMENT", GLCAlib::FRAGMENT, true, false, true, 1 };
+    std::vector<unsigned char> expected = evolve(board, x, y, id, generations, reference);
+    for (int k=0; k<count; ++k) {
+        std::vector<unsigned char> states = evolve(board, x, y, id, generations, settings[k]);
+        bool same = states == expected;
+        std::cerr<<"GLcheck: "<<rule<<" "<<x<<"x"<<y<<" "<<settings[k].name<<": "<<(same ? "ok" : "FAIL")<<std::endl;
+        if (!same) ++failures;
+    }
+}
+
+///\brief Runs the checks
+///
+///Needs an OpenGL context for the reference, without one the checks are skipped.
+int main(int argc, char** argv) {
+    //cerr<<"main"<<endl;
+    const struct_setting cpu[] = {
+        { "CPU bit-sliced", GLCAlib::CPU, true, false, true, 1 },
+        { "CPU bytes", GLCAlib::CPU, false, false, true, 1 },
+        { "CPU all tiles", GLCAlib::CPU, true, false, false, 1 },
+        { "COMPUTE", GLCAlib::COMPUTE, true, false, false, 1 },
+        { "COMPUTE active tiles", GLCAlib::COMPUTE, true, false, true, 1 },
+        { "HYBRID", GLCAlib::HYBRID, true, false, true, 1 },
+    };
+    const struct_setting lookup[] = {
+        { "CPU lookup table", GLCAlib::CPU, true, true, true, 1 },
+        { "FRAGMENT lookup table", GLCAlib::FRAGMENT, true, true, true, 1 },
+    };
+    const struct_setting hashlife[] = {
+        { "HASHLIFE", GLCAlib::HASHLIFE, true, false, true, 1 },
+    };
+    //cerr<<"passes of 24 generations carry the changes farther than a tile"<<endl;
+    const struct_setting blocking[] = {
+        { "COMPUTE 24 steps per pass", GLCAlib::COMPUTE, true, false, false, 24 },
+        { "COMPUTE 24 steps per pass, active tiles", GLCAlib::COMPUTE, true, false, true, 24 },
+    };
+
+    //cerr<<"the reference must run on the GPU"<<endl;
+    std::vector<unsigned char> probe(64, 0);
+    GLCAlib::engine.backend = GLCAlib::FRAGMENT;
+    GLCAlib::init(0, NULL, &probe[0], 8, 8, GLCAlib::CONWAY, false, 1);
+    if (strncmp(GLCAlib::timing().renderer, "CPU", 3) == 0) {
+        std::cout<<"GLcheck: no OpenGL context, nothing to compare with"<<std::endl;
+        return 0;
+    }
+
+    unsigned char table[3][9];
+    for (int n=0; n<9; ++n) {
+        table[0][n] = n == 2 || n == 3 ? 1 : 0;
+        table[1][n] = n == 1 ? 2 : n < 4 ? 1 : 0;
+        table[2][n] = n > 5 ? 1 : 0;
+    }
+    unsigned char neighbourhood[512];
+    for (int i=0; i<512; ++i) neighbourhood[i] = (__builtin_popcount(i & 0x0ba) + (i>>4 & 1)) % 2;
+    struct { const char* name; GLCAlib::BuiltinRule id; int states; } rules[] = {
+        { "CONWAY", GLCAlib::CONWAY, 2 },
+        { "WIREWORLD", GLCAlib::WIREWORLD, 4 },
+        { "B36/S23", GLCAlib::compileRule("B36/S23"), 2 },
+        { "B2/S/C3", GLCAlib::compileRule("B2/S/C3"), 3 },
+        { "3 state table", GLCAlib::compileRule(3, 1, table), 3 },
+    };
+    //cerr<<"odd sizes leave part of the last word, or texel, outside the board"<<endl;
+    const int sizes[][2] = { { 203, 131 }, { 64, 64 }, { 97, 33 } };
+    for (int r=0; r<5; ++r)
+        for (int s=0; s<3; ++s) {
+            int x = sizes[s][0], y = sizes[s][1];
+            check(rules[r].name, rules[r].id, randomBoard(x, y, rules[r].states, 0, 17*r+s), x, y, 37, cpu, 6);
+            if (rules[r].states == 2) check(rules[r].name, rules[r].id, randomBoard(x, y, 2, 0, 17*r+s), x, y, 37, lookup, 2);
+        }
+    check("neighbourhood table", GLCAlib::compileRule(neighbourhood), randomBoard(203, 131, 2, 0, 5), 203, 131, 37, lookup, 2);
+    for (int r=0; r<5; ++r)
+        check(rules[r].name, rules[r].id, randomBoard(200, 160, rules[r].states, 70, 3*r), 200, 160, 30, hashlife, 1);
+    //cerr<<"B1/S grows as fast as a rule can, a cell per generation"<<endl;
+    check("B1/S", GLCAlib::compileRule("B1/S"), randomBoard(256, 256, 2, 120, 9), 256, 256, 96, blocking, 2);
+    for (int r=0; r<5; ++r)
+        check(rules[r].name, rules[r].id, randomBoard(256, 256, rules[r].states, 108, 7*r), 256, 256, 96, blocking, 2);
+
+    if (failures) {
+        std::cout<<"GLcheck: "<<failures<<" boards differ from the reference"<<std::endl;
+        exit(1);
+    }
+    std::cout<<"GLcheck: all the backends agree"<<std::endl;
+    return 0;
+}
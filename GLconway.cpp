@@ -2,7 +2,7 @@
 ///\brief GPGPU-based Conway's Game of Life.
 ///
 ///Realizes the cellular automata described in http://en.wikipedia.org/wiki/Conway's_Game_of_Life using the GLCAlib library.\n
-///Provides a CPU version for performance comparison
+///Provides a run on the CPU backend for performance comparison
 
 // includes
 #include <iostream>
@@ -11,35 +11,43 @@
 
 ///\brief Implements in GLSL the rules of the Automata
 ///
+///Cells are 1 byte states (0 dead, 1 alive), so the live neighbours are just summed up.\n
 ///1. Any live cell with fewer than two live neighbours dies, as if by loneliness.\n
 ///2. Any live cell with more than three live neighbours dies, as if by overcrowding.\n
 ///3. Any live cell with two or three live neighbours lives, unchanged, to the next generationn
 ///4. Any dead cell with exactly three live neighbours comes to life.\n
-char* shader="uniform sampler2DRect texture_A;" \
+char* shader="#version 150 compatibility\n" \
+             "uniform usampler2DRect texture_A;" \
+             "out uvec4 state;" \
 
-             "int sum;" \
-             "vec4 dead = vec4(1.0,1.0,1.0,1.0);" \
-             "vec4 alive = vec4(0.0,0.0,0.0,1.0);" \
+             "uvec4 dead = uvec4(0u);" \
+             "uvec4 alive = uvec4(1u);" \
              "void main(void) {" \
-             "sum=0;" \
-             "vec4 y = texture2DRect(texture_A, gl_TexCoord[0].st);" \
+             "uint y = texture(texture_A, gl_TexCoord[0].st).r;" \
 
-             "if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, -1.0))==alive) ++sum;" \
-             "if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(0.0, -1.0))==alive) ++sum;" \
-             "if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, -1.0))==alive) ++sum;" \
+             "uint sum = texture(texture_A, gl_TexCoord[0].st + vec2(-1.0, -1.0)).r +" \
+             "           texture(texture_A, gl_TexCoord[0].st + vec2(0.0, -1.0)).r +" \
+             "           texture(texture_A, gl_TexCoord[0].st + vec2(1.0, -1.0)).r +" \
 
-             "if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, 0.0))==alive) ++sum;" \
-             "if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, 0.0))==alive) ++sum;" \
+             "           texture(texture_A, gl_TexCoord[0].st + vec2(-1.0, 0.0)).r +" \
+             "           texture(texture_A, gl_TexCoord[0].st + vec2(1.0, 0.0)).r +" \
 
-             "if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, 1.0))==alive) ++sum;" \
-             "if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(0.0, 1.0))==alive) ++sum;" \
-             "if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, 1.0))==alive) ++sum;" \
+             "           texture(texture_A, gl_TexCoord[0].st + vec2(-1.0, 1.0)).r +" \
+             "           texture(texture_A, gl_TexCoord[0].st + vec2(0.0, 1.0)).r +" \
+             "           texture(texture_A, gl_TexCoord[0].st + vec2(1.0, 1.0)).r;" \
 
-             "if (sum<2) gl_FragColor = dead;" \
-             "else if (sum>3) gl_FragColor = dead;" \
-             "else if (sum==3) gl_FragColor = alive;" \
-             "else gl_FragColor = y;" \
+             "if (sum<2u) state = dead;" \
+             "else if (sum>3u) state = dead;" \
+             "else if (sum==3u) state = alive;" \
+             "else state = uvec4(y);" \
              "}";
+///\brief Colors of the states in RGBA images
+///
+///0 is a dead cell (white), 1 is a live cell (black)
+const float palette[][4] = {
+    {1.0, 1.0, 1.0, 1.0},
+    {0.0, 0.0, 0.0, 1.0}
+};
 ///The input image filename
 char* infilename;
 ///The output image filename
@@ -54,71 +62,32 @@ int N;
 bool compareResults;
 ///If TRUE displays the Automata evolution
 bool withgui;
+///If TRUE uses the bit-packed built-in rule instead of shader
+bool builtin;
+///The built-in rule, CONWAY or a Life-like rule compiled from the command line
+GLCAlib::BuiltinRule rule;
 ///Length of the computation in generations
 long numIterations;
 
-///Performs and times the algorithm on the CPU
+///Performs and times the algorithm on the CPU backend of the library
 void CPUresults () {
     //cerr<<"Inside compareResults"<<endl;
-    float* data_A = new float[N];
-    float* data_B = new float[N];
-    GLCAlib::loadImage(data_A, infilename, N);
-    GLCAlib::loadImage(data_B, infilename, N);
-
+    float* image = new float[N];
+    unsigned char* states = new unsigned char[x*y];
+    GLCAlib::loadImage(image, infilename, N);
+    GLCAlib::encodeStates(image, states, x*y, palette, 2);
 
     //cerr<<"calc on CPU"<<endl;
-    long start=time(NULL);
-    for (long n=0; n<numIterations; ++n) {
-        for (int i=1; i<y-1; ++i) {
-            for (int j=4; j<4*(x-1); j+=4) {
-
-                //cerr<<"REPLACING THE SHADER SUBSTITUTE FOR THE SHADER"<<endl;
-                int neighbours=0;
-                if(data_A[4*x*(i-1)+j-4]==0.0) ++neighbours;
-                if(data_A[4*x*(i-1)+j]==0.0) ++neighbours;
-                if(data_A[4*x*(i-1)+j+4]==0.0) ++neighbours;
-
-                if(data_A[4*x*i+j-4]==0.0) ++neighbours;
-                if(data_A[4*x*i+j+4]==0.0) ++neighbours;
-
-                if(data_A[4*x*(i+1)+j-4]==0.0) ++neighbours;
-                if(data_A[4*x*(i+1)+j]==0.0) ++neighbours;
-                if(data_A[4*x*(i+1)+j+4]==0.0) ++neighbours;
-
-                //cerr<<"DIES"<<endl;
-                if (neighbours<2 || neighbours>3) {
-                    data_B[4*x*i+j]=1.0;
-                    data_B[4*x*i+j+1]=1.0;
-                    data_B[4*x*i+j+2]=1.0;
-                    data_B[4*x*i+j+3]=1.0;
-                } else if (neighbours==3) {
-                    //cerr<<"LIVES"<<endl;
-                    data_B[4*x*i+j]=0.0;
-                    data_B[4*x*i+j+1]=0.0;
-                    data_B[4*x*i+j+2]=0.0;
-                    data_B[4*x*i+j+3]=1.0;
-                } else {
-                    //cerr<<"THE SAME"<<endl;
-                    data_B[4*x*i+j]=data_A[4*x*i+j];
-                    data_B[4*x*i+j+1]=data_A[4*x*i+j+1];
-                    data_B[4*x*i+j+2]=data_A[4*x*i+j+2];
-                    data_B[4*x*i+j+3]=data_A[4*x*i+j+3];
-                }
-            }
-        }
-
-        float* tmp=data_B;
-        data_B=data_A;
-        data_A=tmp;
-    }
-    long end = time(NULL);
-    long total = end-start;
-    if (total>0) std::cout<<"CPU Iterations/sec: "<<numIterations/total<<std::endl;
+    GLCAlib::Backend backend = GLCAlib::engine.backend;
+    GLCAlib::engine.backend = GLCAlib::CPU;
+    GLCAlib::init(0, NULL, states, x, y, rule, false, numIterations);
+    GLCAlib::engine.backend = backend;
 
-    GLCAlib::saveImage(data_A,strcat(outfilename, "CPU.rgba") , N);
+    GLCAlib::decodeStates(states, image, x*y, palette, 2);
+    GLCAlib::saveImage(image, strcat(outfilename, "CPU.rgba"), N);
 
-    delete[] data_A;
-    delete[] data_B;
+    delete[] states;
+    delete[] image;
 }
 
 ///\brief Just reads input and calls GLCAlib functions
@@ -134,6 +103,8 @@ void CPUresults () {
 ///Param 5: 0=no comparison of results 1=compare GPU and CPU perfomances\n
 ///Param 6: number of iterations\n
 ///Param 7: 0=noGUI 1=GUI version\n
+///Param 8 (optional): 0=GLSL shader 1=bit-packed built-in rule 2=built-in rule on the CPU backend 3=built-in rule on HashLife 4=built-in rule shared by GPU and CPU 5=built-in rule on its lookup table\n
+///Param 9 (optional): rulestring of a Life-like rule for the built-in rule, as B36/S23 (default B3/S23)\n
 int main(int argc, char** argv) {
     //cerr<<"main"<<endl;
 
@@ -148,7 +119,14 @@ int main(int argc, char** argv) {
         std::cout<<"         1 = compare GPU vs CPU\n";
         std::cout<<"Param 6: number of iterations\n";
         std::cout<<"Param 7: 0 = no GUI\n";
-        std::cout<<"         1 = GUI"<<std::endl;
+        std::cout<<"         1 = GUI\n";
+        std::cout<<"Param 8 (optional): 0 = GLSL shader\n";
+        std::cout<<"                    1 = bit-packed built-in rule\n";
+        std::cout<<"                    2 = built-in rule on the CPU backend\n";
+        std::cout<<"                    3 = built-in rule on HashLife\n";
+        std::cout<<"                    4 = built-in rule shared by the GPU and the CPU\n";
+        std::cout<<"                    5 = built-in rule on its lookup table\n";
+        std::cout<<"Param 9 (optional): rulestring of a Life-like built-in rule, as B36/S23 (default B3/S23)"<<std::endl;
         exit(0);
     } else {
         infilename = argv[1];
@@ -182,6 +160,13 @@ int main(int argc, char** argv) {
             std::cout<<"unknown parameter, exit"<<std::endl;
             exit(1);
         }
+
+        builtin = argc > 8 && atoi(argv[8]) >= 1 && atoi(argv[8]) <= 5;
+        if (argc > 8 && atoi(argv[8]) == 2) GLCAlib::engine.backend = GLCAlib::CPU;
+        if (argc > 8 && atoi(argv[8]) == 3) GLCAlib::engine.backend = GLCAlib::HASHLIFE;
+        if (argc > 8 && atoi(argv[8]) == 4) GLCAlib::engine.backend = GLCAlib::HYBRID;
+        if (argc > 8 && atoi(argv[8]) == 5) GLCAlib::engine.lookup_table = true;
+        rule = argc > 9 ? GLCAlib::compileRule(argv[9]) : GLCAlib::CONWAY;
     }
 
     //cerr<<"calc texture dimensions"<<endl;
@@ -189,7 +174,16 @@ int main(int argc, char** argv) {
     N=4*x*y;
     float* image = new float[N];
     GLCAlib::loadImage(image, infilename, N);
-    GLCAlib::init(argc, argv, image, x, y, shader, withgui, numIterations);
+    //cells are stored as 1 byte states
+    unsigned char* states = new unsigned char[x*y];
+    GLCAlib::encodeStates(image, states, x*y, palette, 2);
+    GLCAlib::engine.palette = palette;
+    GLCAlib::engine.palette_colors = 2;
+    if (builtin)
+        GLCAlib::init(argc, argv, states, x, y, rule, withgui, numIterations);
+    else
+        GLCAlib::init(argc, argv, states, x, y, shader, withgui, numIterations, GLCAlib::R8UI);
+    GLCAlib::decodeStates(states, image, x*y, palette, 2);
     //std::cout<<"save"<<std::endl;
     GLCAlib::saveImage(image, outfilename, N);
     //std::cout<<"compare"<<std::endl;
@@ -2,7 +2,7 @@
 ///\brief GPGPU-based Wireworld computer.
 ///
 ///Realizes the Cellular Automata described in http://www.quinapalus.com/wi-index.html using the GLCAlib library.\n
-///Provides a CPU version for performance comparison
+///Provides a run on the CPU backend for performance comparison
 
 // includes
 #include <iostream>
@@ -11,40 +11,53 @@
 
 ///\brief Implements in GLSL the rules of the Automata
 ///
+///Cells are 1 byte states, numbered as in palette.\n
 ///1. a blank square always stays blank.\n
 ///2. an electron head always becomes an electron tail.\n
 ///3. an electron tail always becomes copper.\n
 ///4. copper stays as copper unless it has one or two neighbours that are heads, in which case it becomes an head.\n
-char* shader="uniform sampler2DRect texture_A;" \
-             "int sum;" \
-             "vec4 blank = vec4(0.0,0.0,0.0,1.0);" \
-             "vec4 copper = vec4(1.0,0.5,0.0,1.0);" \
-             "vec4 head = vec4(1.0,1.0,1.0,1.0);" \
-             "vec4 tail = vec4(0.0,1.0,1.0,1.0);" \
+char* shader="#version 150 compatibility\n" \
+             "uniform usampler2DRect texture_A;" \
+             "out uvec4 state;" \
+             "uint sum;" \
+             "const uint blank = 0u;" \
+             "const uint copper = 1u;" \
+             "const uint head = 2u;" \
+             "const uint tail = 3u;" \
              "void main(void) { " \
-             "    vec4 y = texture2DRect(texture_A, gl_TexCoord[0].st);" \
+             "    uint y = texture(texture_A, gl_TexCoord[0].st).r;" \
 
-             "    if(y==blank) gl_FragColor = blank;" \
-             "    else if(y==head) gl_FragColor = tail;" \
-             "    else if(y==tail) gl_FragColor = copper;" \
+             "    if(y==blank) state = uvec4(blank);" \
+             "    else if(y==head) state = uvec4(tail);" \
+             "    else if(y==tail) state = uvec4(copper);" \
              "    else {" \
-             "        sum=0;" \
-             "        if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, -1.0))==head) ++sum;" \
-             "        if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(0.0, -1.0))==head) ++sum;" \
-             "        if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, -1.0))==head) ++sum;" \
+             "        sum=0u;" \
+             "        if (texture(texture_A, gl_TexCoord[0].st + vec2(-1.0, -1.0)).r==head) ++sum;" \
+             "        if (texture(texture_A, gl_TexCoord[0].st + vec2(0.0, -1.0)).r==head) ++sum;" \
+             "        if (texture(texture_A, gl_TexCoord[0].st + vec2(1.0, -1.0)).r==head) ++sum;" \
 
-             "        if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, 0.0))==head) ++sum;" \
-             "        if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, 0.0))==head) ++sum;" \
+             "        if (texture(texture_A, gl_TexCoord[0].st + vec2(-1.0, 0.0)).r==head) ++sum;" \
+             "        if (texture(texture_A, gl_TexCoord[0].st + vec2(1.0, 0.0)).r==head) ++sum;" \
 
-             "        if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(-1.0, 1.0))==head) ++sum;" \
-             "        if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(0.0, 1.0))==head) ++sum;" \
-             "        if (texture2DRect(texture_A, gl_TexCoord[0].st + vec2(1.0, 1.0))==head) ++sum;" \
+             "        if (texture(texture_A, gl_TexCoord[0].st + vec2(-1.0, 1.0)).r==head) ++sum;" \
+             "        if (texture(texture_A, gl_TexCoord[0].st + vec2(0.0, 1.0)).r==head) ++sum;" \
+             "        if (texture(texture_A, gl_TexCoord[0].st + vec2(1.0, 1.0)).r==head) ++sum;" \
 
-             "        if (sum==1||sum==2) gl_FragColor = head;" \
-             "        else gl_FragColor = copper;" \
+             "        if (sum==1u||sum==2u) state = uvec4(head);" \
+             "        else state = uvec4(copper);" \
              "    }" \
              "}";
 
+///\brief Colors of the states in RGBA images
+///
+///0 blank (black), 1 copper (orange), 2 electron head (white), 3 electron tail (cyan)
+const float palette[][4] = {
+    {0.0, 0.0, 0.0, 1.0},
+    {1.0, 0.5, 0.0, 1.0},
+    {1.0, 1.0, 1.0, 1.0},
+    {0.0, 1.0, 1.0, 1.0}
+};
+
 ///The input image filename
 char* infilename;
 ///The output image filename
@@ -61,106 +74,28 @@ bool compareResults;
 bool withgui;
 ///Length of the computation in generations
 long numIterations;
+///Checkpoint file, the computation resumes from it when it exists (NULL for none)
+char* checkpointfilename = NULL;
 
-///Performs and times the algorithm on the CPU
+///Performs and times the algorithm on the CPU backend of the library
 void CPUresults () {
     //cerr<<"Inside compareResults"<<endl;
-    float* data_A = new float[N];
-    float* data_B = new float[N];
-    GLCAlib::loadImage(data_A, infilename, N);
+    float* image = new float[N];
+    unsigned char* states = new unsigned char[x*y];
+    GLCAlib::loadImage(image, infilename, N);
+    GLCAlib::encodeStates(image, states, x*y, palette, 4);
 
     //cerr<<"calc on CPU"<<endl;
-    long start=time(NULL);
-    for (long n=0; n<numIterations; ++n) {
-        for (int i=1; i<y-1; ++i) {
-            for (int j=4; j<4*x-4; j+=4) {
-
-                //cerr<<"REPLACING THE SHADER SUBSTITUTE FOR THE SHADER"<<endl;
-                //cerr<<"BLANK REMAINS BLANK"<<endl;
-                if (data_A[4*x*i+j]==0.0 && data_A[4*x*i+j+1]==0.0 && data_A[4*x*i+j+2]==0.0 && data_A[4*x*i+j+3]==1.0) {
-                    data_B[4*x*i+j]=0.0;
-                    data_B[4*x*i+j+1]=0.0;
-                    data_B[4*x*i+j+2]=0.0;
-                    data_B[4*x*i+j+3]=1.0;
-                } else if (data_A[4*x*i+j]==1.0 && data_A[4*x*i+j+1]==1.0 && data_A[4*x*i+j+2]==1.0 && data_A[4*x*i+j+3]==1.0) {
-                    //cerr<<"HEAD BECOMES TAIL"<<endl;
-                    data_B[4*x*i+j]=0.0;
-                    data_B[4*x*i+j+1]=1.0;
-                    data_B[4*x*i+j+2]=1.0;
-                    data_B[4*x*i+j+3]=1.0;
-                } else if (data_A[4*x*i+j]==0.0 && data_A[4*x*i+j+1]==1.0 && data_A[4*x*i+j+2]==1.0 && data_A[4*x*i+j+3]==1.0) {
-                    //cerr<<"TAIL BECOMES COPPER"<<endl;
-                    data_B[4*x*i+j]=1.0;
-                    data_B[4*x*i+j+1]=0.5;
-                    data_B[4*x*i+j+2]=0.0;
-                    data_B[4*x*i+j+3]=1.0;
-                } else {
-                    //cerr<<"IF COPPER"<<endl;
-                    //cerr<<"count HEADs in the neighbourhood"<<endl;
-                    float neighbours=0;
-                    if(data_A[4*x*(i-1)+j-4]==1.0 &&
-                            data_A[4*x*(i-1)+j-3]==1.0 &&
-                            data_A[4*x*(i-1)+j-2]==1.0 &&
-                            data_A[4*x*(i-1)+j-1]==1.0) ++neighbours;
-                    if(data_A[4*x*(i-1)+j]==1.0 &&
-                            data_A[4*x*(i-1)+j+1]==1.0 &&
-                            data_A[4*x*(i-1)+j+2]==1.0 &&
-                            data_A[4*x*(i-1)+j+3]==1.0) ++neighbours;
-                    if(data_A[4*x*(i-1)+j+4]==1.0 &&
-                            data_A[4*x*(i-1)+j+5]==1.0 &&
-                            data_A[4*x*(i-1)+j+6]==1.0 &&
-                            data_A[4*x*(i-1)+j+7]==1.0) ++neighbours;
-                    if(data_A[4*x*i+j-4]==1.0 &&
-                            data_A[4*x*i+j-3]==1.0 &&
-                            data_A[4*x*i+j-2]==1.0 &&
-                            data_A[4*x*i+j-1]==1.0) ++neighbours;
-                    if(data_A[4*x*i+j+4]==1.0 &&
-                            data_A[4*x*i+j+5]==1.0 &&
-                            data_A[4*x*i+j+6]==1.0 &&
-                            data_A[4*x*i+j+7]==1.0) ++neighbours;
-                    if(data_A[4*x*(i+1)+j-4]==1.0 &&
-                            data_A[4*x*(i+1)+j-3]==1.0 &&
-                            data_A[4*x*(i+1)+j-2]==1.0 &&
-                            data_A[4*x*(i+1)+j-1]==1.0) ++neighbours;
-                    if(data_A[4*x*(i+1)+j]==1.0 &&
-                            data_A[4*x*(i+1)+j+1]==1.0 &&
-                            data_A[4*x*(i+1)+j+2]==1.0 &&
-                            data_A[4*x*(i+1)+j+3]==1.0) ++neighbours;
-                    if(data_A[4*x*(i+1)+j+4]==1.0 &&
-                            data_A[4*x*(i+1)+j+5]==1.0 &&
-                            data_A[4*x*(i+1)+j+6]==1.0 &&
-                            data_A[4*x*(i+1)+j+7]==1.0) ++neighbours;
-                    //cerr<<neighbours<<endl;
-
-                    //cerr<<"BECOMES HEAD"<<endl;
-                    if (neighbours==1 || neighbours==2) {
-                        data_B[4*x*i+j]=1.0;
-                        data_B[4*x*i+j+1]=1.0;
-                        data_B[4*x*i+j+2]=1.0;
-                        data_B[4*x*i+j+3]=1.0;
-                    } else {
-                        //cerr<<"REMAINS COPPER"<<endl;
-                        data_B[4*x*i+j]=1.0;
-                        data_B[4*x*i+j+1]=0.5;
-                        data_B[4*x*i+j+2]=0.0;
-                        data_B[4*x*i+j+3]=1.0;
-                    }
-                }
-            }
-        }
+    GLCAlib::Backend backend = GLCAlib::engine.backend;
+    GLCAlib::engine.backend = GLCAlib::CPU;
+    GLCAlib::init(0, NULL, states, x, y, GLCAlib::WIREWORLD, false, numIterations);
+    GLCAlib::engine.backend = backend;
 
-        float* tmp=data_B;
-        data_B=data_A;
-        data_A=tmp;
-    }
-    long end = time(NULL);
-    long total = end-start;
-    if (total>0) std::cout<<"CPU Iterations/sec: "<<numIterations/total<<std::endl;
-
-    GLCAlib::saveImage(data_A,strcat(outfilename, "CPU.rgba") , N);
+    GLCAlib::decodeStates(states, image, x*y, palette, 4);
+    GLCAlib::saveImage(image, strcat(outfilename, "CPU.rgba"), N);
 
-    delete[] data_A;
-    delete[] data_B;
+    delete[] states;
+    delete[] image;
 }
 
 ///\brief Just reads input and calls GLCAlib functions
@@ -176,6 +111,10 @@ void CPUresults () {
 ///Param 5: 0=no comparison of results 1=compare GPU and CPU perfomances\n
 ///Param 6: number of iterations\n
 ///Param 7: 0=noGUI 1=GUI version\n
+///Param 8 (optional): 0=fragment shader 1=compute shader 2=CPU backend 3=HashLife 4=GPU and CPU together\n
+///Param 9 (optional): generations per pass of the compute shader backend\n
+///Param 10 (optional): checkpoint file, resumed if it exists\n
+///Param 11 (optional): generations between two checkpoints (default 100000)\n
 int main(int argc, char** argv) {
     //cerr<<"main"<<endl;
 
@@ -190,7 +129,15 @@ int main(int argc, char** argv) {
         std::cout<<"         1 = compare GPU vs CPU\n";
         std::cout<<"Param 6: number of iterations\n";
         std::cout<<"Param 7: 0 = no GUI\n";
-        std::cout<<"         1 = GUI"<<std::endl;
+        std::cout<<"         1 = GUI\n";
+        std::cout<<"Param 8 (optional): 0 = fragment shader backend\n";
+        std::cout<<"                    1 = compute shader backend\n";
+        std::cout<<"                    2 = CPU backend (built-in rule)\n";
+        std::cout<<"                    3 = HashLife (built-in rule)\n";
+        std::cout<<"                    4 = GPU and CPU together (built-in rule)\n";
+        std::cout<<"Param 9 (optional): generations per pass of the compute shader backend\n";
+        std::cout<<"Param 10 (optional): checkpoint file, resumed if it exists\n";
+        std::cout<<"Param 11 (optional): generations between two checkpoints (default 100000)"<<std::endl;
         exit(0);
     } else {
         infilename = argv[1];
@@ -224,6 +171,17 @@ int main(int argc, char** argv) {
             std::cout<<"unknown parameter, exit"<<std::endl;
             exit(1);
         }
+
+        if (argc > 8 && atoi(argv[8]) == 1) GLCAlib::engine.backend = GLCAlib::COMPUTE;
+        if (argc > 8 && atoi(argv[8]) == 2) GLCAlib::engine.backend = GLCAlib::CPU;
+        if (argc > 8 && atoi(argv[8]) == 3) GLCAlib::engine.backend = GLCAlib::HASHLIFE;
+        if (argc > 8 && atoi(argv[8]) == 4) GLCAlib::engine.backend = GLCAlib::HYBRID;
+        if (argc > 9) GLCAlib::engine.steps_per_pass = atoi(argv[9]);
+        if (argc > 10) {
+            checkpointfilename = argv[10];
+            GLCAlib::engine.checkpoint_file = checkpointfilename;
+            GLCAlib::engine.checkpoint_generations = argc > 11 ? atol(argv[11]) : 100000;
+        }
     }
 
     //cerr<<"calc texture dimensions"<<endl;
@@ -231,7 +189,20 @@ int main(int argc, char** argv) {
     N=4*x*y;
     float* image = new float[N];
     GLCAlib::loadImage(image, infilename, N);
-    GLCAlib::init(argc, argv, image, x, y, shader, withgui, numIterations);
+    //cells are stored as 1 byte states
+    unsigned char* states = new unsigned char[x*y];
+    GLCAlib::encodeStates(image, states, x*y, palette, 4);
+    GLCAlib::engine.palette = palette;
+    GLCAlib::engine.palette_colors = 4;
+    GLCAlib::struct_checkpoint checkpoint;
+    bool resuming = checkpointfilename && GLCAlib::checkpointInfo(checkpointfilename, &checkpoint);
+    if (GLCAlib::engine.backend == GLCAlib::CPU || GLCAlib::engine.backend == GLCAlib::HASHLIFE || GLCAlib::engine.backend == GLCAlib::HYBRID)
+        GLCAlib::init(argc, argv, states, x, y, GLCAlib::WIREWORLD, withgui, numIterations);
+    else if (resuming)
+        GLCAlib::resume(argc, argv, checkpointfilename, states, x, y, shader, withgui, numIterations, GLCAlib::R8UI);
+    else
+        GLCAlib::init(argc, argv, states, x, y, shader, withgui, numIterations, GLCAlib::R8UI);
+    GLCAlib::decodeStates(states, image, x*y, palette, 4);
     //std::cout<<"save"<<std::endl;
     GLCAlib::saveImage(image, outfilename, N);
     //std::cout<<"compare"<<std::endl;
@@ -0,0 +1,102 @@
+///\file GLwworldMPI.cpp
+///\brief Wireworld computer split among MPI ranks.
+///
+///Runs the built-in Wireworld rule of GLCAlib in the MPI mode: each rank reads, encodes,
+///evolves and writes back its own rows of the image with MPI-IO, as the checkpoints do.
+
+// includes
+#include <mpi.h>
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include "GLCAlib.h"
+
+///\brief Colors of the states in RGBA images, as in GLwworld
+const float palette[][4] = {
+    {0.0, 0.0, 0.0, 1.0},
+    {1.0, 0.5, 0.0, 1.0},
+    {1.0, 1.0, 1.0, 1.0},
+    {0.0, 1.0, 1.0, 1.0}
+};
+
+///\brief Reads the input, runs the ranks and saves the output
+///@param[in] argc: nuber of parameters on th ecommand line:\n
+///@param[in] argv: holds parameters passed on the commend line:\n
+///Param 1: Filename of the input RGBA image\n
+///Param 2: Filename of the output RGBA image\n
+///Param 3: problem size x\n
+///Param 4: problem size y\n
+///Param 5: number of iterations\n
+///Param 6 (optional): checkpoint file, resumed if it exists\n
+///Param 7 (optional): generations between two checkpoints (default 100000)\n
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (argc < 6) {
+        if (rank == 0) {
+            std::cout<<"Command line parameters:\n";
+            std::cout<<"Param 1: Filename of the input RGBA image\n";
+            std::cout<<"Param 2: Filename of the output RGBA image\n";
+            std::cout<<"Param 3: problem size x\n";
+            std::cout<<"Param 4: problem size y\n";
+            std::cout<<"Param 5: number of iterations\n";
+            std::cout<<"Param 6 (optional): checkpoint file, resumed if it exists\n";
+            std::cout<<"Param 7 (optional): generations between two checkpoints (default 100000)"<<std::endl;
+        }
+        MPI_Finalize();
+        return 0;
+    }
+    int x = atoi(argv[3]);
+    int y = atoi(argv[4]);
+    long numIterations = atol(argv[5]);
+    const char* checkpointfilename = argc > 6 ? argv[6] : NULL;
+    if (checkpointfilename) {
+        GLCAlib::engine.checkpoint_file = checkpointfilename;
+        GLCAlib::engine.checkpoint_generations = argc > 7 ? atol(argv[7]) : 100000;
+    }
+
+    //cerr<<"each rank reads and encodes its own rows, the halos come from its neighbours"<<endl;
+    int first, rows;
+    GLCAlib::slabRows(y, &first, &rows);
+    long N = 4L*x*rows;
+    MPI_Datatype pixel;
+    MPI_Type_contiguous(4, MPI_BYTE, &pixel);
+    MPI_Type_commit(&pixel);
+    //pixels beyond the end of the file are zeros, as for loadImage
+    std::vector<unsigned char> pixels(N, 0);
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, argv[1], MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        std::cout<<"Can not open "<<argv[1]<<std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_read_at_all(file, 4*(MPI_Offset)x*first, &pixels[0], x*rows, pixel, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    std::vector<float> image(N);
+    GLCAlib::bytesToFloats(&pixels[0], &image[0], N);
+    std::vector<unsigned char> slab((size_t)x*rows);
+    GLCAlib::encodeStates(&image[0], &slab[0], x*rows, palette, 4);
+
+    GLCAlib::struct_checkpoint checkpoint;
+    if (checkpointfilename && GLCAlib::checkpointInfo(checkpointfilename, &checkpoint))
+        GLCAlib::resumeMPI(checkpointfilename, &slab[0], x, y, GLCAlib::WIREWORLD, numIterations);
+    else
+        GLCAlib::initMPI(&slab[0], x, y, GLCAlib::WIREWORLD, numIterations);
+
+    //cerr<<"each rank writes its rows at their place in the image"<<endl;
+    GLCAlib::decodeStates(&slab[0], &image[0], x*rows, palette, 4);
+    GLCAlib::floatsToBytes(&image[0], &pixels[0], N);
+    if (MPI_File_open(MPI_COMM_WORLD, argv[2], MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        std::cout<<"Can not create "<<argv[2]<<std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_set_size(file, 4*(MPI_Offset)x*y);
+    if (MPI_File_write_at_all(file, 4*(MPI_Offset)x*first, &pixels[0], x*rows, pixel, MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+        std::cout<<"Can not write "<<argv[2]<<std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_close(&file);
+    MPI_Type_free(&pixel);
+    MPI_Finalize();
+    return 0;
+}